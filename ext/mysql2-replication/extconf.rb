@@ -43,6 +43,14 @@ checking_for(checking_message("--enable-debug-build option")) do
   enable_debug_build
 end
 
+checking_for(checking_message("--enable-decode-profile option")) do
+  enable_decode_profile = enable_config("decode-profile", false)
+  if enable_decode_profile
+    $defs << "-DRBM2_ENABLE_DECODE_PROFILE"
+  end
+  enable_decode_profile
+end
+
 spec = Gem::Specification.find_by_name("mysql2")
 source_dir = File.join(spec.full_gem_path, "ext", "mysql2")
 $INCFLAGS += " -I#{source_dir}"
@@ -59,4 +67,13 @@ unless PKGConfig.have_package("libmariadb")
   end
 end
 
+have_header("mysql_enc_to_ruby.h")
+have_header("ma_pvio.h", "mysql.h")
+have_header("poll.h")
+have_header("sys/mman.h")
+have_header("pthread.h")
+have_header("ruby/ractor.h")
+have_func("rb_ext_ractor_safe", "ruby.h")
+have_func("rb_ractor_make_shareable", "ruby/ractor.h")
+
 create_makefile("mysql2_replication")
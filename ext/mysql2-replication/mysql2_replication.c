@@ -1,22 +1,61 @@
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef HAVE_POLL_H
+#  include <poll.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #include <ruby.h>
 #include <ruby/encoding.h>
+#ifdef HAVE_RUBY_RACTOR_H
+#  include <ruby/ractor.h>
+#endif
 #include <ruby/thread.h>
+#include <ruby/util.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
 
 /* libmariadb */
 #include <mysql.h>
 #include <mariadb_com.h>
 #include <mariadb_rpl.h>
+#include <errmsg.h>
+#ifdef HAVE_MA_PVIO_H
+#  include <ma_pvio.h>
+#endif
 
 /* mysql2 */
 #include <client.h>
+#ifdef HAVE_MYSQL_ENC_TO_RUBY_H
+#  include <mysql_enc_to_ruby.h>
+#endif
 
 
 #ifndef RUBY_LL2NUM
 #  define RUBY_LL2NUM LL2NUM
 #endif
 
+#ifndef RUBY_TYPED_FROZEN_SHAREABLE
+#  define RUBY_TYPED_FROZEN_SHAREABLE 0
+#endif
+
+#define RBM2_EVENT_HEADER_SIZE 19
+#define RBM2_EVENT_CHECKSUM_SIZE 4
+
 
 void Init_mysql2_replication(void);
 
@@ -33,13 +72,15 @@ static VALUE rb_cMysql2ReplicationTableMapEvent;
 static VALUE rb_cMysql2ReplicationWriteRowsEvent;
 static VALUE rb_cMysql2ReplicationUpdateRowsEvent;
 static VALUE rb_cMysql2ReplicationDeleteRowsEvent;
-
-static VALUE
-rbm2_replication_rows_event_statement_end_p(VALUE self)
-{
-  return (NUM2USHORT(rb_iv_get(self, "@rows_flags")) & FL_STMT_END) ?
-    RUBY_Qtrue : RUBY_Qfalse;
-}
+static VALUE rb_cMysql2ReplicationGtidEvent;
+static VALUE rb_cMysql2ReplicationGtidListEvent;
+static VALUE rb_cMysql2ReplicationPreviousGtidsEvent;
+static VALUE rb_cMysql2ReplicationQueryEvent;
+static VALUE rb_cMysql2ReplicationXidEvent;
+static VALUE rb_cMysql2ReplicationRowsQueryEvent;
+static VALUE rb_cMysql2ReplicationHeartbeatEvent;
+static VALUE rb_cMysql2ReplicationTransaction;
+static VALUE rb_cMysql2ReplicationStats;
 
 static inline int8_t
 rbm2_read_int8(const uint8_t *data)
@@ -132,6 +173,28 @@ rbm2_read_uint40_bigendian(const uint8_t *data)
           ((uint64_t)(data[4])));
 }
 
+static inline uint64_t
+rbm2_read_uint48_bigendian(const uint8_t *data)
+{
+  return (((uint64_t)(data[0]) << 40) +
+          ((uint64_t)(data[1]) << 32) +
+          ((uint64_t)(data[2]) << 24) +
+          ((uint64_t)(data[3]) << 16) +
+          ((uint64_t)(data[4]) << 8) +
+          ((uint64_t)(data[5])));
+}
+
+static inline uint64_t
+rbm2_read_uint48(const uint8_t *data)
+{
+  return (((uint64_t)(data[0])) +
+          ((uint64_t)(data[1]) << 8) +
+          ((uint64_t)(data[2]) << 16) +
+          ((uint64_t)(data[3]) << 24) +
+          ((uint64_t)(data[4]) << 32) +
+          ((uint64_t)(data[5]) << 40));
+}
+
 static inline int64_t
 rbm2_read_int64(const uint8_t *data)
 {
@@ -144,6 +207,75 @@ rbm2_read_uint64(const uint8_t *data)
   return *((const uint64_t *)data);
 }
 
+static inline void
+rbm2_write_uint16(uint8_t *data, uint16_t value)
+{
+  data[0] = value & 0xff;
+  data[1] = (value >> 8) & 0xff;
+}
+
+static inline void
+rbm2_write_uint32(uint8_t *data, uint32_t value)
+{
+  int i;
+  for (i = 0; i < 4; i++) {
+    data[i] = (value >> (i * 8)) & 0xff;
+  }
+}
+
+static inline void
+rbm2_write_uint64(uint8_t *data, uint64_t value)
+{
+  int i;
+  for (i = 0; i < 8; i++) {
+    data[i] = (value >> (i * 8)) & 0xff;
+  }
+}
+
+static inline bool
+rbm2_read_packed_integer(const uint8_t **data,
+                         const uint8_t *data_end,
+                         uint64_t *value)
+{
+  /* https://mariadb.com/kb/en/protocol-data-types/#length-encoded-integers */
+  if (*data >= data_end) {
+    return false;
+  }
+  uint8_t first_byte = (*data)[0];
+  (*data) += 1;
+  size_t size = 0;
+  switch (first_byte) {
+  case 252:
+    size = 2;
+    break;
+  case 253:
+    size = 3;
+    break;
+  case 254:
+    size = 8;
+    break;
+  default:
+    *value = first_byte;
+    return true;
+  }
+  if ((size_t)(data_end - *data) < size) {
+    return false;
+  }
+  switch (size) {
+  case 2:
+    *value = rbm2_read_uint16(*data);
+    break;
+  case 3:
+    *value = rbm2_read_uint24(*data);
+    break;
+  default:
+    *value = rbm2_read_uint64(*data);
+    break;
+  }
+  (*data) += size;
+  return true;
+}
+
 static ID
 rbm2_column_type_to_id(enum enum_field_types column_type)
 {
@@ -221,12 +353,233 @@ rbm2_column_type_to_symbol(enum enum_field_types column_type)
   return rb_id2sym(rbm2_column_type_to_id(column_type));
 }
 
+static uint64_t
+rbm2_monotonic_time_ns(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return ((uint64_t)(time.tv_sec) * 1000000000) + time.tv_nsec;
+}
+
+/*
+ * Decode profile. It's available when the extension is built with
+ * --enable-decode-profile and it's enabled by
+ * Mysql2Replication.decode_profile_enabled = true. Entries are indexed
+ * by event type or column type. Both of them are 1 byte.
+ *
+ * Each Ractor has its own profile and its own enabled flag. Counters
+ * are updated only while the GVL is acquired. So they don't need any
+ * synchronization.
+ */
+typedef struct
+{
+  uint64_t count;
+  uint64_t n_bytes;
+  uint64_t time_ns;
+} rbm2_decode_profile_entry;
+
+typedef struct
+{
+  rbm2_decode_profile_entry fetch;
+  rbm2_decode_profile_entry events[256];
+  rbm2_decode_profile_entry metadata[256];
+  rbm2_decode_profile_entry columns[256];
+} rbm2_decode_profile;
+
+typedef struct
+{
+  bool enabled;
+  rbm2_decode_profile profile;
+} rbm2_decode_profile_state;
+
+#ifdef RBM2_ENABLE_DECODE_PROFILE
+#  ifdef HAVE_RUBY_RACTOR_H
+/* rbm2_decode_profile_state * of the current Ractor. */
+static rb_ractor_local_key_t rbm2_decode_profile_state_key;
+#  else
+static rbm2_decode_profile_state rbm2_decode_profile_global_state;
+#  endif
+#endif
+
+static rbm2_decode_profile_state *
+rbm2_decode_profile_state_get(bool create)
+{
+#ifdef RBM2_ENABLE_DECODE_PROFILE
+#  ifdef HAVE_RUBY_RACTOR_H
+  rbm2_decode_profile_state *state =
+    rb_ractor_local_storage_ptr(rbm2_decode_profile_state_key);
+  if (!state && create) {
+    state = ZALLOC(rbm2_decode_profile_state);
+    rb_ractor_local_storage_ptr_set(rbm2_decode_profile_state_key, state);
+  }
+  return state;
+#  else
+  return &rbm2_decode_profile_global_state;
+#  endif
+#else
+  /* The compiler removes all profile code. */
+  return NULL;
+#endif
+}
+
+/* Returns NULL when the decode profile isn't enabled in this Ractor. */
+static inline rbm2_decode_profile *
+rbm2_decode_profile_get(void)
+{
+  rbm2_decode_profile_state *state = rbm2_decode_profile_state_get(false);
+  if (!state || !state->enabled) {
+    return NULL;
+  }
+  return &(state->profile);
+}
+
+static inline uint64_t
+rbm2_decode_profile_start(rbm2_decode_profile *profile)
+{
+  if (!profile) {
+    return 0;
+  }
+  return rbm2_monotonic_time_ns();
+}
+
+static inline void
+rbm2_decode_profile_add(rbm2_decode_profile_entry *entry,
+                        uint64_t start_time_ns,
+                        uint64_t count,
+                        uint64_t n_bytes)
+{
+  entry->count += count;
+  entry->n_bytes += n_bytes;
+  entry->time_ns += rbm2_monotonic_time_ns() - start_time_ns;
+}
+
+typedef struct
+{
+  enum enum_field_types type;
+  uint32_t size;
+  uint32_t max_length;
+  uint32_t bits;
+  uint32_t decimals;
+  uint32_t length_size;
+  uint32_t precision;
+  uint32_t scale;
+  /*
+    The followings are parsed from the optional metadata. They're
+    available only with binlog_row_metadata=FULL.
+  */
+  bool is_unsigned;
+  /* 0 means unknown. */
+  uint32_t collation_id;
+  /* NULL means binary. String values are tagged with this. */
+  rb_encoding *encoding;
+  VALUE rb_name;
+  bool is_primary_key;
+  /* 0 means the whole value is used. */
+  uint32_t primary_key_prefix_length;
+  /* Strings of ENUM/SET values. */
+  VALUE rb_values;
+  VALUE rb_column;
+} rbm2_column;
+
+typedef struct
+{
+  uint32_t n_columns;
+  rbm2_column *columns;
+  VALUE rb_database_name;
+  VALUE rb_table_name;
+  VALUE rb_columns;
+  /* Column indexes in the primary key order or nil */
+  VALUE rb_primary_key;
+  /* Row keys for the :name row format: column names or indexes */
+  VALUE rb_column_names;
+  /* column_types, metadata and optional metadata of the TABLE_MAP_EVENT. */
+  VALUE rb_signature;
+  st_index_t signature_hash;
+} rbm2_table;
+
+static void
+rbm2_table_mark(void *data)
+{
+  rbm2_table *table = data;
+  uint32_t i;
+  for (i = 0; i < table->n_columns; i++) {
+    rb_gc_mark(table->columns[i].rb_name);
+    rb_gc_mark(table->columns[i].rb_values);
+    rb_gc_mark(table->columns[i].rb_column);
+  }
+  rb_gc_mark(table->rb_database_name);
+  rb_gc_mark(table->rb_table_name);
+  rb_gc_mark(table->rb_columns);
+  rb_gc_mark(table->rb_primary_key);
+  rb_gc_mark(table->rb_column_names);
+  rb_gc_mark(table->rb_signature);
+}
+
+static void
+rbm2_table_free(void *data)
+{
+  rbm2_table *table = data;
+  ruby_xfree(table->columns);
+  ruby_xfree(table);
+}
+
+/* Table descriptors are never changed after they're built. */
+static const rb_data_type_t rbm2_table_type = {
+  "Mysql2Replication::Table",
+  {
+    rbm2_table_mark,
+    rbm2_table_free,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE,
+};
+
+static VALUE
+rbm2_table_new(uint32_t n_columns)
+{
+  rbm2_table *table;
+  VALUE rb_table = TypedData_Make_Struct(0,
+                                         rbm2_table,
+                                         &rbm2_table_type,
+                                         table);
+  table->columns = ZALLOC_N(rbm2_column, n_columns);
+  table->n_columns = n_columns;
+  uint32_t i;
+  for (i = 0; i < n_columns; i++) {
+    table->columns[i].rb_name = RUBY_Qnil;
+    table->columns[i].rb_values = RUBY_Qnil;
+    table->columns[i].rb_column = RUBY_Qnil;
+  }
+  table->rb_database_name = RUBY_Qnil;
+  table->rb_table_name = RUBY_Qnil;
+  table->rb_columns = RUBY_Qnil;
+  table->rb_primary_key = RUBY_Qnil;
+  table->rb_column_names = RUBY_Qnil;
+  table->rb_signature = RUBY_Qnil;
+  table->signature_hash = 0;
+  return rb_table;
+}
+
+static inline rbm2_table *
+rbm2_table_get(VALUE rb_table)
+{
+  rbm2_table *table;
+  TypedData_Get_Struct(rb_table, rbm2_table, &rbm2_table_type, table);
+  return table;
+}
+
 static void
-rbm2_metadata_parse(enum enum_field_types *column_type,
+rbm2_metadata_parse(rbm2_column *column,
                     const uint8_t **metadata,
-                    VALUE rb_column)
+                    rbm2_decode_profile *profile)
 {
-  switch (*column_type) {
+  uint64_t start_time_ns = rbm2_decode_profile_start(profile);
+  const uint8_t *metadata_start = *metadata;
+  /* MYSQL_TYPE_STRING may be changed to the real type. */
+  uint8_t type = column->type;
+  VALUE rb_column = column->rb_column;
+  switch (column->type) {
   case MYSQL_TYPE_DECIMAL:
   case MYSQL_TYPE_TINY:
   case MYSQL_TYPE_SHORT:
@@ -234,9 +587,10 @@ rbm2_metadata_parse(enum enum_field_types *column_type,
     break;
   case MYSQL_TYPE_FLOAT:
   case MYSQL_TYPE_DOUBLE:
+    column->size = (*metadata)[0];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("size")),
-                 UINT2NUM((*metadata)[0]));
+                 UINT2NUM(column->size));
     (*metadata) += 1;
     break;
   case MYSQL_TYPE_NULL:
@@ -250,1172 +604,7990 @@ rbm2_metadata_parse(enum enum_field_types *column_type,
   case MYSQL_TYPE_NEWDATE:
     break;
   case MYSQL_TYPE_VARCHAR:
+    column->max_length = rbm2_read_uint16(*metadata);
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("max_length")),
-                 UINT2NUM(rbm2_read_uint16(*metadata)));
+                 UINT2NUM(column->max_length));
     (*metadata) += 2;
     break;
   case MYSQL_TYPE_BIT:
     {
       uint8_t bits = (*metadata)[0];
       uint8_t bytes = (*metadata)[1];
+      column->bits = (bytes * 8) + bits;
       rb_hash_aset(rb_column,
                    rb_id2sym(rb_intern("bits")),
-                   UINT2NUM((bytes * 8) + bits));
+                   UINT2NUM(column->bits));
       (*metadata) += 2;
     }
     break;
   case MYSQL_TYPE_TIMESTAMP2:
   case MYSQL_TYPE_DATETIME2:
   case MYSQL_TYPE_TIME2:
+    column->decimals = (*metadata)[0];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("decimals")),
-                 UINT2NUM((*metadata)[0]));
+                 UINT2NUM(column->decimals));
     (*metadata) += 1;
     break;
   case MYSQL_TYPE_JSON:
+    column->length_size = (*metadata)[0];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("length_size")),
-                 UINT2NUM((*metadata)[0]));
+                 UINT2NUM(column->length_size));
     (*metadata) += 1;
     break;
   case MYSQL_TYPE_NEWDECIMAL:
+    column->precision = (*metadata)[0];
+    column->scale = (*metadata)[1];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("precision")),
-                 UINT2NUM((*metadata)[0]));
+                 UINT2NUM(column->precision));
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("scale")),
-                 UINT2NUM((*metadata)[1]));
+                 UINT2NUM(column->scale));
     (*metadata) += 2;
     break;
   case MYSQL_TYPE_ENUM:
   case MYSQL_TYPE_SET:
+    column->size = (*metadata)[1];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("size")),
-                 UINT2NUM((*metadata)[1]));
+                 UINT2NUM(column->size));
     (*metadata) += 2;
     break;
   case MYSQL_TYPE_TINY_BLOB:
   case MYSQL_TYPE_MEDIUM_BLOB:
   case MYSQL_TYPE_LONG_BLOB:
+    /* These types don't have metadata. The type implies the length size. */
+    switch (column->type) {
+    case MYSQL_TYPE_TINY_BLOB:
+      column->length_size = 1;
+      break;
+    case MYSQL_TYPE_MEDIUM_BLOB:
+      column->length_size = 3;
+      break;
+    default:
+      column->length_size = 4;
+      break;
+    }
+    rb_hash_aset(rb_column,
+                 rb_id2sym(rb_intern("length_size")),
+                 UINT2NUM(column->length_size));
     break;
   case MYSQL_TYPE_BLOB:
+    column->length_size = (*metadata)[0];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("length_size")),
-                 UINT2NUM((*metadata)[0]));
+                 UINT2NUM(column->length_size));
     (*metadata) += 1;
     break;
   case MYSQL_TYPE_VAR_STRING:
   case MYSQL_TYPE_STRING:
     {
       /* See also Field_string::do_save_field_metadata() */
-      *column_type = (*metadata)[0];
-      switch (*column_type) {
+      column->type = (*metadata)[0];
+      switch (column->type) {
       case MYSQL_TYPE_ENUM:
       case MYSQL_TYPE_SET:
+        column->size = (*metadata)[1];
         rb_hash_aset(rb_column,
                      rb_id2sym(rb_intern("size")),
-                     UINT2NUM((*metadata)[1]));
+                     UINT2NUM(column->size));
         break;
       default:
+        column->max_length =
+          (((((*metadata)[0] >> 4) & 0x03) ^ 0x03) << 8) + (*metadata)[1];
         rb_hash_aset(rb_column,
                      rb_id2sym(rb_intern("max_length")),
-                     UINT2NUM((((((*metadata)[0] >> 4) & 0x03) ^ 0x03) << 8) +
-                              (*metadata)[1]));
+                     UINT2NUM(column->max_length));
         break;
       }
       (*metadata) += 2;
     }
     break;
   case MYSQL_TYPE_GEOMETRY:
+    column->length_size = (*metadata)[0];
     rb_hash_aset(rb_column,
                  rb_id2sym(rb_intern("length_size")),
-                 UINT2NUM((*metadata)[0]));
+                 UINT2NUM(column->length_size));
     (*metadata) += 1;
     break;
   default:
     break;
   }
+  if (profile) {
+    rbm2_decode_profile_add(&(profile->metadata[type]),
+                            start_time_ns,
+                            1,
+                            *metadata - metadata_start);
+  }
 }
 
-static inline VALUE
-rbm2_column_parse_variable_size_uint(VALUE rb_column,
-                                     const uint8_t **row_data)
+/*
+ * The optional metadata of a TABLE_MAP_EVENT. libmariadb doesn't
+ * parse it. It's the rest of the TABLE_MAP_EVENT after the NULL
+ * bitmap.
+ *
+ * https://dev.mysql.com/doc/dev/mysql-server/latest/classmysql_1_1binlog_1_1event_1_1Table__map__event.html
+ */
+typedef struct
 {
-  VALUE rb_size = rb_hash_aref(rb_column, rb_id2sym(rb_intern("size")));
-  uint32_t size = NUM2UINT(rb_size);
-  VALUE rb_value = RUBY_Qnil;
-  switch (size) {
-  case 1:
-    rb_value = USHORT2NUM(rbm2_read_uint8(*row_data));
-    break;
-  case 2:
-    rb_value = USHORT2NUM(rbm2_read_uint16(*row_data));
-    break;
-  case 3:
-    rb_value = UINT2NUM(rbm2_read_uint24(*row_data));
-    break;
-  case 4:
-    rb_value = UINT2NUM(rbm2_read_uint32(*row_data));
-    break;
+  const uint8_t *data;
+  size_t size;
+  /* Geometry columns have charset in MariaDB. */
+  bool is_mariadb;
+} rbm2_optional_metadata;
+
+#define RBM2_OPTIONAL_METADATA_SIGNEDNESS 1
+#define RBM2_OPTIONAL_METADATA_DEFAULT_CHARSET 2
+#define RBM2_OPTIONAL_METADATA_COLUMN_CHARSET 3
+#define RBM2_OPTIONAL_METADATA_COLUMN_NAME 4
+#define RBM2_OPTIONAL_METADATA_SET_STR_VALUE 5
+#define RBM2_OPTIONAL_METADATA_ENUM_STR_VALUE 6
+#define RBM2_OPTIONAL_METADATA_GEOMETRY_TYPE 7
+#define RBM2_OPTIONAL_METADATA_SIMPLE_PRIMARY_KEY 8
+#define RBM2_OPTIONAL_METADATA_PRIMARY_KEY_WITH_PREFIX 9
+#define RBM2_OPTIONAL_METADATA_ENUM_AND_SET_DEFAULT_CHARSET 10
+#define RBM2_OPTIONAL_METADATA_ENUM_AND_SET_COLUMN_CHARSET 11
+
+static rb_encoding *
+rbm2_collation_to_encoding(uint32_t collation_id)
+{
+#ifdef HAVE_MYSQL_ENC_TO_RUBY_H
+  if (collation_id == 0 || collation_id - 1 >= CHARSETNR_SIZE) {
+    return NULL;
+  }
+  const char *name = mysql2_mysql_enc_to_rb[collation_id - 1];
+  if (!name) {
+    return NULL;
+  }
+  int index = rb_enc_find_index(name);
+  if (index < 0) {
+    return NULL;
+  }
+  return rb_enc_from_index(index);
+#else
+  return NULL;
+#endif
+}
+
+static bool
+rbm2_column_is_numeric(const rbm2_column *column)
+{
+  switch (column->type) {
+  case MYSQL_TYPE_TINY:
+  case MYSQL_TYPE_SHORT:
+  case MYSQL_TYPE_INT24:
+  case MYSQL_TYPE_LONG:
+  case MYSQL_TYPE_LONGLONG:
+  case MYSQL_TYPE_NEWDECIMAL:
+  case MYSQL_TYPE_FLOAT:
+  case MYSQL_TYPE_DOUBLE:
+    return true;
   default:
-    rb_raise(rb_eNotImpError,
-             "unsupported size for variable size uint: %u: %+" PRIsVALUE,
-             size,
-             rb_column);
-    break;
+    return false;
   }
-  (*row_data) += size;
-  return rb_value;
 }
 
-static inline VALUE
-rbm2_column_parse_variable_length_string(VALUE rb_column,
-                                         const uint8_t **row_data)
+static bool
+rbm2_column_is_character(const rbm2_column *column,
+                         const rbm2_optional_metadata *optional_metadata)
 {
-  /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_varchar-and-other-variable-length-string-types */
-  uint32_t max_length =
-    NUM2UINT(rb_hash_aref(rb_column,
-                          rb_id2sym(rb_intern("max_length"))));
-  VALUE rb_value;
-  if (max_length > 255) {
-    uint16_t length = rbm2_read_uint16(*row_data);
-    (*row_data) += 2;
-    rb_value = rb_str_new((const char *)(*row_data),
-                          length);
-    (*row_data) += length;
+  switch (column->type) {
+  case MYSQL_TYPE_STRING:
+  case MYSQL_TYPE_VAR_STRING:
+  case MYSQL_TYPE_VARCHAR:
+  case MYSQL_TYPE_BLOB:
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+    return true;
+  case MYSQL_TYPE_GEOMETRY:
+    return optional_metadata->is_mariadb;
+  default:
+    return false;
+  }
+}
+
+static bool
+rbm2_column_is_enum_or_set(const rbm2_column *column)
+{
+  return column->type == MYSQL_TYPE_ENUM || column->type == MYSQL_TYPE_SET;
+}
+
+typedef bool (*rbm2_column_predicate)(const rbm2_column *column,
+                                      const rbm2_optional_metadata *metadata);
+
+static bool
+rbm2_column_is_character_predicate(const rbm2_column *column,
+                                   const rbm2_optional_metadata *metadata)
+{
+  return rbm2_column_is_character(column, metadata);
+}
+
+static bool
+rbm2_column_is_enum_or_set_predicate(const rbm2_column *column,
+                                     const rbm2_optional_metadata *metadata)
+{
+  return rbm2_column_is_enum_or_set(column);
+}
+
+static rbm2_column *
+rbm2_table_find_nth_column(rbm2_table *table,
+                           uint64_t n,
+                           rbm2_column_predicate predicate,
+                           const rbm2_optional_metadata *optional_metadata)
+{
+  uint32_t i;
+  for (i = 0; i < table->n_columns; i++) {
+    rbm2_column *column = &(table->columns[i]);
+    if (!predicate(column, optional_metadata)) {
+      continue;
+    }
+    if (n == 0) {
+      return column;
+    }
+    n--;
+  }
+  return NULL;
+}
+
+static void
+rbm2_column_set_collation(rbm2_column *column, uint64_t collation_id)
+{
+  column->collation_id = collation_id;
+  column->encoding = rbm2_collation_to_encoding(column->collation_id);
+}
+
+static bool
+rbm2_optional_metadata_parse_default_charset(
+  rbm2_table *table,
+  const uint8_t *data,
+  const uint8_t *data_end,
+  rbm2_column_predicate predicate,
+  const rbm2_optional_metadata *optional_metadata)
+{
+  uint64_t default_collation_id;
+  if (!rbm2_read_packed_integer(&data, data_end, &default_collation_id)) {
+    return false;
+  }
+  uint32_t i;
+  for (i = 0; i < table->n_columns; i++) {
+    rbm2_column *column = &(table->columns[i]);
+    if (predicate(column, optional_metadata)) {
+      rbm2_column_set_collation(column, default_collation_id);
+    }
+  }
+  while (data < data_end) {
+    uint64_t index;
+    uint64_t collation_id;
+    if (!rbm2_read_packed_integer(&data, data_end, &index) ||
+        !rbm2_read_packed_integer(&data, data_end, &collation_id)) {
+      return false;
+    }
+    rbm2_column *column =
+      rbm2_table_find_nth_column(table, index, predicate, optional_metadata);
+    if (!column) {
+      return false;
+    }
+    rbm2_column_set_collation(column, collation_id);
+  }
+  return true;
+}
+
+static bool
+rbm2_optional_metadata_parse_column_charset(
+  rbm2_table *table,
+  const uint8_t *data,
+  const uint8_t *data_end,
+  rbm2_column_predicate predicate,
+  const rbm2_optional_metadata *optional_metadata)
+{
+  uint32_t i;
+  for (i = 0; i < table->n_columns && data < data_end; i++) {
+    rbm2_column *column = &(table->columns[i]);
+    if (!predicate(column, optional_metadata)) {
+      continue;
+    }
+    uint64_t collation_id;
+    if (!rbm2_read_packed_integer(&data, data_end, &collation_id)) {
+      return false;
+    }
+    rbm2_column_set_collation(column, collation_id);
+  }
+  return true;
+}
+
+static bool
+rbm2_optional_metadata_read_string(const uint8_t **data,
+                                   const uint8_t *data_end,
+                                   rb_encoding *encoding,
+                                   VALUE *rb_string)
+{
+  uint64_t length;
+  if (!rbm2_read_packed_integer(data, data_end, &length)) {
+    return false;
+  }
+  if ((uint64_t)(data_end - *data) < length) {
+    return false;
+  }
+  if (encoding) {
+    *rb_string = rb_enc_str_new((const char *)(*data), length, encoding);
   } else {
-    uint8_t length = rbm2_read_uint8(*row_data);
-    (*row_data) += 1;
-    rb_value = rb_str_new((const char *)(*row_data),
-                          length);
-    (*row_data) += length;
+    *rb_string = rb_str_new((const char *)(*data), length);
   }
-  return rb_value;
+  rb_obj_freeze(*rb_string);
+  (*data) += length;
+  return true;
 }
 
-static inline VALUE
-rbm2_column_parse_blob(VALUE rb_column,
-                       const uint8_t **row_data)
+static bool
+rbm2_optional_metadata_parse_values(rbm2_table *table,
+                                    const uint8_t *data,
+                                    const uint8_t *data_end,
+                                    enum enum_field_types type)
 {
-  /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_blob-and-other-blob-types */
-  uint32_t length_size =
-    NUM2UINT(rb_hash_aref(rb_column,
-                          rb_id2sym(rb_intern("length_size"))));
-  VALUE rb_value;
-  switch (length_size) {
-  case 1:
-    {
-      uint8_t length = rbm2_read_uint8(*row_data);
-      (*row_data) += 1;
-      rb_value = rb_str_new((const char *)(*row_data),
-                            length);
-      (*row_data) += length;
+  uint32_t i;
+  for (i = 0; i < table->n_columns && data < data_end; i++) {
+    rbm2_column *column = &(table->columns[i]);
+    if (column->type != type) {
+      continue;
     }
-    break;
-  case 2:
-    {
-      uint16_t length = rbm2_read_uint16(*row_data);
-      (*row_data) += 2;
-      rb_value = rb_str_new((const char *)(*row_data),
-                            length);
-      (*row_data) += length;
+    uint64_t n_values;
+    if (!rbm2_read_packed_integer(&data, data_end, &n_values)) {
+      return false;
     }
-    break;
-  case 3:
-    {
-      uint32_t length = rbm2_read_uint24(*row_data);
-      (*row_data) += 3;
-      rb_value = rb_str_new((const char *)(*row_data),
-                            length);
-      (*row_data) += length;
+    if ((uint64_t)(data_end - data) < n_values) {
+      return false;
     }
-    break;
-  case 4:
-    {
-      uint32_t length = rbm2_read_uint32(*row_data);
-      (*row_data) += 4;
-      rb_value = rb_str_new((const char *)(*row_data),
-                            length);
-      (*row_data) += length;
+    VALUE rb_values = rb_ary_new_capa(n_values);
+    uint64_t j;
+    for (j = 0; j < n_values; j++) {
+      VALUE rb_value;
+      if (!rbm2_optional_metadata_read_string(&data,
+                                              data_end,
+                                              column->encoding,
+                                              &rb_value)) {
+        return false;
+      }
+      rb_ary_push(rb_values, rb_value);
     }
-    break;
-  default:
-    rb_raise(rb_eNotImpError,
-             "unsupported length size for blob: %u: %+" PRIsVALUE,
-             length_size,
-             rb_column);
-    break;
+    column->rb_values = rb_obj_freeze(rb_values);
   }
-  return rb_value;
+  return true;
 }
 
-static VALUE
-rbm2_column_parse(VALUE rb_column, const uint8_t **row_data)
+static bool
+rbm2_optional_metadata_parse_primary_key(rbm2_table *table,
+                                         const uint8_t *data,
+                                         const uint8_t *data_end,
+                                         bool with_prefix)
 {
-  VALUE rb_value = RUBY_Qnil;
-  VALUE rb_type = rb_hash_aref(rb_column, rb_id2sym(rb_intern("type")));
-  VALUE rb_type_id = rb_hash_aref(rb_column, rb_id2sym(rb_intern("type_id")));
-  enum enum_field_types type = NUM2UINT(rb_type_id);
-  switch (type) {
-  case MYSQL_TYPE_DECIMAL:
-    rb_raise(rb_eNotImpError,
-             "decimal type isn't implemented yet: %+" PRIsVALUE ": %+" PRIsVALUE,
-             rb_type,
-             rb_column);
-    break;
-  case MYSQL_TYPE_TINY:
-    rb_value = RB_CHR2FIX(*(*row_data));
-    (*row_data) += 1;
-    break;
-  case MYSQL_TYPE_SHORT:
-    rb_value = RB_INT2NUM(rbm2_read_int16(*row_data));
-    (*row_data) += 2;
-    break;
-  case MYSQL_TYPE_LONG:
-    rb_value = RB_INT2NUM(rbm2_read_int32(*row_data));
-    (*row_data) += 4;
-    break;
-  case MYSQL_TYPE_FLOAT:
-    rb_value = rb_float_new(*((const float *)(*row_data)));
-    (*row_data) += 4;
-    break;
-  case MYSQL_TYPE_DOUBLE:
-    rb_value = rb_float_new(*((const double *)(*row_data)));
-    (*row_data) += 8;
-    break;
-  case MYSQL_TYPE_NULL:
-    break;
-  case MYSQL_TYPE_TIMESTAMP:
-    rb_value = rb_funcall(rb_cTime,
-                          rb_intern("at"),
-                          1,
-                          RB_UINT2NUM(rbm2_read_uint32(*row_data)));
-    (*row_data) += 4;
-    break;
-  case MYSQL_TYPE_LONGLONG:
-    rb_value = RB_LL2NUM(rbm2_read_int64(*row_data));
-    (*row_data) += 8;
-    break;
-  case MYSQL_TYPE_INT24:
-    rb_value = RB_INT2NUM(rbm2_read_int24(*row_data));
-    (*row_data) += 3;
-    break;
-  case MYSQL_TYPE_DATE:
-    {
-      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_date */
-      uint32_t raw_date = rbm2_read_uint24(*row_data);
-      /*
-        YYYYYYYMMMMDDDDD
-        Y: 6bit
-        M: 4bit
-        D: 5bit
-      */
-      if (raw_date == 0) {
-        rb_value = rb_funcall(rb_cDate,
-                              rb_intern("new"),
-                              3,
-                              RB_UINT2NUM(0),
-                              RB_UINT2NUM(1),
-                              RB_UINT2NUM(1));
-      } else {
-        rb_value = rb_funcall(rb_cDate,
-                              rb_intern("new"),
-                              3,
-                              RB_UINT2NUM((raw_date >> 9)),
-                              RB_UINT2NUM((raw_date >> 5) & ((1 << 4) - 1)),
-                              RB_UINT2NUM((raw_date & ((1 << 5) - 1))));
-      }
-      (*row_data) += 3;
+  VALUE rb_primary_key = rb_ary_new();
+  while (data < data_end) {
+    uint64_t index;
+    uint64_t prefix_length = 0;
+    if (!rbm2_read_packed_integer(&data, data_end, &index)) {
+      return false;
     }
-    break;
-  case MYSQL_TYPE_TIME:
-    {
-      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_time */
-      uint32_t raw_time = rbm2_read_uint24(*row_data);
-      /* HHMMSS */
-      rb_value = rb_sprintf("%02u:%02u:%02u",
-                            (raw_time / (10 * 4)),
-                            (raw_time % (10 * 4)) / (10 * 2),
-                            (raw_time % (10 * 2)));
-      (*row_data) += 3;
+    if (with_prefix &&
+        !rbm2_read_packed_integer(&data, data_end, &prefix_length)) {
+      return false;
     }
-    break;
-  case MYSQL_TYPE_DATETIME:
-    {
-      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_datetime */
-      uint64_t raw_time = rbm2_read_uint64(*row_data);
-      /* YYYYMMDDHHMMSS */
-      if (raw_time == 0) {
-        rb_value = rb_funcall(rb_cTime,
-                              rb_intern("utc"),
-                              1,
-                              RB_UINT2NUM(0));
-      } else {
-        rb_value = rb_funcall(rb_cTime,
-                              rb_intern("utc"),
-                              6,
-                              RB_UINT2NUM((raw_time / 10000000000)),
-                              RB_UINT2NUM((raw_time % 10000000000) / 100000000),
-                              RB_UINT2NUM((raw_time %   100000000) /   1000000),
-                              RB_UINT2NUM((raw_time %     1000000) /     10000),
-                              RB_UINT2NUM((raw_time %       10000) /       100),
-                              RB_UINT2NUM((raw_time %         100)));
-      }
-      (*row_data) += 8;
+    if (index >= table->n_columns) {
+      return false;
     }
-    break;
-  case MYSQL_TYPE_YEAR:
-    rb_value = RB_UINT2NUM(rbm2_read_uint8(*row_data) + 1900);
-    (*row_data) += 1;
-    break;
-  case MYSQL_TYPE_NEWDATE:
-    rb_raise(rb_eNotImpError,
-             "newdate type isn't implemented yet: %+" PRIsVALUE ": %+" PRIsVALUE,
-             rb_type,
-             rb_column);
-    break;
-  case MYSQL_TYPE_VARCHAR:
-    rb_value = rbm2_column_parse_variable_length_string(rb_column, row_data);
-    break;
-  case MYSQL_TYPE_BIT:
+    rbm2_column *column = &(table->columns[index]);
+    column->is_primary_key = true;
+    column->primary_key_prefix_length = prefix_length;
+    rb_ary_push(rb_primary_key, ULL2NUM(index));
+  }
+  table->rb_primary_key = rb_obj_freeze(rb_primary_key);
+  return true;
+}
+
+static bool
+rbm2_optional_metadata_parse_field(rbm2_table *table,
+                                   uint8_t type,
+                                   const uint8_t *data,
+                                   const uint8_t *data_end,
+                                   const rbm2_optional_metadata *metadata)
+{
+  uint32_t i;
+  switch (type) {
+  case RBM2_OPTIONAL_METADATA_SIGNEDNESS:
     {
-      uint8_t bits =
-        RB_NUM2UINT(rb_hash_aref(rb_column,
-                                 rb_id2sym(rb_intern("bits"))));
-      switch ((bits + 7) / 8) {
-      case 1:
-        rb_value = RB_UINT2NUM(rbm2_read_uint8(*row_data));
-        (*row_data) += 1;
-        break;
-      case 2:
-        rb_value = RB_UINT2NUM(rbm2_read_uint16(*row_data));
-        (*row_data) += 2;
-        break;
-      case 3:
-        rb_value = RB_UINT2NUM(rbm2_read_uint24(*row_data));
-        (*row_data) += 3;
-        break;
-      case 4:
-        rb_value = RB_UINT2NUM(rbm2_read_uint32(*row_data));
-        (*row_data) += 4;
-        break;
-      default :
-        rb_raise(rb_eNotImpError,
-                 "%d bit type isn't implemented yet: %+" PRIsVALUE
-                 ": %+" PRIsVALUE,
-                 bits,
-                 rb_type,
-                 rb_column);
-        break;
+      /* 1 bit per numeric column from the MSB. 1 means unsigned. */
+      uint32_t nth_numeric_column = 0;
+      for (i = 0; i < table->n_columns; i++) {
+        rbm2_column *column = &(table->columns[i]);
+        if (!rbm2_column_is_numeric(column)) {
+          continue;
+        }
+        size_t byte_offset = nth_numeric_column / 8;
+        if ((size_t)(data_end - data) <= byte_offset) {
+          return false;
+        }
+        column->is_unsigned =
+          (data[byte_offset] & (0x80 >> (nth_numeric_column % 8))) != 0;
+        nth_numeric_column++;
       }
     }
-    break;
-  case MYSQL_TYPE_TIMESTAMP2:
-    {
-      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_timestamp2 */
-      uint32_t decimals =
-        RB_NUM2UINT(rb_hash_aref(rb_column,
-                                 rb_id2sym(rb_intern("decimals"))));
-      uint32_t seconds = rbm2_read_uint32_bigendian(*row_data);
-      (*row_data) += 4;
-      uint32_t fractional_seconds = 0;
-      switch ((decimals + 1) / 2) {
-      case 1:
-        fractional_seconds = rbm2_read_uint8(*row_data) * 10000;
-        (*row_data) += 1;
-        break;
-      case 2:
-        fractional_seconds = rbm2_read_uint16_bigendian(*row_data) * 100;
-        (*row_data) += 2;
-        break;
-      case 3:
-        fractional_seconds = rbm2_read_uint24_bigendian(*row_data);
-        (*row_data) += 3;
-        break;
-      default :
-        break;
+    return true;
+  case RBM2_OPTIONAL_METADATA_DEFAULT_CHARSET:
+    return rbm2_optional_metadata_parse_default_charset(
+      table, data, data_end, rbm2_column_is_character_predicate, metadata);
+  case RBM2_OPTIONAL_METADATA_COLUMN_CHARSET:
+    return rbm2_optional_metadata_parse_column_charset(
+      table, data, data_end, rbm2_column_is_character_predicate, metadata);
+  case RBM2_OPTIONAL_METADATA_ENUM_AND_SET_DEFAULT_CHARSET:
+    return rbm2_optional_metadata_parse_default_charset(
+      table, data, data_end, rbm2_column_is_enum_or_set_predicate, metadata);
+  case RBM2_OPTIONAL_METADATA_ENUM_AND_SET_COLUMN_CHARSET:
+    return rbm2_optional_metadata_parse_column_charset(
+      table, data, data_end, rbm2_column_is_enum_or_set_predicate, metadata);
+  case RBM2_OPTIONAL_METADATA_COLUMN_NAME:
+    for (i = 0; i < table->n_columns && data < data_end; i++) {
+      /* Column names are always UTF-8. */
+      if (!rbm2_optional_metadata_read_string(&data,
+                                              data_end,
+                                              rb_utf8_encoding(),
+                                              &(table->columns[i].rb_name))) {
+        return false;
       }
-      rb_value = rb_funcall(rb_cTime,
-                            rb_intern("at"),
-                            2,
-                            UINT2NUM(seconds),
-                            UINT2NUM(fractional_seconds));
     }
-    break;
-  case MYSQL_TYPE_DATETIME2:
-    {
-      /*
-        See the documentation of TIME_to_longlong_datetime_packed().
+    return true;
+  case RBM2_OPTIONAL_METADATA_SET_STR_VALUE:
+    return rbm2_optional_metadata_parse_values(table,
+                                               data,
+                                               data_end,
+                                               MYSQL_TYPE_SET);
+  case RBM2_OPTIONAL_METADATA_ENUM_STR_VALUE:
+    return rbm2_optional_metadata_parse_values(table,
+                                               data,
+                                               data_end,
+                                               MYSQL_TYPE_ENUM);
+  case RBM2_OPTIONAL_METADATA_SIMPLE_PRIMARY_KEY:
+    return rbm2_optional_metadata_parse_primary_key(table,
+                                                    data,
+                                                    data_end,
+                                                    false);
+  case RBM2_OPTIONAL_METADATA_PRIMARY_KEY_WITH_PREFIX:
+    return rbm2_optional_metadata_parse_primary_key(table,
+                                                    data,
+                                                    data_end,
+                                                    true);
+  default:
+    /* GEOMETRY_TYPE, COLUMN_VISIBILITY and unknown fields are ignored. */
+    return true;
+  }
+}
 
-        https://github.com/mysql/mysql-server/blob/mysql-8.0.27/mysys/my_time.cc#L1672-L1691
-       */
-      uint64_t integer_part = rbm2_read_uint40_bigendian(*row_data);
-      (*row_data) += 5;
-      uint32_t fractional_seconds = 0;
-      uint32_t decimals =
-        NUM2UINT(rb_hash_aref(rb_column,
-                              rb_id2sym(rb_intern("decimals"))));
-      switch ((decimals + 1) / 2) {
-      case 1:
-        fractional_seconds = rbm2_read_uint8(*row_data) * 10000;
-        (*row_data) += 1;
-        break;
-      case 2:
-        fractional_seconds = rbm2_read_uint16_bigendian(*row_data) * 100;
-        (*row_data) += 2;
-        break;
-      case 3:
-        fractional_seconds = rbm2_read_uint24_bigendian(*row_data);
-        (*row_data) += 3;
-        break;
-      default :
-        break;
+/*
+ * Parses fields of the optional metadata into the table
+ * descriptor. Fields are type (1 byte), length (packed integer) and
+ * value.
+ *
+ * ENUM/SET values depend on charsets. MySQL writes ENUM_STR_VALUE and
+ * SET_STR_VALUE before ENUM_AND_SET_*_CHARSET. So they're parsed after
+ * other fields.
+ */
+static void
+rbm2_table_parse_optional_metadata(rbm2_table *table,
+                                   const rbm2_optional_metadata *metadata)
+{
+  int pass;
+  for (pass = 0; pass < 2; pass++) {
+    const uint8_t *data = metadata->data;
+    const uint8_t *data_end = data + metadata->size;
+    while (data < data_end) {
+      uint8_t type = data[0];
+      data++;
+      uint64_t length;
+      if (!rbm2_read_packed_integer(&data, data_end, &length) ||
+          (uint64_t)(data_end - data) < length) {
+        rb_raise(rb_eMysql2ReplicationError,
+                 "invalid optional metadata: %+" PRIsVALUE,
+                 table->rb_table_name);
       }
-      uint32_t symd = integer_part >> 17;
-      uint32_t sym = symd >> 5;
-      uint32_t sign = sym >> 17;
-      uint32_t ym = sym % (1 << 17);
-      uint32_t year = ym / 13;
-      if (sign == 0) {
-        year = -year;
+      bool is_values = (type == RBM2_OPTIONAL_METADATA_SET_STR_VALUE ||
+                        type == RBM2_OPTIONAL_METADATA_ENUM_STR_VALUE);
+      if (is_values == (pass == 1) &&
+          !rbm2_optional_metadata_parse_field(table,
+                                              type,
+                                              data,
+                                              data + length,
+                                              metadata)) {
+        rb_raise(rb_eMysql2ReplicationError,
+                 "invalid optional metadata: type: %u: %+" PRIsVALUE,
+                 type,
+                 table->rb_table_name);
       }
-      uint32_t month = ym % 13;
-      uint32_t day = symd % (1 << 5);
-      uint32_t hms = integer_part % (1 << 17);
-      uint32_t hour = hms >> 12;
-      uint32_t minute = (hms >> 6) % (1 << 6);
-      uint32_t second = hms % (1 << 6);
-      rb_value = rb_funcall(rb_cTime,
-                            rb_intern("utc"),
-                            7,
-                            UINT2NUM(year),
-                            UINT2NUM(month),
-                            UINT2NUM(day),
-                            UINT2NUM(hour),
-                            UINT2NUM(minute),
-                            UINT2NUM(second),
-                            UINT2NUM(fractional_seconds));
+      data += length;
     }
-    break;
-  case MYSQL_TYPE_TIME2:
-    rb_raise(rb_eNotImpError,
-             "time2 type isn't implemented yet: %+" PRIsVALUE ": %+" PRIsVALUE,
-             rb_type,
-             rb_column);
-    break;
-  case MYSQL_TYPE_JSON:
-    rb_value = rbm2_column_parse_blob(rb_column, row_data);
-    break;
-  case MYSQL_TYPE_NEWDECIMAL:
-    {
-      /* TODO: See also bin2decimal(). */
-      const uint32_t digits_per_integer = 9;
-      const int32_t compressed_bytes[] = {0, 1, 1, 2, 3, 3, 4, 4, 4};
-      uint32_t precision =
-        NUM2UINT(rb_hash_aref(rb_column,
-                              rb_id2sym(rb_intern("precision"))));
-      uint32_t scale =
-        NUM2UINT(rb_hash_aref(rb_column,
-                              rb_id2sym(rb_intern("scale"))));
-      uint32_t integral = precision - scale;
-      uint32_t uncompressed_integral = integral / digits_per_integer;
-      uint32_t uncompressed_fractional = scale / digits_per_integer;
-      uint32_t compressed_integral =
-        integral - (uncompressed_integral * digits_per_integer);
-      uint32_t compressed_fractional =
-        scale - (uncompressed_fractional * digits_per_integer);
-
-      (*row_data) += compressed_bytes[compressed_integral];
-      if (uncompressed_integral > 1) {
-        (*row_data) += (4 * (uncompressed_integral - 1));
+  }
+}
+
+static st_index_t
+rbm2_table_map_signature_hash(struct st_mariadb_rpl_table_map_event *table_map,
+                              const rbm2_optional_metadata *optional_metadata)
+{
+  st_index_t hash = rb_memhash(table_map->column_types.str,
+                               table_map->column_types.length);
+  hash = rb_hash_uint(hash,
+                      rb_memhash(table_map->metadata.str,
+                                 table_map->metadata.length));
+  return rb_hash_uint(hash,
+                      rb_memhash(optional_metadata->data,
+                                 optional_metadata->size));
+}
+
+static bool
+rbm2_table_match(const rbm2_table *table,
+                 struct st_mariadb_rpl_table_map_event *table_map,
+                 const rbm2_optional_metadata *optional_metadata,
+                 st_index_t signature_hash)
+{
+  if (table->signature_hash != signature_hash) {
+    return false;
+  }
+  if (table->n_columns != table_map->column_count) {
+    return false;
+  }
+  if ((size_t)RSTRING_LEN(table->rb_database_name) !=
+      table_map->database.length ||
+      memcmp(RSTRING_PTR(table->rb_database_name),
+             table_map->database.str,
+             table_map->database.length) != 0) {
+    return false;
+  }
+  if ((size_t)RSTRING_LEN(table->rb_table_name) != table_map->table.length ||
+      memcmp(RSTRING_PTR(table->rb_table_name),
+             table_map->table.str,
+             table_map->table.length) != 0) {
+    return false;
+  }
+  const char *signature = RSTRING_PTR(table->rb_signature);
+  if ((size_t)RSTRING_LEN(table->rb_signature) !=
+      table_map->column_types.length +
+      table_map->metadata.length +
+      optional_metadata->size) {
+    return false;
+  }
+  signature += table_map->column_types.length;
+  if (memcmp(RSTRING_PTR(table->rb_signature),
+             table_map->column_types.str,
+             table_map->column_types.length) != 0) {
+    return false;
+  }
+  if (memcmp(signature,
+             table_map->metadata.str,
+             table_map->metadata.length) != 0) {
+    return false;
+  }
+  signature += table_map->metadata.length;
+  return (optional_metadata->size == 0 ||
+          memcmp(signature,
+                 optional_metadata->data,
+                 optional_metadata->size) == 0);
+}
+
+/*
+ * Builds a frozen table descriptor from a TABLE_MAP_EVENT. It's
+ * shared by all TABLE_MAP_EVENTs that have the same table_id, name,
+ * column_types and metadata.
+ */
+static VALUE
+rbm2_table_new_from_table_map(struct st_mariadb_rpl_table_map_event *table_map,
+                              const rbm2_optional_metadata *optional_metadata,
+                              st_index_t signature_hash)
+{
+  VALUE rb_table = rbm2_table_new(table_map->column_count);
+  rbm2_table *table = rbm2_table_get(rb_table);
+  table->rb_database_name =
+    rb_obj_freeze(rb_str_new(table_map->database.str,
+                             table_map->database.length));
+  table->rb_table_name =
+    rb_obj_freeze(rb_str_new(table_map->table.str,
+                             table_map->table.length));
+  VALUE rb_signature =
+    rb_str_buf_new(table_map->column_types.length +
+                   table_map->metadata.length +
+                   optional_metadata->size);
+  rb_str_buf_cat(rb_signature,
+                 table_map->column_types.str,
+                 table_map->column_types.length);
+  rb_str_buf_cat(rb_signature,
+                 table_map->metadata.str,
+                 table_map->metadata.length);
+  rb_str_buf_cat(rb_signature,
+                 (const char *)(optional_metadata->data),
+                 optional_metadata->size);
+  table->rb_signature = rb_obj_freeze(rb_signature);
+  table->signature_hash = signature_hash;
+
+  VALUE rb_columns = rb_ary_new_capa(table_map->column_count);
+  table->rb_columns = rb_columns;
+  const uint8_t *column_types =
+    (const uint8_t *)(table_map->column_types.str);
+  const uint8_t *metadata = (const uint8_t *)(table_map->metadata.str);
+  rbm2_decode_profile *profile = rbm2_decode_profile_get();
+  uint32_t i;
+  for (i = 0; i < table_map->column_count; i++) {
+    rbm2_column *column = &(table->columns[i]);
+    VALUE rb_column = rb_hash_new();
+    column->type = column_types[i];
+    column->rb_column = rb_column;
+    rbm2_metadata_parse(column, &metadata, profile);
+    rb_hash_aset(rb_column,
+                 rb_id2sym(rb_intern("type")),
+                 rbm2_column_type_to_symbol(column->type));
+    rb_hash_aset(rb_column,
+                 rb_id2sym(rb_intern("type_id")),
+                 UINT2NUM(column->type));
+  }
+  rbm2_table_parse_optional_metadata(table, optional_metadata);
+  VALUE rb_column_names = rb_ary_new_capa(table_map->column_count);
+  table->rb_column_names = rb_column_names;
+  for (i = 0; i < table_map->column_count; i++) {
+    rbm2_column *column = &(table->columns[i]);
+    VALUE rb_column = column->rb_column;
+    if (RB_NIL_P(column->rb_name)) {
+      rb_ary_push(rb_column_names, UINT2NUM(i));
+    } else {
+      rb_ary_push(rb_column_names, column->rb_name);
+      rb_hash_aset(rb_column, rb_id2sym(rb_intern("name")), column->rb_name);
+    }
+    if (column->is_unsigned) {
+      rb_hash_aset(rb_column,
+                   rb_id2sym(rb_intern("unsigned")),
+                   RUBY_Qtrue);
+    }
+    if (column->is_primary_key) {
+      rb_hash_aset(rb_column,
+                   rb_id2sym(rb_intern("primary_key")),
+                   RUBY_Qtrue);
+      if (column->primary_key_prefix_length > 0) {
+        rb_hash_aset(rb_column,
+                     rb_id2sym(rb_intern("primary_key_prefix_length")),
+                     UINT2NUM(column->primary_key_prefix_length));
       }
-      if (uncompressed_fractional > 1) {
-        (*row_data) += (4 * (uncompressed_fractional - 1));
+    }
+    if (!RB_NIL_P(column->rb_values)) {
+      rb_hash_aset(rb_column,
+                   rb_id2sym(rb_intern("values")),
+                   column->rb_values);
+    }
+    if (column->collation_id > 0) {
+      rb_hash_aset(rb_column,
+                   rb_id2sym(rb_intern("collation_id")),
+                   UINT2NUM(column->collation_id));
+      if (column->encoding) {
+        rb_hash_aset(rb_column,
+                     rb_id2sym(rb_intern("encoding")),
+                     rb_enc_from_encoding(column->encoding));
       }
-      (*row_data) += compressed_bytes[compressed_fractional];
     }
-    break;
-  case MYSQL_TYPE_ENUM:
-  case MYSQL_TYPE_SET:
-    rb_value = rbm2_column_parse_variable_size_uint(rb_column, row_data);
-    break;
-  case MYSQL_TYPE_TINY_BLOB:
-  case MYSQL_TYPE_MEDIUM_BLOB:
-  case MYSQL_TYPE_LONG_BLOB:
-    rb_raise(rb_eNotImpError,
-             "blob types aren't implemented yet: %+" PRIsVALUE ": %+" PRIsVALUE,
-             rb_type,
-             rb_column);
-    break;
-  case MYSQL_TYPE_BLOB:
-    rb_value = rbm2_column_parse_blob(rb_column, row_data);
-    break;
-  case MYSQL_TYPE_VAR_STRING:
-    rb_value = rbm2_column_parse_variable_length_string(rb_column, row_data);
-    break;
-  case MYSQL_TYPE_STRING:
-    rb_value = rbm2_column_parse_variable_length_string(rb_column, row_data);
-    break;
-  case MYSQL_TYPE_GEOMETRY:
-    rb_raise(rb_eNotImpError,
-             "geometry type isn't implemented yet: %+" PRIsVALUE
-             ": %+" PRIsVALUE,
-             rb_type,
-             rb_column);
-    break;
+    rb_ary_push(rb_columns, rb_obj_freeze(rb_column));
+  }
+  rb_obj_freeze(rb_columns);
+  rb_obj_freeze(rb_column_names);
+  /* rb_ractor_make_shareable() can't call #freeze of a hidden object. */
+  return rb_obj_freeze(rb_table);
+}
+
+typedef enum
+{
+  RBM2_ROW_FORMAT_HASH,
+  RBM2_ROW_FORMAT_ARRAY,
+  /* Hash keyed by column name. It needs binlog_row_metadata=FULL. */
+  RBM2_ROW_FORMAT_NAME,
+} rbm2_row_format;
+
+static rbm2_row_format
+rbm2_row_format_parse(VALUE rb_row_format)
+{
+  ID id_row_format = rb_sym2id(rb_to_symbol(rb_row_format));
+  if (id_row_format == rb_intern("hash")) {
+    return RBM2_ROW_FORMAT_HASH;
+  } else if (id_row_format == rb_intern("array")) {
+    return RBM2_ROW_FORMAT_ARRAY;
+  } else if (id_row_format == rb_intern("name")) {
+    return RBM2_ROW_FORMAT_NAME;
+  } else {
+    rb_raise(rb_eArgError,
+             "row format must be :hash, :array or :name: %+" PRIsVALUE,
+             rb_row_format);
+  }
+  return RBM2_ROW_FORMAT_HASH;
+}
+
+static VALUE
+rbm2_row_format_to_symbol(rbm2_row_format row_format)
+{
+  switch (row_format) {
+  case RBM2_ROW_FORMAT_ARRAY:
+    return rb_id2sym(rb_intern("array"));
+  case RBM2_ROW_FORMAT_NAME:
+    return rb_id2sym(rb_intern("name"));
   default:
-    rb_raise(rb_eNotImpError,
-             "unknown type isn't implemented yet: %+" PRIsVALUE
-             ": %+" PRIsVALUE,
-             rb_type,
-             rb_column);
-    break;
+    return rb_id2sym(rb_intern("hash"));
+  }
+}
+
+typedef enum
+{
+  RBM2_DECIMAL_FORMAT_BIG_DECIMAL,
+  RBM2_DECIMAL_FORMAT_INTEGER,
+  RBM2_DECIMAL_FORMAT_RATIONAL,
+} rbm2_decimal_format;
+
+static rbm2_decimal_format
+rbm2_decimal_format_parse(VALUE rb_decimal_format)
+{
+  ID id_decimal_format = rb_sym2id(rb_to_symbol(rb_decimal_format));
+  if (id_decimal_format == rb_intern("big_decimal")) {
+    return RBM2_DECIMAL_FORMAT_BIG_DECIMAL;
+  } else if (id_decimal_format == rb_intern("integer")) {
+    return RBM2_DECIMAL_FORMAT_INTEGER;
+  } else if (id_decimal_format == rb_intern("rational")) {
+    return RBM2_DECIMAL_FORMAT_RATIONAL;
+  } else {
+    rb_raise(rb_eArgError,
+             "decimal format must be :big_decimal, :integer or :rational: "
+             "%+" PRIsVALUE,
+             rb_decimal_format);
+  }
+  return RBM2_DECIMAL_FORMAT_BIG_DECIMAL;
+}
+
+static VALUE
+rbm2_decimal_format_to_symbol(rbm2_decimal_format decimal_format)
+{
+  switch (decimal_format) {
+  case RBM2_DECIMAL_FORMAT_INTEGER:
+    return rb_id2sym(rb_intern("integer"));
+  case RBM2_DECIMAL_FORMAT_RATIONAL:
+    return rb_id2sym(rb_intern("rational"));
+  default:
+    return rb_id2sym(rb_intern("big_decimal"));
+  }
+}
+
+typedef enum
+{
+  RBM2_TIME_FORMAT_TIME,
+  RBM2_TIME_FORMAT_INTEGER,
+  RBM2_TIME_FORMAT_ARRAY,
+} rbm2_time_format;
+
+static rbm2_time_format
+rbm2_time_format_parse(VALUE rb_time_format)
+{
+  ID id_time_format = rb_sym2id(rb_to_symbol(rb_time_format));
+  if (id_time_format == rb_intern("time")) {
+    return RBM2_TIME_FORMAT_TIME;
+  } else if (id_time_format == rb_intern("integer")) {
+    return RBM2_TIME_FORMAT_INTEGER;
+  } else if (id_time_format == rb_intern("array")) {
+    return RBM2_TIME_FORMAT_ARRAY;
+  } else {
+    rb_raise(rb_eArgError,
+             "time format must be :time, :integer or :array: %+" PRIsVALUE,
+             rb_time_format);
+  }
+  return RBM2_TIME_FORMAT_TIME;
+}
+
+static VALUE
+rbm2_time_format_to_symbol(rbm2_time_format time_format)
+{
+  switch (time_format) {
+  case RBM2_TIME_FORMAT_INTEGER:
+    return rb_id2sym(rb_intern("integer"));
+  case RBM2_TIME_FORMAT_ARRAY:
+    return rb_id2sym(rb_intern("array"));
+  default:
+    return rb_id2sym(rb_intern("time"));
+  }
+}
+
+typedef enum
+{
+  RBM2_JSON_FORMAT_RAW,
+  RBM2_JSON_FORMAT_OBJECT,
+  RBM2_JSON_FORMAT_TEXT,
+} rbm2_json_format;
+
+static rbm2_json_format
+rbm2_json_format_parse(VALUE rb_json_format)
+{
+  ID id_json_format = rb_sym2id(rb_to_symbol(rb_json_format));
+  if (id_json_format == rb_intern("raw")) {
+    return RBM2_JSON_FORMAT_RAW;
+  } else if (id_json_format == rb_intern("object")) {
+    return RBM2_JSON_FORMAT_OBJECT;
+  } else if (id_json_format == rb_intern("text")) {
+    return RBM2_JSON_FORMAT_TEXT;
+  } else {
+    rb_raise(rb_eArgError,
+             "JSON format must be :raw, :object or :text: %+" PRIsVALUE,
+             rb_json_format);
+  }
+  return RBM2_JSON_FORMAT_RAW;
+}
+
+static VALUE
+rbm2_json_format_to_symbol(rbm2_json_format json_format)
+{
+  switch (json_format) {
+  case RBM2_JSON_FORMAT_OBJECT:
+    return rb_id2sym(rb_intern("object"));
+  case RBM2_JSON_FORMAT_TEXT:
+    return rb_id2sym(rb_intern("text"));
+  default:
+    return rb_id2sym(rb_intern("raw"));
+  }
+}
+
+typedef struct
+{
+  rbm2_row_format row_format;
+  rbm2_decimal_format decimal_format;
+  rbm2_time_format time_format;
+  rbm2_json_format json_format;
+  /* Decode rows eagerly and make events shareable between Ractors. */
+  bool shareable;
+  /* Return string values as substrings of the copied rows data. */
+  bool share_strings;
+  /* The frozen rows data while rows are decoded with share_strings. */
+  VALUE rb_shared_data;
+  /* Mysql2Replication::Stats to count decoded rows or nil. */
+  VALUE rb_stats;
+  /* The decode profile of the current Ractor while rows are decoded or
+   * NULL. It's looked up once per rows event not per value. */
+  rbm2_decode_profile *profile;
+} rbm2_decode_options;
+
+static void
+rbm2_decode_options_init(rbm2_decode_options *options)
+{
+  options->row_format = RBM2_ROW_FORMAT_HASH;
+  options->decimal_format = RBM2_DECIMAL_FORMAT_BIG_DECIMAL;
+  options->time_format = RBM2_TIME_FORMAT_TIME;
+  options->json_format = RBM2_JSON_FORMAT_RAW;
+  options->shareable = false;
+  options->share_strings = false;
+  options->rb_shared_data = RUBY_Qnil;
+  options->rb_stats = RUBY_Qnil;
+  options->profile = NULL;
+}
+
+/*
+ * Replication statistics. They're plain counters updated on each
+ * event. Rates and lag are computed only when they're requested.
+ */
+typedef struct
+{
+  uint64_t n_events;
+  uint64_t n_bytes;
+  uint64_t n_decoded_rows;
+  /* The timestamp of the last event in seconds or 0 */
+  uint32_t last_timestamp;
+  uint64_t started_time_ns;
+  uint64_t time_with_gvl_ns;
+  uint64_t time_without_gvl_ns;
+} rbm2_stats;
+
+static const rb_data_type_t rbm2_stats_type = {
+  "Mysql2Replication::Stats",
+  {
+    NULL,
+    RUBY_TYPED_DEFAULT_FREE,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static void
+rbm2_stats_reset(rbm2_stats *stats)
+{
+  stats->n_events = 0;
+  stats->n_bytes = 0;
+  stats->n_decoded_rows = 0;
+  stats->last_timestamp = 0;
+  stats->started_time_ns = rbm2_monotonic_time_ns();
+  stats->time_with_gvl_ns = 0;
+  stats->time_without_gvl_ns = 0;
+}
+
+static VALUE
+rbm2_stats_new(void)
+{
+  rbm2_stats *stats;
+  VALUE rb_stats = TypedData_Make_Struct(rb_cMysql2ReplicationStats,
+                                         rbm2_stats,
+                                         &rbm2_stats_type,
+                                         stats);
+  rbm2_stats_reset(stats);
+  return rb_stats;
+}
+
+static inline rbm2_stats *
+rbm2_stats_get(VALUE rb_stats)
+{
+  rbm2_stats *stats;
+  TypedData_Get_Struct(rb_stats, rbm2_stats, &rbm2_stats_type, stats);
+  return stats;
+}
+
+static void
+rbm2_stats_count_event(rbm2_stats *stats,
+                       MARIADB_RPL_EVENT *event,
+                       size_t raw_event_size)
+{
+  stats->n_events++;
+  stats->n_bytes += raw_event_size;
+  if (event->event_type == HEARTBEAT_LOG_EVENT) {
+    /* The server sends heartbeats only when we've read all events. */
+    stats->last_timestamp = (uint32_t)time(NULL);
+  } else if (event->timestamp != 0 && event->next_event_pos != 0) {
+    /* Fake and artificial events are ignored. */
+    stats->last_timestamp = event->timestamp;
+  }
+}
+
+static VALUE
+rbm2_time_new(int64_t seconds,
+              uint32_t microseconds,
+              bool utc,
+              const rbm2_decode_options *options)
+{
+  switch (options->time_format) {
+  case RBM2_TIME_FORMAT_INTEGER:
+    return RUBY_LL2NUM(seconds);
+  case RBM2_TIME_FORMAT_ARRAY:
+    return rb_assoc_new(RUBY_LL2NUM(seconds), UINT2NUM(microseconds));
+  default:
+    {
+      struct timespec time_spec;
+      time_spec.tv_sec = (time_t)seconds;
+      time_spec.tv_nsec = (long)microseconds * 1000;
+      /* INT_MAX: localtime, INT_MAX - 1: UTC */
+      return rb_time_timespec_new(&time_spec, utc ? INT_MAX - 1 : INT_MAX);
+    }
+  }
+}
+
+static inline int64_t
+rbm2_days_from_civil(int64_t year, uint32_t month, uint32_t day)
+{
+  /* https://howardhinnant.github.io/date_algorithms.html#days_from_civil */
+  if (month <= 2) {
+    year--;
+  }
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  uint32_t year_of_era = (uint32_t)(year - era * 400);
+  uint32_t day_of_year =
+    (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t day_of_era =
+    year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+static VALUE
+rbm2_datetime_new(int64_t year,
+                  uint32_t month,
+                  uint32_t day,
+                  uint32_t hour,
+                  uint32_t minute,
+                  uint32_t second,
+                  uint32_t microseconds,
+                  const rbm2_decode_options *options)
+{
+  if (month < 1 || month > 12 || day < 1 || day > 31) {
+    /* Zero date such as 0000-00-00 is nil in all formats like
+     * mysql2. */
+    return RUBY_Qnil;
+  }
+  int64_t seconds =
+    (rbm2_days_from_civil(year, month, day) * 86400) +
+    (hour * 3600) +
+    (minute * 60) +
+    second;
+  return rbm2_time_new(seconds, microseconds, true, options);
+}
+
+#define RBM2_DATE_CACHE_MAX_SIZE 4096
+/* raw date -> frozen Date. Each Ractor has its own cache. */
+#ifdef HAVE_RUBY_RACTOR_H
+static rb_ractor_local_key_t rbm2_date_cache_key;
+#else
+static VALUE rbm2_date_cache = RUBY_Qnil;
+#endif
+
+static VALUE
+rbm2_date_cache_get(void)
+{
+#ifdef HAVE_RUBY_RACTOR_H
+  VALUE rb_date_cache;
+  if (!rb_ractor_local_storage_value_lookup(rbm2_date_cache_key,
+                                            &rb_date_cache)) {
+    rb_date_cache = rb_hash_new();
+    rb_ractor_local_storage_value_set(rbm2_date_cache_key, rb_date_cache);
+  }
+  return rb_date_cache;
+#else
+  return rbm2_date_cache;
+#endif
+}
+
+static VALUE
+rbm2_date_new(uint32_t raw_date)
+{
+  /*
+    YYYYYYYMMMMDDDDD
+    Y: 6bit
+    M: 4bit
+    D: 5bit
+  */
+  if (raw_date == 0) {
+    /* Zero date 0000-00-00 is nil like mysql2. */
+    return RUBY_Qnil;
+  }
+  VALUE rb_raw_date = UINT2NUM(raw_date);
+  VALUE rb_date_cache = rbm2_date_cache_get();
+  VALUE rb_date = rb_hash_lookup2(rb_date_cache, rb_raw_date, RUBY_Qundef);
+  if (rb_date != RUBY_Qundef) {
+    return rb_date;
+  }
+  rb_date = rb_funcall(rb_cDate,
+                       rb_intern("new"),
+                       3,
+                       RB_UINT2NUM((raw_date >> 9)),
+                       RB_UINT2NUM((raw_date >> 5) & ((1 << 4) - 1)),
+                       RB_UINT2NUM((raw_date & ((1 << 5) - 1))));
+  rb_obj_freeze(rb_date);
+  if (RHASH_SIZE(rb_date_cache) >= RBM2_DATE_CACHE_MAX_SIZE) {
+    rb_hash_clear(rb_date_cache);
+  }
+  rb_hash_aset(rb_date_cache, rb_raw_date, rb_date);
+  return rb_date;
+}
+
+/*
+ * Raises when the rest of the row data is shorter than size. Row data
+ * may be broken because a binlog file isn't verified by default.
+ */
+static inline void
+rbm2_row_data_ensure(const uint8_t *row_data,
+                     const uint8_t *row_data_end,
+                     uint64_t size)
+{
+  if (row_data > row_data_end ||
+      (uint64_t)(row_data_end - row_data) < size) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "truncated row data: required: %" PRIsVALUE
+             ": rest: %" PRIsVALUE,
+             ULL2NUM(size),
+             LL2NUM(row_data_end - row_data));
+  }
+}
+
+static inline VALUE
+rbm2_column_parse_variable_size_uint(const rbm2_column *column,
+                                     const uint8_t **row_data,
+                                     const uint8_t *row_data_end)
+{
+  uint32_t size = column->size;
+  VALUE rb_value = RUBY_Qnil;
+  rbm2_row_data_ensure(*row_data, row_data_end, size);
+  switch (size) {
+  case 1:
+    rb_value = USHORT2NUM(rbm2_read_uint8(*row_data));
+    break;
+  case 2:
+    rb_value = USHORT2NUM(rbm2_read_uint16(*row_data));
+    break;
+  case 3:
+    rb_value = UINT2NUM(rbm2_read_uint24(*row_data));
+    break;
+  case 4:
+    rb_value = UINT2NUM(rbm2_read_uint32(*row_data));
+    break;
+  default:
+    rb_raise(rb_eNotImpError,
+             "unsupported size for variable size uint: %u: %+" PRIsVALUE,
+             size,
+             column->rb_column);
+    break;
+  }
+  (*row_data) += size;
+  return rb_value;
+}
+
+/*
+ * Creates a string value from row data. It refers the rows data
+ * without copying with share_strings.
+ */
+static inline VALUE
+rbm2_column_value_str_new(const rbm2_column *column,
+                          const rbm2_decode_options *options,
+                          const uint8_t *data,
+                          long length)
+{
+  if (RB_NIL_P(options->rb_shared_data)) {
+    if (column->encoding) {
+      return rb_enc_str_new((const char *)data, length, column->encoding);
+    } else {
+      return rb_str_new((const char *)data, length);
+    }
+  }
+  const char *shared_data = RSTRING_PTR(options->rb_shared_data);
+  VALUE rb_value = rb_str_subseq(options->rb_shared_data,
+                                 (const char *)data - shared_data,
+                                 length);
+  if (column->encoding) {
+    rb_enc_associate(rb_value, column->encoding);
+  }
+  return rb_value;
+}
+
+static inline VALUE
+rbm2_column_parse_variable_length_string(const rbm2_column *column,
+                                         const rbm2_decode_options *options,
+                                         const uint8_t **row_data,
+                                         const uint8_t *row_data_end)
+{
+  /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_varchar-and-other-variable-length-string-types */
+  uint16_t length;
+  if (column->max_length > 255) {
+    rbm2_row_data_ensure(*row_data, row_data_end, 2);
+    length = rbm2_read_uint16(*row_data);
+    (*row_data) += 2;
+  } else {
+    rbm2_row_data_ensure(*row_data, row_data_end, 1);
+    length = rbm2_read_uint8(*row_data);
+    (*row_data) += 1;
+  }
+  rbm2_row_data_ensure(*row_data, row_data_end, length);
+  VALUE rb_value =
+    rbm2_column_value_str_new(column, options, *row_data, length);
+  (*row_data) += length;
+  return rb_value;
+}
+
+/* The returned length is ensured to be in the row data. */
+static inline uint32_t
+rbm2_column_read_blob_length(const rbm2_column *column,
+                             const uint8_t **row_data,
+                             const uint8_t *row_data_end)
+{
+  /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_blob-and-other-blob-types */
+  uint32_t length_size = column->length_size;
+  uint32_t length = 0;
+  rbm2_row_data_ensure(*row_data, row_data_end, length_size);
+  switch (length_size) {
+  case 1:
+    length = rbm2_read_uint8(*row_data);
+    break;
+  case 2:
+    length = rbm2_read_uint16(*row_data);
+    break;
+  case 3:
+    length = rbm2_read_uint24(*row_data);
+    break;
+  case 4:
+    length = rbm2_read_uint32(*row_data);
+    break;
+  default:
+    rb_raise(rb_eNotImpError,
+             "unsupported length size for blob: %u: %+" PRIsVALUE,
+             length_size,
+             column->rb_column);
+    break;
+  }
+  (*row_data) += length_size;
+  rbm2_row_data_ensure(*row_data, row_data_end, length);
+  return length;
+}
+
+static inline VALUE
+rbm2_column_parse_blob(const rbm2_column *column,
+                       const rbm2_decode_options *options,
+                       const uint8_t **row_data,
+                       const uint8_t *row_data_end)
+{
+  uint32_t length =
+    rbm2_column_read_blob_length(column, row_data, row_data_end);
+  VALUE rb_value = rbm2_column_value_str_new(column, options, *row_data, length);
+  (*row_data) += length;
+  return rb_value;
+}
+
+#define RBM2_DECIMAL_DIGITS_PER_GROUP 9
+#define RBM2_DECIMAL_GROUP_SIZE 4
+#define RBM2_DECIMAL_MAX_PRECISION 65
+#define RBM2_DECIMAL_MAX_SCALE 30
+/* 10^18 - 1 fits in int64_t. */
+#define RBM2_DECIMAL_MAX_INT64_PRECISION 18
+
+static const uint32_t rbm2_decimal_digits_to_bytes[] =
+  {0, 1, 1, 2, 2, 3, 3, 4, 4, 4};
+static const uint32_t rbm2_decimal_powers_of_ten[] =
+  {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static ID id_BigDecimal;
+static ID id_multiply;
+/* 10 ** scale */
+static VALUE rbm2_decimal_denominators[RBM2_DECIMAL_MAX_SCALE + 1];
+/* BigDecimal("1e-#{scale}") */
+static VALUE rbm2_decimal_scale_factors[RBM2_DECIMAL_MAX_SCALE + 1];
+
+/* Raises when a broken group has more than n_digits digits. */
+static inline uint32_t
+rbm2_decimal_read_group(const uint8_t *data,
+                        uint32_t size,
+                        uint32_t n_digits)
+{
+  uint32_t value = 0;
+  uint32_t i;
+  for (i = 0; i < size; i++) {
+    value = (value << 8) + data[i];
+  }
+  if (value >= rbm2_decimal_powers_of_ten[n_digits]) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "broken decimal group: %u: digits: %u",
+             value,
+             n_digits);
+  }
+  return value;
+}
+
+static VALUE
+rbm2_decimal_new(VALUE rb_unscaled_value,
+                 uint32_t scale,
+                 const rbm2_decode_options *options)
+{
+  switch (options->decimal_format) {
+  case RBM2_DECIMAL_FORMAT_INTEGER:
+    return rb_unscaled_value;
+  case RBM2_DECIMAL_FORMAT_RATIONAL:
+    return rb_rational_new(rb_unscaled_value,
+                           rbm2_decimal_denominators[scale]);
+  default:
+    {
+      VALUE rb_value = rb_funcall(rb_mKernel,
+                                  id_BigDecimal,
+                                  1,
+                                  rb_unscaled_value);
+      if (scale > 0) {
+        rb_value = rb_funcall(rb_value,
+                              id_multiply,
+                              1,
+                              rbm2_decimal_scale_factors[scale]);
+      }
+      return rb_value;
+    }
+  }
+}
+
+static VALUE
+rbm2_column_parse_decimal(const rbm2_column *column,
+                          const rbm2_decode_options *options,
+                          const uint8_t **row_data,
+                          const uint8_t *row_data_end)
+{
+  /*
+    See also bin2decimal():
+    https://github.com/mysql/mysql-server/blob/mysql-8.0.27/strings/decimal.cc#L1381-L1505
+  */
+  uint32_t precision = column->precision;
+  uint32_t scale = column->scale;
+  if (precision > RBM2_DECIMAL_MAX_PRECISION ||
+      scale > RBM2_DECIMAL_MAX_SCALE ||
+      scale > precision) {
+    rb_raise(rb_eNotImpError,
+             "unsupported decimal precision and scale: %u: %u: %+" PRIsVALUE,
+             precision,
+             scale,
+             column->rb_column);
+  }
+  uint32_t integral = precision - scale;
+  uint32_t n_integral_groups = integral / RBM2_DECIMAL_DIGITS_PER_GROUP;
+  uint32_t n_leading_digits = integral % RBM2_DECIMAL_DIGITS_PER_GROUP;
+  uint32_t n_fractional_groups = scale / RBM2_DECIMAL_DIGITS_PER_GROUP;
+  uint32_t n_trailing_digits = scale % RBM2_DECIMAL_DIGITS_PER_GROUP;
+  uint32_t leading_size = rbm2_decimal_digits_to_bytes[n_leading_digits];
+  uint32_t trailing_size = rbm2_decimal_digits_to_bytes[n_trailing_digits];
+  uint32_t size =
+    leading_size +
+    (n_integral_groups * RBM2_DECIMAL_GROUP_SIZE) +
+    (n_fractional_groups * RBM2_DECIMAL_GROUP_SIZE) +
+    trailing_size;
+
+  /*
+    The most significant bit is the sign bit. It's 1 for positive
+    values. Negative values are stored as their bitwise complement.
+  */
+  uint8_t data[32];
+  rbm2_row_data_ensure(*row_data, row_data_end, size);
+  memcpy(data, *row_data, size);
+  (*row_data) += size;
+  bool negative = !(data[0] & 0x80);
+  data[0] ^= 0x80;
+  if (negative) {
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+      data[i] = ~data[i];
+    }
+  }
+
+  const uint8_t *current = data;
+  uint32_t i;
+  if (precision <= RBM2_DECIMAL_MAX_INT64_PRECISION) {
+    /* Fast path: no string formatting */
+    int64_t value = 0;
+    if (leading_size > 0) {
+      value = rbm2_decimal_read_group(current, leading_size, n_leading_digits);
+      current += leading_size;
+    }
+    for (i = 0; i < n_integral_groups + n_fractional_groups; i++) {
+      value *= rbm2_decimal_powers_of_ten[RBM2_DECIMAL_DIGITS_PER_GROUP];
+      value += rbm2_decimal_read_group(current,
+                                       RBM2_DECIMAL_GROUP_SIZE,
+                                       RBM2_DECIMAL_DIGITS_PER_GROUP);
+      current += RBM2_DECIMAL_GROUP_SIZE;
+    }
+    if (trailing_size > 0) {
+      value *= rbm2_decimal_powers_of_ten[n_trailing_digits];
+      value += rbm2_decimal_read_group(current,
+                                       trailing_size,
+                                       n_trailing_digits);
+    }
+    if (negative) {
+      value = -value;
+    }
+    return rbm2_decimal_new(LL2NUM(value), scale, options);
+  }
+
+  /* "-" + digits + "\0" */
+  char digits[1 + RBM2_DECIMAL_MAX_PRECISION + 1];
+  char *digits_current = digits;
+  if (negative) {
+    *digits_current++ = '-';
+  }
+  if (leading_size > 0) {
+    digits_current += snprintf(digits_current,
+                               RBM2_DECIMAL_DIGITS_PER_GROUP + 1,
+                               "%0*u",
+                               (int)n_leading_digits,
+                               rbm2_decimal_read_group(current,
+                                                       leading_size,
+                                                       n_leading_digits));
+    current += leading_size;
+  }
+  for (i = 0; i < n_integral_groups + n_fractional_groups; i++) {
+    uint32_t group = rbm2_decimal_read_group(current,
+                                             RBM2_DECIMAL_GROUP_SIZE,
+                                             RBM2_DECIMAL_DIGITS_PER_GROUP);
+    digits_current += snprintf(digits_current,
+                               RBM2_DECIMAL_DIGITS_PER_GROUP + 1,
+                               "%09u",
+                               group);
+    current += RBM2_DECIMAL_GROUP_SIZE;
+  }
+  if (trailing_size > 0) {
+    digits_current += snprintf(digits_current,
+                               RBM2_DECIMAL_DIGITS_PER_GROUP + 1,
+                               "%0*u",
+                               (int)n_trailing_digits,
+                               rbm2_decimal_read_group(current,
+                                                       trailing_size,
+                                                       n_trailing_digits));
+  }
+  return rbm2_decimal_new(rb_cstr2inum(digits, 10), scale, options);
+}
+
+/*
+  MySQL binary JSON.
+
+  See also sql-common/json_binary.h:
+  https://github.com/mysql/mysql-server/blob/mysql-8.0.27/sql-common/json_binary.h
+*/
+#define RBM2_JSON_TYPE_SMALL_OBJECT 0x00
+#define RBM2_JSON_TYPE_LARGE_OBJECT 0x01
+#define RBM2_JSON_TYPE_SMALL_ARRAY 0x02
+#define RBM2_JSON_TYPE_LARGE_ARRAY 0x03
+#define RBM2_JSON_TYPE_LITERAL 0x04
+#define RBM2_JSON_TYPE_INT16 0x05
+#define RBM2_JSON_TYPE_UINT16 0x06
+#define RBM2_JSON_TYPE_INT32 0x07
+#define RBM2_JSON_TYPE_UINT32 0x08
+#define RBM2_JSON_TYPE_INT64 0x09
+#define RBM2_JSON_TYPE_UINT64 0x0a
+#define RBM2_JSON_TYPE_DOUBLE 0x0b
+#define RBM2_JSON_TYPE_STRING 0x0c
+#define RBM2_JSON_TYPE_OPAQUE 0x0f
+
+#define RBM2_JSON_LITERAL_NULL 0x00
+#define RBM2_JSON_LITERAL_TRUE 0x01
+#define RBM2_JSON_LITERAL_FALSE 0x02
+
+/* MySQL itself rejects documents deeper than 100. */
+#define RBM2_JSON_MAX_DEPTH 512
+
+typedef struct
+{
+  const uint8_t *data_end;
+  const rbm2_column *column;
+  const rbm2_decode_options *options;
+  /* Only for RBM2_JSON_FORMAT_TEXT */
+  VALUE rb_text;
+} rbm2_json_decoder;
+
+typedef struct
+{
+  const uint8_t *data;
+  bool large;
+  bool object;
+  uint32_t n_elements;
+  uint32_t size;
+  uint32_t offset_size;
+  const uint8_t *key_entries;
+  const uint8_t *value_entries;
+} rbm2_json_container;
+
+static void
+rbm2_json_decoder_raise(rbm2_json_decoder *decoder, const char *message)
+{
+  rb_raise(rb_eMysql2ReplicationError,
+           "invalid binary JSON: %s: %+" PRIsVALUE,
+           message,
+           decoder->column->rb_column);
+}
+
+static inline void
+rbm2_json_decoder_ensure(rbm2_json_decoder *decoder,
+                         const uint8_t *data,
+                         uint64_t size)
+{
+  if (data > decoder->data_end ||
+      (uint64_t)(decoder->data_end - data) < size) {
+    rbm2_json_decoder_raise(decoder, "truncated");
+  }
+}
+
+static inline uint32_t
+rbm2_json_decoder_read_variable_length(rbm2_json_decoder *decoder,
+                                       const uint8_t **data)
+{
+  /* 7 bits per byte. The highest bit means "more bytes follow". */
+  uint32_t length = 0;
+  int i;
+  for (i = 0; i < 5; i++) {
+    rbm2_json_decoder_ensure(decoder, *data, 1);
+    uint8_t byte = **data;
+    (*data)++;
+    length |= ((uint32_t)(byte & 0x7f)) << (7 * i);
+    if (!(byte & 0x80)) {
+      return length;
+    }
+  }
+  rbm2_json_decoder_raise(decoder, "too long variable length");
+  return 0;
+}
+
+static inline uint32_t
+rbm2_json_read_offset(const uint8_t *data, bool large)
+{
+  return large ? rbm2_read_uint32(data) : rbm2_read_uint16(data);
+}
+
+static inline bool
+rbm2_json_type_is_inlined(uint8_t type, bool large)
+{
+  switch (type) {
+  case RBM2_JSON_TYPE_LITERAL:
+  case RBM2_JSON_TYPE_INT16:
+  case RBM2_JSON_TYPE_UINT16:
+    return true;
+  case RBM2_JSON_TYPE_INT32:
+  case RBM2_JSON_TYPE_UINT32:
+    return large;
+  default:
+    return false;
+  }
+}
+
+static void
+rbm2_json_container_init(rbm2_json_decoder *decoder,
+                         rbm2_json_container *container,
+                         uint8_t type,
+                         const uint8_t *data)
+{
+  container->data = data;
+  container->large = (type == RBM2_JSON_TYPE_LARGE_OBJECT ||
+                      type == RBM2_JSON_TYPE_LARGE_ARRAY);
+  container->object = (type == RBM2_JSON_TYPE_SMALL_OBJECT ||
+                       type == RBM2_JSON_TYPE_LARGE_OBJECT);
+  container->offset_size = container->large ? 4 : 2;
+  rbm2_json_decoder_ensure(decoder, data, container->offset_size * 2);
+  container->n_elements = rbm2_json_read_offset(data, container->large);
+  container->size = rbm2_json_read_offset(data + container->offset_size,
+                                          container->large);
+  rbm2_json_decoder_ensure(decoder, data, container->size);
+  uint32_t key_entry_size = container->object ? container->offset_size + 2 : 0;
+  uint32_t value_entry_size = 1 + container->offset_size;
+  uint64_t header_size =
+    (container->offset_size * 2) +
+    ((uint64_t)(container->n_elements) * (key_entry_size + value_entry_size));
+  if (header_size > container->size) {
+    rbm2_json_decoder_raise(decoder, "too many elements");
+  }
+  container->key_entries = data + (container->offset_size * 2);
+  container->value_entries =
+    container->key_entries + (container->n_elements * key_entry_size);
+}
+
+static inline void
+rbm2_json_container_get_key(rbm2_json_decoder *decoder,
+                            rbm2_json_container *container,
+                            uint32_t i,
+                            const char **key,
+                            uint32_t *key_length)
+{
+  const uint8_t *entry =
+    container->key_entries + (i * (container->offset_size + 2));
+  uint32_t offset = rbm2_json_read_offset(entry, container->large);
+  *key_length = rbm2_read_uint16(entry + container->offset_size);
+  if ((uint64_t)offset + *key_length > container->size) {
+    rbm2_json_decoder_raise(decoder, "key is out of range");
+  }
+  *key = (const char *)(container->data + offset);
+}
+
+static inline void
+rbm2_json_container_get_value(rbm2_json_decoder *decoder,
+                              rbm2_json_container *container,
+                              uint32_t i,
+                              uint8_t *type,
+                              const uint8_t **value)
+{
+  const uint8_t *entry =
+    container->value_entries + (i * (1 + container->offset_size));
+  *type = entry[0];
+  if (rbm2_json_type_is_inlined(*type, container->large)) {
+    *value = entry + 1;
+    return;
+  }
+  uint32_t offset = rbm2_json_read_offset(entry + 1, container->large);
+  if (offset >= container->size) {
+    rbm2_json_decoder_raise(decoder, "value is out of range");
+  }
+  *value = container->data + offset;
+}
+
+static uint32_t
+rbm2_decimal_size(uint32_t precision, uint32_t scale)
+{
+  uint32_t integral = precision - scale;
+  return
+    rbm2_decimal_digits_to_bytes[integral % RBM2_DECIMAL_DIGITS_PER_GROUP] +
+    ((integral / RBM2_DECIMAL_DIGITS_PER_GROUP) * RBM2_DECIMAL_GROUP_SIZE) +
+    ((scale / RBM2_DECIMAL_DIGITS_PER_GROUP) * RBM2_DECIMAL_GROUP_SIZE) +
+    rbm2_decimal_digits_to_bytes[scale % RBM2_DECIMAL_DIGITS_PER_GROUP];
+}
+
+static VALUE
+rbm2_json_decoder_decode_opaque_decimal(rbm2_json_decoder *decoder,
+                                        const uint8_t *data,
+                                        uint32_t length)
+{
+  /* precision(1) scale(1) bin2decimal() data */
+  rbm2_json_decoder_ensure(decoder, data, 2);
+  rbm2_column column = {0};
+  column.type = MYSQL_TYPE_NEWDECIMAL;
+  column.precision = data[0];
+  column.scale = data[1];
+  column.rb_column = decoder->column->rb_column;
+  if (column.precision > RBM2_DECIMAL_MAX_PRECISION ||
+      column.scale > RBM2_DECIMAL_MAX_SCALE ||
+      column.scale > column.precision ||
+      length < 2 + rbm2_decimal_size(column.precision, column.scale)) {
+    rbm2_json_decoder_raise(decoder, "invalid decimal");
+  }
+  data += 2;
+  if (RB_NIL_P(decoder->rb_text)) {
+    return rbm2_column_parse_decimal(&column,
+                                     decoder->options,
+                                     &data,
+                                     decoder->data_end);
+  }
+
+  rbm2_decode_options options = *(decoder->options);
+  options.decimal_format = RBM2_DECIMAL_FORMAT_INTEGER;
+  VALUE rb_unscaled_value =
+    rb_obj_as_string(rbm2_column_parse_decimal(&column,
+                                               &options,
+                                               &data,
+                                               decoder->data_end));
+  const char *digits = RSTRING_PTR(rb_unscaled_value);
+  long n_digits = RSTRING_LEN(rb_unscaled_value);
+  if (digits[0] == '-') {
+    rb_str_buf_cat(decoder->rb_text, "-", 1);
+    digits++;
+    n_digits--;
+  }
+  if (column.scale == 0) {
+    rb_str_buf_cat(decoder->rb_text, digits, n_digits);
+  } else if (n_digits > (long)column.scale) {
+    rb_str_buf_cat(decoder->rb_text, digits, n_digits - column.scale);
+    rb_str_buf_cat(decoder->rb_text, ".", 1);
+    rb_str_buf_cat(decoder->rb_text,
+                   digits + n_digits - column.scale,
+                   column.scale);
+  } else {
+    rb_str_buf_cat(decoder->rb_text, "0.", 2);
+    long i;
+    for (i = n_digits; i < (long)column.scale; i++) {
+      rb_str_buf_cat(decoder->rb_text, "0", 1);
+    }
+    rb_str_buf_cat(decoder->rb_text, digits, n_digits);
+  }
+  return RUBY_Qnil;
+}
+
+static void
+rbm2_json_append_base64(VALUE rb_string, const uint8_t *data, uint32_t size)
+{
+  static const char table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  char buffer[4];
+  uint32_t i;
+  for (i = 0; i + 2 < size; i += 3) {
+    uint32_t bits = (data[i] << 16) + (data[i + 1] << 8) + data[i + 2];
+    buffer[0] = table[(bits >> 18) & 0x3f];
+    buffer[1] = table[(bits >> 12) & 0x3f];
+    buffer[2] = table[(bits >> 6) & 0x3f];
+    buffer[3] = table[bits & 0x3f];
+    rb_str_buf_cat(rb_string, buffer, 4);
+  }
+  if (i < size) {
+    uint32_t bits = data[i] << 16;
+    if (i + 1 < size) {
+      bits += data[i + 1] << 8;
+    }
+    buffer[0] = table[(bits >> 18) & 0x3f];
+    buffer[1] = table[(bits >> 12) & 0x3f];
+    buffer[2] = (i + 1 < size) ? table[(bits >> 6) & 0x3f] : '=';
+    buffer[3] = '=';
+    rb_str_buf_cat(rb_string, buffer, 4);
+  }
+}
+
+static VALUE
+rbm2_json_decoder_decode_opaque(rbm2_json_decoder *decoder,
+                                const uint8_t *data)
+{
+  /* field_type(1) length(variable) data */
+  rbm2_json_decoder_ensure(decoder, data, 1);
+  uint8_t field_type = data[0];
+  data++;
+  uint32_t length = rbm2_json_decoder_read_variable_length(decoder, &data);
+  rbm2_json_decoder_ensure(decoder, data, length);
+
+  /* The same text as MySQL's JSON output */
+  char buffer[64];
+  int buffer_length = -1;
+  bool base64 = false;
+  switch (field_type) {
+  case MYSQL_TYPE_NEWDECIMAL:
+    return rbm2_json_decoder_decode_opaque_decimal(decoder, data, length);
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_DATETIME:
+  case MYSQL_TYPE_TIMESTAMP:
+  case MYSQL_TYPE_TIME:
+    {
+      /* TIME_to_longlong_*_packed() */
+      if (length < 8) {
+        rbm2_json_decoder_raise(decoder, "invalid temporal value");
+      }
+      int64_t packed = rbm2_read_int64(data);
+      bool negative = (packed < 0);
+      if (negative) {
+        packed = -packed;
+      }
+      uint32_t microseconds = (uint32_t)(packed % (1 << 24));
+      int64_t integer_part = packed >> 24;
+      if (field_type == MYSQL_TYPE_TIME) {
+        uint32_t hour = (uint32_t)((integer_part >> 12) % (1 << 10));
+        uint32_t minute = (uint32_t)((integer_part >> 6) % (1 << 6));
+        uint32_t second = (uint32_t)(integer_part % (1 << 6));
+        buffer_length = snprintf(buffer,
+                                 sizeof(buffer),
+                                 "%s%02u:%02u:%02u.%06u",
+                                 negative ? "-" : "",
+                                 hour,
+                                 minute,
+                                 second,
+                                 microseconds);
+      } else {
+        int64_t ymd = integer_part >> 17;
+        int64_t ym = ymd >> 5;
+        uint32_t hms = (uint32_t)(integer_part % (1 << 17));
+        uint32_t year = (uint32_t)(ym / 13);
+        uint32_t month = (uint32_t)(ym % 13);
+        uint32_t day = (uint32_t)(ymd % (1 << 5));
+        if (field_type == MYSQL_TYPE_DATE) {
+          buffer_length = snprintf(buffer,
+                                   sizeof(buffer),
+                                   "%04u-%02u-%02u",
+                                   year,
+                                   month,
+                                   day);
+        } else {
+          buffer_length = snprintf(buffer,
+                                   sizeof(buffer),
+                                   "%04u-%02u-%02u %02u:%02u:%02u.%06u",
+                                   year,
+                                   month,
+                                   day,
+                                   hms >> 12,
+                                   (hms >> 6) % (1 << 6),
+                                   hms % (1 << 6),
+                                   microseconds);
+        }
+      }
+    }
+    break;
+  default:
+    buffer_length = snprintf(buffer,
+                             sizeof(buffer),
+                             "base64:type%u:",
+                             field_type);
+    base64 = true;
+    break;
+  }
+
+  VALUE rb_string = decoder->rb_text;
+  if (RB_NIL_P(rb_string)) {
+    rb_string = rb_enc_str_new(buffer, buffer_length, rb_utf8_encoding());
+  } else {
+    rb_str_buf_cat(rb_string, "\"", 1);
+    rb_str_buf_cat(rb_string, buffer, buffer_length);
+  }
+  if (base64) {
+    rbm2_json_append_base64(rb_string, data, length);
+  }
+  if (RB_NIL_P(decoder->rb_text)) {
+    return rb_string;
+  } else {
+    rb_str_buf_cat(rb_string, "\"", 1);
+    return RUBY_Qnil;
+  }
+}
+
+static VALUE
+rbm2_json_decoder_decode(rbm2_json_decoder *decoder,
+                         uint8_t type,
+                         const uint8_t *data,
+                         uint32_t depth)
+{
+  switch (type) {
+  case RBM2_JSON_TYPE_SMALL_OBJECT:
+  case RBM2_JSON_TYPE_LARGE_OBJECT:
+  case RBM2_JSON_TYPE_SMALL_ARRAY:
+  case RBM2_JSON_TYPE_LARGE_ARRAY:
+    {
+      if (depth >= RBM2_JSON_MAX_DEPTH) {
+        rbm2_json_decoder_raise(decoder, "too deep");
+      }
+      rbm2_json_container container;
+      rbm2_json_container_init(decoder, &container, type, data);
+      VALUE rb_container;
+      if (container.object) {
+        rb_container = rb_hash_new();
+      } else {
+        rb_container = rb_ary_new_capa(container.n_elements);
+      }
+      uint32_t i;
+      for (i = 0; i < container.n_elements; i++) {
+        uint8_t value_type;
+        const uint8_t *value;
+        rbm2_json_container_get_value(decoder,
+                                      &container,
+                                      i,
+                                      &value_type,
+                                      &value);
+        VALUE rb_value =
+          rbm2_json_decoder_decode(decoder, value_type, value, depth + 1);
+        if (container.object) {
+          const char *key;
+          uint32_t key_length;
+          rbm2_json_container_get_key(decoder,
+                                      &container,
+                                      i,
+                                      &key,
+                                      &key_length);
+          rb_hash_aset(rb_container,
+                       rb_enc_str_new(key, key_length, rb_utf8_encoding()),
+                       rb_value);
+        } else {
+          rb_ary_push(rb_container, rb_value);
+        }
+      }
+      return rb_container;
+    }
+  case RBM2_JSON_TYPE_LITERAL:
+    rbm2_json_decoder_ensure(decoder, data, 1);
+    switch (data[0]) {
+    case RBM2_JSON_LITERAL_NULL:
+      return RUBY_Qnil;
+    case RBM2_JSON_LITERAL_TRUE:
+      return RUBY_Qtrue;
+    case RBM2_JSON_LITERAL_FALSE:
+      return RUBY_Qfalse;
+    default:
+      rbm2_json_decoder_raise(decoder, "unknown literal");
+      break;
+    }
+    break;
+  case RBM2_JSON_TYPE_INT16:
+    rbm2_json_decoder_ensure(decoder, data, 2);
+    return INT2NUM(rbm2_read_int16(data));
+  case RBM2_JSON_TYPE_UINT16:
+    rbm2_json_decoder_ensure(decoder, data, 2);
+    return UINT2NUM(rbm2_read_uint16(data));
+  case RBM2_JSON_TYPE_INT32:
+    rbm2_json_decoder_ensure(decoder, data, 4);
+    return INT2NUM(rbm2_read_int32(data));
+  case RBM2_JSON_TYPE_UINT32:
+    rbm2_json_decoder_ensure(decoder, data, 4);
+    return UINT2NUM(rbm2_read_uint32(data));
+  case RBM2_JSON_TYPE_INT64:
+    rbm2_json_decoder_ensure(decoder, data, 8);
+    return RUBY_LL2NUM(rbm2_read_int64(data));
+  case RBM2_JSON_TYPE_UINT64:
+    rbm2_json_decoder_ensure(decoder, data, 8);
+    return ULL2NUM(rbm2_read_uint64(data));
+  case RBM2_JSON_TYPE_DOUBLE:
+    {
+      rbm2_json_decoder_ensure(decoder, data, 8);
+      double value;
+      memcpy(&value, data, sizeof(value));
+      return rb_float_new(value);
+    }
+  case RBM2_JSON_TYPE_STRING:
+    {
+      uint32_t length = rbm2_json_decoder_read_variable_length(decoder, &data);
+      rbm2_json_decoder_ensure(decoder, data, length);
+      return rb_enc_str_new((const char *)data, length, rb_utf8_encoding());
+    }
+  case RBM2_JSON_TYPE_OPAQUE:
+    return rbm2_json_decoder_decode_opaque(decoder, data);
+  default:
+    rbm2_json_decoder_raise(decoder, "unknown type");
+    break;
+  }
+  return RUBY_Qnil;
+}
+
+static void
+rbm2_json_decoder_write_string(rbm2_json_decoder *decoder,
+                               const char *data,
+                               size_t size)
+{
+  VALUE rb_text = decoder->rb_text;
+  const char *start = data;
+  const char *current = data;
+  const char *end = data + size;
+  rb_str_buf_cat(rb_text, "\"", 1);
+  for (; current < end; current++) {
+    const char *escaped = NULL;
+    char buffer[7];
+    switch (*current) {
+    case '"':
+      escaped = "\\\"";
+      break;
+    case '\\':
+      escaped = "\\\\";
+      break;
+    case '\b':
+      escaped = "\\b";
+      break;
+    case '\f':
+      escaped = "\\f";
+      break;
+    case '\n':
+      escaped = "\\n";
+      break;
+    case '\r':
+      escaped = "\\r";
+      break;
+    case '\t':
+      escaped = "\\t";
+      break;
+    default:
+      if ((uint8_t)(*current) < 0x20) {
+        snprintf(buffer, sizeof(buffer), "\\u%04x", (uint8_t)(*current));
+        escaped = buffer;
+      }
+      break;
+    }
+    if (!escaped) {
+      continue;
+    }
+    rb_str_buf_cat(rb_text, start, current - start);
+    rb_str_buf_cat(rb_text, escaped, strlen(escaped));
+    start = current + 1;
+  }
+  rb_str_buf_cat(rb_text, start, end - start);
+  rb_str_buf_cat(rb_text, "\"", 1);
+}
+
+static void
+rbm2_json_decoder_write_double(rbm2_json_decoder *decoder, double value)
+{
+  /* The shortest representation that is read back as the same value */
+  char buffer[32];
+  int length = 0;
+  int precision;
+  for (precision = 15; precision <= 17; precision++) {
+    length = snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    if (strtod(buffer, NULL) == value) {
+      break;
+    }
+  }
+  rb_str_buf_cat(decoder->rb_text, buffer, length);
+  if (strspn(buffer, "-0123456789") == (size_t)length) {
+    rb_str_buf_cat(decoder->rb_text, ".0", 2);
+  }
+}
+
+static void
+rbm2_json_decoder_write(rbm2_json_decoder *decoder,
+                        uint8_t type,
+                        const uint8_t *data,
+                        uint32_t depth)
+{
+  VALUE rb_text = decoder->rb_text;
+  char buffer[32];
+  int length;
+  switch (type) {
+  case RBM2_JSON_TYPE_SMALL_OBJECT:
+  case RBM2_JSON_TYPE_LARGE_OBJECT:
+  case RBM2_JSON_TYPE_SMALL_ARRAY:
+  case RBM2_JSON_TYPE_LARGE_ARRAY:
+    {
+      if (depth >= RBM2_JSON_MAX_DEPTH) {
+        rbm2_json_decoder_raise(decoder, "too deep");
+      }
+      rbm2_json_container container;
+      rbm2_json_container_init(decoder, &container, type, data);
+      rb_str_buf_cat(rb_text, container.object ? "{" : "[", 1);
+      uint32_t i;
+      for (i = 0; i < container.n_elements; i++) {
+        if (i > 0) {
+          rb_str_buf_cat(rb_text, ", ", 2);
+        }
+        if (container.object) {
+          const char *key;
+          uint32_t key_length;
+          rbm2_json_container_get_key(decoder,
+                                      &container,
+                                      i,
+                                      &key,
+                                      &key_length);
+          rbm2_json_decoder_write_string(decoder, key, key_length);
+          rb_str_buf_cat(rb_text, ": ", 2);
+        }
+        uint8_t value_type;
+        const uint8_t *value;
+        rbm2_json_container_get_value(decoder,
+                                      &container,
+                                      i,
+                                      &value_type,
+                                      &value);
+        rbm2_json_decoder_write(decoder, value_type, value, depth + 1);
+      }
+      rb_str_buf_cat(rb_text, container.object ? "}" : "]", 1);
+    }
+    break;
+  case RBM2_JSON_TYPE_LITERAL:
+    rbm2_json_decoder_ensure(decoder, data, 1);
+    switch (data[0]) {
+    case RBM2_JSON_LITERAL_NULL:
+      rb_str_buf_cat(rb_text, "null", 4);
+      break;
+    case RBM2_JSON_LITERAL_TRUE:
+      rb_str_buf_cat(rb_text, "true", 4);
+      break;
+    case RBM2_JSON_LITERAL_FALSE:
+      rb_str_buf_cat(rb_text, "false", 5);
+      break;
+    default:
+      rbm2_json_decoder_raise(decoder, "unknown literal");
+      break;
+    }
+    break;
+  case RBM2_JSON_TYPE_INT16:
+    rbm2_json_decoder_ensure(decoder, data, 2);
+    length = snprintf(buffer, sizeof(buffer), "%d", rbm2_read_int16(data));
+    rb_str_buf_cat(rb_text, buffer, length);
+    break;
+  case RBM2_JSON_TYPE_UINT16:
+    rbm2_json_decoder_ensure(decoder, data, 2);
+    length = snprintf(buffer, sizeof(buffer), "%u", rbm2_read_uint16(data));
+    rb_str_buf_cat(rb_text, buffer, length);
+    break;
+  case RBM2_JSON_TYPE_INT32:
+    rbm2_json_decoder_ensure(decoder, data, 4);
+    length = snprintf(buffer, sizeof(buffer), "%d", rbm2_read_int32(data));
+    rb_str_buf_cat(rb_text, buffer, length);
+    break;
+  case RBM2_JSON_TYPE_UINT32:
+    rbm2_json_decoder_ensure(decoder, data, 4);
+    length = snprintf(buffer, sizeof(buffer), "%u", rbm2_read_uint32(data));
+    rb_str_buf_cat(rb_text, buffer, length);
+    break;
+  case RBM2_JSON_TYPE_INT64:
+    rbm2_json_decoder_ensure(decoder, data, 8);
+    length = snprintf(buffer,
+                      sizeof(buffer),
+                      "%" PRId64,
+                      rbm2_read_int64(data));
+    rb_str_buf_cat(rb_text, buffer, length);
+    break;
+  case RBM2_JSON_TYPE_UINT64:
+    rbm2_json_decoder_ensure(decoder, data, 8);
+    length = snprintf(buffer,
+                      sizeof(buffer),
+                      "%" PRIu64,
+                      rbm2_read_uint64(data));
+    rb_str_buf_cat(rb_text, buffer, length);
+    break;
+  case RBM2_JSON_TYPE_DOUBLE:
+    {
+      rbm2_json_decoder_ensure(decoder, data, 8);
+      double value;
+      memcpy(&value, data, sizeof(value));
+      rbm2_json_decoder_write_double(decoder, value);
+    }
+    break;
+  case RBM2_JSON_TYPE_STRING:
+    {
+      uint32_t string_length =
+        rbm2_json_decoder_read_variable_length(decoder, &data);
+      rbm2_json_decoder_ensure(decoder, data, string_length);
+      rbm2_json_decoder_write_string(decoder,
+                                     (const char *)data,
+                                     string_length);
+    }
+    break;
+  case RBM2_JSON_TYPE_OPAQUE:
+    rbm2_json_decoder_decode_opaque(decoder, data);
+    break;
+  default:
+    rbm2_json_decoder_raise(decoder, "unknown type");
+    break;
+  }
+}
+
+static VALUE
+rbm2_column_parse_json(const rbm2_column *column,
+                       const rbm2_decode_options *options,
+                       const uint8_t **row_data,
+                       const uint8_t *row_data_end)
+{
+  if (options->json_format == RBM2_JSON_FORMAT_RAW) {
+    return rbm2_column_parse_blob(column, options, row_data, row_data_end);
+  }
+
+  uint32_t length =
+    rbm2_column_read_blob_length(column, row_data, row_data_end);
+  const uint8_t *data = *row_data;
+  (*row_data) += length;
+
+  rbm2_json_decoder decoder;
+  decoder.data_end = data + length;
+  decoder.column = column;
+  decoder.options = options;
+  decoder.rb_text = RUBY_Qnil;
+  if (options->json_format == RBM2_JSON_FORMAT_TEXT) {
+    decoder.rb_text = rb_enc_str_new(NULL, 0, rb_utf8_encoding());
+  }
+  if (length == 0) {
+    /* An empty value is JSON null. */
+    if (RB_NIL_P(decoder.rb_text)) {
+      return RUBY_Qnil;
+    } else {
+      rb_str_buf_cat(decoder.rb_text, "null", 4);
+      return decoder.rb_text;
+    }
+  }
+  uint8_t type = data[0];
+  if (RB_NIL_P(decoder.rb_text)) {
+    return rbm2_json_decoder_decode(&decoder, type, data + 1, 0);
+  } else {
+    rbm2_json_decoder_write(&decoder, type, data + 1, 0);
+    return decoder.rb_text;
+  }
+}
+
+static VALUE
+rbm2_column_parse(const rbm2_column *column,
+                  const rbm2_decode_options *options,
+                  const uint8_t **row_data,
+                  const uint8_t *row_data_end)
+{
+  rbm2_decode_profile *profile = options->profile;
+  uint64_t start_time_ns = rbm2_decode_profile_start(profile);
+  const uint8_t *row_data_start = *row_data;
+  VALUE rb_value = RUBY_Qnil;
+  switch (column->type) {
+  case MYSQL_TYPE_DECIMAL:
+    rb_raise(rb_eNotImpError,
+             "decimal type isn't implemented yet: %+" PRIsVALUE ": %+" PRIsVALUE,
+             rbm2_column_type_to_symbol(column->type),
+             column->rb_column);
+    break;
+  case MYSQL_TYPE_TINY:
+    rbm2_row_data_ensure(*row_data, row_data_end, 1);
+    if (column->is_unsigned) {
+      rb_value = RB_UINT2NUM(rbm2_read_uint8(*row_data));
+    } else {
+      rb_value = RB_INT2NUM(rbm2_read_int8(*row_data));
+    }
+    (*row_data) += 1;
+    break;
+  case MYSQL_TYPE_SHORT:
+    rbm2_row_data_ensure(*row_data, row_data_end, 2);
+    if (column->is_unsigned) {
+      rb_value = RB_UINT2NUM(rbm2_read_uint16(*row_data));
+    } else {
+      rb_value = RB_INT2NUM(rbm2_read_int16(*row_data));
+    }
+    (*row_data) += 2;
+    break;
+  case MYSQL_TYPE_LONG:
+    rbm2_row_data_ensure(*row_data, row_data_end, 4);
+    if (column->is_unsigned) {
+      rb_value = RB_UINT2NUM(rbm2_read_uint32(*row_data));
+    } else {
+      rb_value = RB_INT2NUM(rbm2_read_int32(*row_data));
+    }
+    (*row_data) += 4;
+    break;
+  case MYSQL_TYPE_FLOAT:
+    rbm2_row_data_ensure(*row_data, row_data_end, 4);
+    rb_value = rb_float_new(*((const float *)(*row_data)));
+    (*row_data) += 4;
+    break;
+  case MYSQL_TYPE_DOUBLE:
+    rbm2_row_data_ensure(*row_data, row_data_end, 8);
+    rb_value = rb_float_new(*((const double *)(*row_data)));
+    (*row_data) += 8;
+    break;
+  case MYSQL_TYPE_NULL:
+    break;
+  case MYSQL_TYPE_TIMESTAMP:
+    {
+      rbm2_row_data_ensure(*row_data, row_data_end, 4);
+      uint32_t seconds = rbm2_read_uint32(*row_data);
+      /* Zero timestamp 0000-00-00 00:00:00 is nil like mysql2. */
+      if (seconds > 0) {
+        rb_value = rbm2_time_new(seconds, 0, false, options);
+      }
+      (*row_data) += 4;
+    }
+    break;
+  case MYSQL_TYPE_LONGLONG:
+    rbm2_row_data_ensure(*row_data, row_data_end, 8);
+    if (column->is_unsigned) {
+      rb_value = RB_ULL2NUM(rbm2_read_uint64(*row_data));
+    } else {
+      rb_value = RB_LL2NUM(rbm2_read_int64(*row_data));
+    }
+    (*row_data) += 8;
+    break;
+  case MYSQL_TYPE_INT24:
+    rbm2_row_data_ensure(*row_data, row_data_end, 3);
+    if (column->is_unsigned) {
+      rb_value = RB_UINT2NUM(rbm2_read_uint24(*row_data));
+    } else {
+      rb_value = RB_INT2NUM(rbm2_read_int24(*row_data));
+    }
+    (*row_data) += 3;
+    break;
+  case MYSQL_TYPE_DATE:
+    {
+      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_date */
+      rbm2_row_data_ensure(*row_data, row_data_end, 3);
+      rb_value = rbm2_date_new(rbm2_read_uint24(*row_data));
+      (*row_data) += 3;
+    }
+    break;
+  case MYSQL_TYPE_TIME:
+    {
+      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_time */
+      rbm2_row_data_ensure(*row_data, row_data_end, 3);
+      uint32_t raw_time = rbm2_read_uint24(*row_data);
+      /* HHMMSS */
+      rb_value = rb_sprintf("%02u:%02u:%02u",
+                            (raw_time / (10 * 4)),
+                            (raw_time % (10 * 4)) / (10 * 2),
+                            (raw_time % (10 * 2)));
+      (*row_data) += 3;
+    }
+    break;
+  case MYSQL_TYPE_DATETIME:
+    {
+      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_datetime */
+      rbm2_row_data_ensure(*row_data, row_data_end, 8);
+      uint64_t raw_time = rbm2_read_uint64(*row_data);
+      /* YYYYMMDDHHMMSS */
+      rb_value =
+        rbm2_datetime_new(raw_time / 10000000000,
+                          (raw_time % 10000000000) / 100000000,
+                          (raw_time %   100000000) /   1000000,
+                          (raw_time %     1000000) /     10000,
+                          (raw_time %       10000) /       100,
+                          (raw_time %         100),
+                          0,
+                          options);
+      (*row_data) += 8;
+    }
+    break;
+  case MYSQL_TYPE_YEAR:
+    rbm2_row_data_ensure(*row_data, row_data_end, 1);
+    rb_value = RB_UINT2NUM(rbm2_read_uint8(*row_data) + 1900);
+    (*row_data) += 1;
+    break;
+  case MYSQL_TYPE_NEWDATE:
+    rb_raise(rb_eNotImpError,
+             "newdate type isn't implemented yet: %+" PRIsVALUE ": %+" PRIsVALUE,
+             rbm2_column_type_to_symbol(column->type),
+             column->rb_column);
+    break;
+  case MYSQL_TYPE_VARCHAR:
+    rb_value = rbm2_column_parse_variable_length_string(column,
+                                                       options,
+                                                       row_data,
+                                                       row_data_end);
+    break;
+  case MYSQL_TYPE_BIT:
+    {
+      uint32_t bits = column->bits;
+      rbm2_row_data_ensure(*row_data, row_data_end, (bits + 7) / 8);
+      switch ((bits + 7) / 8) {
+      case 1:
+        rb_value = RB_UINT2NUM(rbm2_read_uint8(*row_data));
+        (*row_data) += 1;
+        break;
+      case 2:
+        rb_value = RB_UINT2NUM(rbm2_read_uint16(*row_data));
+        (*row_data) += 2;
+        break;
+      case 3:
+        rb_value = RB_UINT2NUM(rbm2_read_uint24(*row_data));
+        (*row_data) += 3;
+        break;
+      case 4:
+        rb_value = RB_UINT2NUM(rbm2_read_uint32(*row_data));
+        (*row_data) += 4;
+        break;
+      default :
+        rb_raise(rb_eNotImpError,
+                 "%u bit type isn't implemented yet: %+" PRIsVALUE
+                 ": %+" PRIsVALUE,
+                 bits,
+                 rbm2_column_type_to_symbol(column->type),
+                 column->rb_column);
+        break;
+      }
+    }
+    break;
+  case MYSQL_TYPE_TIMESTAMP2:
+    {
+      /* https://mariadb.com/kb/en/rows_event_v1/#mysql_type_timestamp2 */
+      uint32_t decimals = column->decimals;
+      rbm2_row_data_ensure(*row_data, row_data_end, 4 + (decimals + 1) / 2);
+      uint32_t seconds = rbm2_read_uint32_bigendian(*row_data);
+      (*row_data) += 4;
+      uint32_t fractional_seconds = 0;
+      switch ((decimals + 1) / 2) {
+      case 1:
+        fractional_seconds = rbm2_read_uint8(*row_data) * 10000;
+        (*row_data) += 1;
+        break;
+      case 2:
+        fractional_seconds = rbm2_read_uint16_bigendian(*row_data) * 100;
+        (*row_data) += 2;
+        break;
+      case 3:
+        fractional_seconds = rbm2_read_uint24_bigendian(*row_data);
+        (*row_data) += 3;
+        break;
+      default :
+        break;
+      }
+      /* Zero timestamp 0000-00-00 00:00:00 is nil like mysql2. */
+      if (seconds > 0 || fractional_seconds > 0) {
+        rb_value = rbm2_time_new(seconds, fractional_seconds, false, options);
+      }
+    }
+    break;
+  case MYSQL_TYPE_DATETIME2:
+    {
+      /*
+        See the documentation of TIME_to_longlong_datetime_packed().
+
+        https://github.com/mysql/mysql-server/blob/mysql-8.0.27/mysys/my_time.cc#L1672-L1691
+       */
+      uint32_t decimals = column->decimals;
+      rbm2_row_data_ensure(*row_data, row_data_end, 5 + (decimals + 1) / 2);
+      uint64_t integer_part = rbm2_read_uint40_bigendian(*row_data);
+      (*row_data) += 5;
+      uint32_t fractional_seconds = 0;
+      switch ((decimals + 1) / 2) {
+      case 1:
+        fractional_seconds = rbm2_read_uint8(*row_data) * 10000;
+        (*row_data) += 1;
+        break;
+      case 2:
+        fractional_seconds = rbm2_read_uint16_bigendian(*row_data) * 100;
+        (*row_data) += 2;
+        break;
+      case 3:
+        fractional_seconds = rbm2_read_uint24_bigendian(*row_data);
+        (*row_data) += 3;
+        break;
+      default :
+        break;
+      }
+      uint32_t symd = integer_part >> 17;
+      uint32_t sym = symd >> 5;
+      uint32_t sign = sym >> 17;
+      uint32_t ym = sym % (1 << 17);
+      int64_t year = ym / 13;
+      if (sign == 0) {
+        year = -year;
+      }
+      uint32_t month = ym % 13;
+      uint32_t day = symd % (1 << 5);
+      uint32_t hms = integer_part % (1 << 17);
+      uint32_t hour = hms >> 12;
+      uint32_t minute = (hms >> 6) % (1 << 6);
+      uint32_t second = hms % (1 << 6);
+      rb_value = rbm2_datetime_new(year,
+                                   month,
+                                   day,
+                                   hour,
+                                   minute,
+                                   second,
+                                   fractional_seconds,
+                                   options);
+    }
+    break;
+  case MYSQL_TYPE_TIME2:
+    {
+      /*
+        See also my_time_packed_from_binary() and
+        TIME_from_longlong_time_packed():
+
+        https://github.com/mysql/mysql-server/blob/mysql-8.0.27/mysys/my_time.cc#L1549-L1580
+        https://github.com/mysql/mysql-server/blob/mysql-8.0.27/mysys/my_time.cc#L1484-L1496
+      */
+      const int64_t integer_part_offset = 0x800000;
+      const int64_t packed_offset = 0x800000000000;
+      uint32_t decimals = column->decimals;
+      int64_t integer_part;
+      int64_t fractional_seconds = 0;
+      if (decimals > 6) {
+        rb_raise(rb_eNotImpError,
+                 "unsupported time2 decimals: %u: %+" PRIsVALUE,
+                 decimals,
+                 column->rb_column);
+      }
+      rbm2_row_data_ensure(*row_data, row_data_end, 3 + (decimals + 1) / 2);
+      switch ((decimals + 1) / 2) {
+      case 1:
+        integer_part =
+          (int64_t)rbm2_read_uint24_bigendian(*row_data) - integer_part_offset;
+        fractional_seconds = rbm2_read_uint8((*row_data) + 3);
+        if (integer_part < 0 && fractional_seconds > 0) {
+          integer_part++;
+          fractional_seconds -= 0x100;
+        }
+        fractional_seconds *= 10000;
+        (*row_data) += 4;
+        break;
+      case 2:
+        integer_part =
+          (int64_t)rbm2_read_uint24_bigendian(*row_data) - integer_part_offset;
+        fractional_seconds = rbm2_read_uint16_bigendian((*row_data) + 3);
+        if (integer_part < 0 && fractional_seconds > 0) {
+          integer_part++;
+          fractional_seconds -= 0x10000;
+        }
+        fractional_seconds *= 100;
+        (*row_data) += 5;
+        break;
+      case 3:
+        {
+          int64_t packed =
+            (int64_t)rbm2_read_uint48_bigendian(*row_data) - packed_offset;
+          integer_part = packed / (1 << 24);
+          fractional_seconds = packed % (1 << 24);
+          (*row_data) += 6;
+        }
+        break;
+      default:
+        integer_part =
+          (int64_t)rbm2_read_uint24_bigendian(*row_data) - integer_part_offset;
+        (*row_data) += 3;
+        break;
+      }
+      int64_t packed = (integer_part * (1 << 24)) + fractional_seconds;
+      bool negative = (packed < 0);
+      if (negative) {
+        packed = -packed;
+      }
+      uint32_t hms = (uint32_t)(packed >> 24);
+      uint32_t hour = (hms >> 12) % (1 << 10);
+      uint32_t minute = (hms >> 6) % (1 << 6);
+      uint32_t second = hms % (1 << 6);
+      uint32_t microseconds = (uint32_t)(packed % (1 << 24));
+      /* [-]HH:MM:SS[.fraction] */
+      if (decimals == 0) {
+        rb_value = rb_sprintf("%s%02u:%02u:%02u",
+                              negative ? "-" : "",
+                              hour,
+                              minute,
+                              second);
+      } else {
+        rb_value = rb_sprintf("%s%02u:%02u:%02u.%0*u",
+                              negative ? "-" : "",
+                              hour,
+                              minute,
+                              second,
+                              (int)decimals,
+                              microseconds /
+                              rbm2_decimal_powers_of_ten[6 - decimals]);
+      }
+    }
+    break;
+  case MYSQL_TYPE_JSON:
+    rb_value = rbm2_column_parse_json(column, options, row_data, row_data_end);
+    break;
+  case MYSQL_TYPE_NEWDECIMAL:
+    rb_value = rbm2_column_parse_decimal(column,
+                                         options,
+                                         row_data,
+                                         row_data_end);
+    break;
+  case MYSQL_TYPE_ENUM:
+  case MYSQL_TYPE_SET:
+    rb_value = rbm2_column_parse_variable_size_uint(column,
+                                                    row_data,
+                                                    row_data_end);
+    break;
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+    rb_value = rbm2_column_parse_blob(column, options, row_data, row_data_end);
+    break;
+  case MYSQL_TYPE_VAR_STRING:
+    rb_value = rbm2_column_parse_variable_length_string(column,
+                                                       options,
+                                                       row_data,
+                                                       row_data_end);
+    break;
+  case MYSQL_TYPE_STRING:
+    rb_value = rbm2_column_parse_variable_length_string(column,
+                                                       options,
+                                                       row_data,
+                                                       row_data_end);
+    break;
+  case MYSQL_TYPE_GEOMETRY:
+    /*
+      Geometry values are stored as blob: 4 bytes SRID (little endian)
+      followed by WKB. This is the same value as mysql2 returns for
+      geometry columns.
+    */
+    {
+      /* Geometry values are binary even if they have charset. */
+      rbm2_column geometry_column = *column;
+      geometry_column.encoding = NULL;
+      rb_value = rbm2_column_parse_blob(&geometry_column,
+                                        options,
+                                        row_data,
+                                        row_data_end);
+    }
+    break;
+  default:
+    rb_raise(rb_eNotImpError,
+             "unknown type isn't implemented yet: %+" PRIsVALUE
+             ": %+" PRIsVALUE,
+             rbm2_column_type_to_symbol(column->type),
+             column->rb_column);
+    break;
+  }
+  if (profile) {
+    rbm2_decode_profile_add(&(profile->columns[column->type]),
+                            start_time_ns,
+                            1,
+                            *row_data - row_data_start);
+  }
+  return rb_value;
+}
+
+static inline bool
+rbm2_bitmap_is_set(const uint8_t *bitmap, uint32_t i)
+{
+  return (bitmap[i >> 3] >> (i & 0x07)) & 1;
+}
+
+static inline bool
+rbm2_bitmap_has_set(const uint8_t *bitmap, uint32_t n_bits)
+{
+  uint32_t i;
+  for (i = 0; i < n_bits; i++) {
+    if (rbm2_bitmap_is_set(bitmap, i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * A table filter is a frozen Array of [database, table] pairs. nil in
+ * a pair matches any name. They are built from "database.table",
+ * "database.*", "*.table" and "database" patterns.
+ */
+static VALUE
+rbm2_table_filter_parse(VALUE rb_patterns)
+{
+  if (RB_NIL_P(rb_patterns)) {
+    return RUBY_Qnil;
+  }
+  rb_patterns = rb_Array(rb_patterns);
+  long n_patterns = RARRAY_LEN(rb_patterns);
+  VALUE rb_filter = rb_ary_new_capa(n_patterns);
+  long i;
+  for (i = 0; i < n_patterns; i++) {
+    VALUE rb_pattern = rb_String(RARRAY_AREF(rb_patterns, i));
+    const char *pattern = RSTRING_PTR(rb_pattern);
+    long pattern_length = RSTRING_LEN(rb_pattern);
+    const char *separator = memchr(pattern, '.', pattern_length);
+    VALUE rb_database;
+    VALUE rb_table;
+    if (separator) {
+      rb_database = rb_str_new(pattern, separator - pattern);
+      rb_table = rb_str_new(separator + 1,
+                            pattern_length - (separator - pattern) - 1);
+    } else {
+      rb_database = rb_str_new(pattern, pattern_length);
+      rb_table = rb_str_new_cstr("*");
+    }
+    if (RSTRING_LEN(rb_database) == 1 && RSTRING_PTR(rb_database)[0] == '*') {
+      rb_database = RUBY_Qnil;
+    } else {
+      rb_obj_freeze(rb_database);
+    }
+    if (RSTRING_LEN(rb_table) == 1 && RSTRING_PTR(rb_table)[0] == '*') {
+      rb_table = RUBY_Qnil;
+    } else {
+      rb_obj_freeze(rb_table);
+    }
+    rb_ary_push(rb_filter,
+                rb_obj_freeze(rb_assoc_new(rb_database, rb_table)));
+  }
+  return rb_obj_freeze(rb_filter);
+}
+
+static inline bool
+rbm2_table_filter_name_match(VALUE rb_name, const char *name, size_t length)
+{
+  if (RB_NIL_P(rb_name)) {
+    return true;
+  }
+  return ((size_t)RSTRING_LEN(rb_name) == length &&
+          memcmp(RSTRING_PTR(rb_name), name, length) == 0);
+}
+
+static bool
+rbm2_table_filter_match(VALUE rb_filter,
+                        const char *database,
+                        size_t database_length,
+                        const char *table,
+                        size_t table_length)
+{
+  long i;
+  long n_patterns = RARRAY_LEN(rb_filter);
+  for (i = 0; i < n_patterns; i++) {
+    VALUE rb_pattern = RARRAY_AREF(rb_filter, i);
+    if (rbm2_table_filter_name_match(RARRAY_AREF(rb_pattern, 0),
+                                     database,
+                                     database_length) &&
+        rbm2_table_filter_name_match(RARRAY_AREF(rb_pattern, 1),
+                                     table,
+                                     table_length)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static VALUE
+rbm2_table_filter_to_patterns(VALUE rb_filter)
+{
+  if (RB_NIL_P(rb_filter)) {
+    return RUBY_Qnil;
+  }
+  long n_patterns = RARRAY_LEN(rb_filter);
+  VALUE rb_patterns = rb_ary_new_capa(n_patterns);
+  long i;
+  for (i = 0; i < n_patterns; i++) {
+    VALUE rb_pattern = RARRAY_AREF(rb_filter, i);
+    VALUE rb_database = RARRAY_AREF(rb_pattern, 0);
+    VALUE rb_table = RARRAY_AREF(rb_pattern, 1);
+    rb_ary_push(rb_patterns,
+                rb_sprintf("%s.%s",
+                           RB_NIL_P(rb_database) ?
+                             "*" : StringValueCStr(rb_database),
+                           RB_NIL_P(rb_table) ?
+                             "*" : StringValueCStr(rb_table)));
+  }
+  return rb_patterns;
+}
+
+/*
+ * Decoding state that doesn't depend on where events come from. It's
+ * shared by Client and FileReader.
+ */
+typedef struct
+{
+  VALUE rb_table_maps;
+  VALUE rb_tables;
+  long table_cache_size;
+  bool force_disable_use_checksum;
+  bool format_description_processed;
+  rbm2_decode_options options;
+  VALUE rb_include_tables;
+  VALUE rb_exclude_tables;
+  bool skip_filtered_events;
+  /* Detected by the server version in FORMAT_DESCRIPTION_EVENT. */
+  bool is_mariadb;
+} rbm2_decoder;
+
+static void
+rbm2_decoder_init(rbm2_decoder *decoder)
+{
+  decoder->rb_table_maps = rb_hash_new();
+  decoder->rb_tables = rb_hash_new();
+  decoder->table_cache_size = 1024;
+  decoder->force_disable_use_checksum = false;
+  decoder->format_description_processed = false;
+  rbm2_decode_options_init(&(decoder->options));
+  decoder->rb_include_tables = RUBY_Qnil;
+  decoder->rb_exclude_tables = RUBY_Qnil;
+  decoder->skip_filtered_events = false;
+  decoder->is_mariadb = false;
+}
+
+static void
+rbm2_decoder_mark(rbm2_decoder *decoder)
+{
+  rb_gc_mark(decoder->rb_table_maps);
+  rb_gc_mark(decoder->rb_tables);
+  rb_gc_mark(decoder->rb_include_tables);
+  rb_gc_mark(decoder->rb_exclude_tables);
+  rb_gc_mark(decoder->options.rb_stats);
+}
+
+static void
+rbm2_decoder_parse_options(rbm2_decoder *decoder, VALUE rb_options)
+{
+  if (RB_NIL_P(rb_options)) {
+    return;
+  }
+
+  static ID keyword_ids[10];
+  VALUE keyword_args[10];
+  if (keyword_ids[0] == 0) {
+    CONST_ID(keyword_ids[0], "row_format");
+    CONST_ID(keyword_ids[1], "include_tables");
+    CONST_ID(keyword_ids[2], "exclude_tables");
+    CONST_ID(keyword_ids[3], "skip_filtered_events");
+    CONST_ID(keyword_ids[4], "table_cache_size");
+    CONST_ID(keyword_ids[5], "decimal_format");
+    CONST_ID(keyword_ids[6], "time_format");
+    CONST_ID(keyword_ids[7], "json_format");
+    CONST_ID(keyword_ids[8], "shareable");
+    CONST_ID(keyword_ids[9], "share_strings");
+  }
+  rb_get_kwargs(rb_options, keyword_ids, 0, 10, keyword_args);
+  if (keyword_args[0] != RUBY_Qundef && !RB_NIL_P(keyword_args[0])) {
+    decoder->options.row_format = rbm2_row_format_parse(keyword_args[0]);
+  }
+  if (keyword_args[1] != RUBY_Qundef) {
+    decoder->rb_include_tables = rbm2_table_filter_parse(keyword_args[1]);
+  }
+  if (keyword_args[2] != RUBY_Qundef) {
+    decoder->rb_exclude_tables = rbm2_table_filter_parse(keyword_args[2]);
+  }
+  if (keyword_args[3] != RUBY_Qundef) {
+    decoder->skip_filtered_events = RB_TEST(keyword_args[3]);
+  }
+  if (keyword_args[4] != RUBY_Qundef && !RB_NIL_P(keyword_args[4])) {
+    decoder->table_cache_size = NUM2LONG(keyword_args[4]);
+  }
+  if (keyword_args[5] != RUBY_Qundef && !RB_NIL_P(keyword_args[5])) {
+    decoder->options.decimal_format =
+      rbm2_decimal_format_parse(keyword_args[5]);
+  }
+  if (keyword_args[6] != RUBY_Qundef && !RB_NIL_P(keyword_args[6])) {
+    decoder->options.time_format = rbm2_time_format_parse(keyword_args[6]);
+  }
+  if (keyword_args[7] != RUBY_Qundef && !RB_NIL_P(keyword_args[7])) {
+    decoder->options.json_format = rbm2_json_format_parse(keyword_args[7]);
+  }
+  if (keyword_args[8] != RUBY_Qundef) {
+    decoder->options.shareable = RB_TEST(keyword_args[8]);
+  }
+  if (keyword_args[9] != RUBY_Qundef) {
+    decoder->options.share_strings = RB_TEST(keyword_args[9]);
+  }
+}
+
+static bool
+rbm2_decoder_is_target_table(rbm2_decoder *decoder,
+                             struct st_mariadb_rpl_table_map_event *table_map)
+{
+  if (!RB_NIL_P(decoder->rb_include_tables) &&
+      !rbm2_table_filter_match(decoder->rb_include_tables,
+                               table_map->database.str,
+                               table_map->database.length,
+                               table_map->table.str,
+                               table_map->table.length)) {
+    return false;
+  }
+  if (!RB_NIL_P(decoder->rb_exclude_tables) &&
+      rbm2_table_filter_match(decoder->rb_exclude_tables,
+                              table_map->database.str,
+                              table_map->database.length,
+                              table_map->table.str,
+                              table_map->table.length)) {
+    return false;
+  }
+  return true;
+}
+
+/*
+ * TABLE_MAP_EVENTs for the same table are sent again and again. This
+ * reuses the table descriptor built for the previous TABLE_MAP_EVENT
+ * while its table ID and schema aren't changed.
+ */
+static VALUE
+rbm2_decoder_find_table(rbm2_decoder *decoder,
+                        struct st_mariadb_rpl_table_map_event *table_map,
+                        const uint8_t *optional_metadata,
+                        size_t optional_metadata_size)
+{
+  rbm2_optional_metadata metadata;
+  metadata.data = optional_metadata;
+  metadata.size = optional_metadata_size;
+  metadata.is_mariadb = decoder->is_mariadb;
+  VALUE rb_table_id = ULL2NUM(table_map->table_id);
+  st_index_t signature_hash =
+    rbm2_table_map_signature_hash(table_map, &metadata);
+  VALUE rb_table = rb_hash_lookup(decoder->rb_tables, rb_table_id);
+  if (!RB_NIL_P(rb_table) &&
+      rbm2_table_match(rbm2_table_get(rb_table),
+                       table_map,
+                       &metadata,
+                       signature_hash)) {
+    return rb_table;
+  }
+  rb_table = rbm2_table_new_from_table_map(table_map,
+                                           &metadata,
+                                           signature_hash);
+  if (RHASH_SIZE(decoder->rb_tables) >= (size_t)(decoder->table_cache_size)) {
+    rb_hash_clear(decoder->rb_tables);
+  }
+  if (decoder->table_cache_size > 0) {
+    rb_hash_aset(decoder->rb_tables, rb_table_id, rb_table);
+  }
+  return rb_table;
+}
+
+/*
+ * The checksum algorithm is stored at the end of
+ * FORMAT_DESCRIPTION_EVENT by servers that support checksum.
+ *
+ * See also Format_description_log_event::get_checksum_alg():
+ * https://github.com/mysql/mysql-server/blob/mysql-8.0.27/libbinlogevents/src/control_events.cpp#L175-L214
+ */
+static bool
+rbm2_format_description_event_use_checksum(const uint8_t *raw_event,
+                                           size_t raw_event_size)
+{
+  const size_t server_version_size = 50;
+  /* format(2) + server_version(50) + timestamp(4) + header_len(1) */
+  const size_t min_body_size = 2 + server_version_size + 4 + 1;
+  /* algorithm(1) + checksum(4) */
+  const size_t footer_size = 1 + RBM2_EVENT_CHECKSUM_SIZE;
+  if (raw_event_size < RBM2_EVENT_HEADER_SIZE + min_body_size + footer_size) {
+    return false;
+  }
+  char server_version[51];
+  memcpy(server_version,
+         raw_event + RBM2_EVENT_HEADER_SIZE + 2,
+         server_version_size);
+  server_version[server_version_size] = '\0';
+  unsigned int major = 0;
+  unsigned int minor = 0;
+  unsigned int micro = 0;
+  sscanf(server_version, "%u.%u.%u", &major, &minor, &micro);
+  unsigned int version = (major * 10000) + (minor * 100) + micro;
+  unsigned int checksum_version;
+  if (strstr(server_version, "MariaDB")) {
+    checksum_version = 50300;
+  } else {
+    checksum_version = 50601;
+  }
+  if (version < checksum_version) {
+    return false;
+  }
+  uint8_t algorithm = raw_event[raw_event_size - footer_size];
+  /* 0: off, 1: CRC32 */
+  return algorithm == 1;
+}
+
+/*
+ * Tracks transaction boundaries:
+ *
+ *   * MariaDB: GTID_EVENT ... XID_EVENT or QUERY_EVENT(COMMIT)
+ *   * MariaDB: GTID_EVENT(standalone) QUERY_EVENT(DDL)
+ *   * MySQL: GTID_LOG_EVENT QUERY_EVENT(BEGIN) ... XID_EVENT
+ *   * MySQL: GTID_LOG_EVENT QUERY_EVENT(DDL)
+ *   * Without GTID: QUERY_EVENT(BEGIN) ... XID_EVENT or QUERY_EVENT(DDL)
+ *
+ * rb_gtid, have_xid and xid are for the current or the last
+ * transaction.
+ */
+typedef struct
+{
+  /* Whether GTID, BEGIN or a rows event is processed */
+  bool in_transaction;
+  /* Whether COMMIT or XID_EVENT ends the current transaction */
+  bool need_commit;
+  VALUE rb_gtid;
+  bool have_xid;
+  uint64_t xid;
+} rbm2_transaction_state;
+
+typedef enum
+{
+  /* Outside of transactions such as ROTATE_EVENT */
+  RBM2_TRANSACTION_EVENT_OUTSIDE,
+  /* GTID or BEGIN */
+  RBM2_TRANSACTION_EVENT_BEGIN,
+  /* In a transaction such as rows events */
+  RBM2_TRANSACTION_EVENT_BODY,
+  /* The last event in a transaction such as DDL */
+  RBM2_TRANSACTION_EVENT_LAST,
+  /* COMMIT or XID */
+  RBM2_TRANSACTION_EVENT_COMMIT,
+} rbm2_transaction_event_role;
+
+typedef struct
+{
+  MARIADB_RPL *rpl;
+  MARIADB_RPL_EVENT *rpl_event;
+  VALUE rb_client;
+  /* GTID (MariaDB) or GTID set (MySQL) to start from */
+  VALUE rb_gtid;
+  /* Whether COM_BINLOG_DUMP_GTID is sent without mariadb_rpl_open() */
+  bool binlog_dump_gtid;
+  /* SET @master_binlog_checksum for reconnect */
+  VALUE rb_checksum_query;
+  /*
+   * The position after the last fully processed transaction.
+   * next_file_name and next_position are for the last read event. They
+   * are committed when the next event is requested.
+   */
+  VALUE rb_current_file_name;
+  uint64_t current_position;
+  VALUE rb_next_file_name;
+  uint64_t next_position;
+  rbm2_transaction_state transaction_state;
+  bool auto_reconnect;
+  /* Negative means unlimited. */
+  int max_reconnect_attempts;
+  /* In seconds. It's doubled for each attempt. */
+  double reconnect_interval;
+  /* In seconds. Negative means the server default. */
+  double heartbeat_period;
+  rbm2_decoder decoder;
+  uint8_t *batch_buffer;
+  size_t batch_buffer_size;
+  size_t batch_buffer_capacity;
+} rbm2_replication_client_wrapper;
+
+static void
+rbm2_replication_client_mark(void *data)
+{
+  rbm2_replication_client_wrapper *wrapper = data;
+  rb_gc_mark(wrapper->rb_client);
+  rb_gc_mark(wrapper->rb_gtid);
+  rb_gc_mark(wrapper->rb_checksum_query);
+  rb_gc_mark(wrapper->rb_current_file_name);
+  rb_gc_mark(wrapper->rb_next_file_name);
+  rb_gc_mark(wrapper->transaction_state.rb_gtid);
+  rbm2_decoder_mark(&(wrapper->decoder));
+}
+
+static void
+rbm2_replication_client_free(void *data)
+{
+  rbm2_replication_client_wrapper *wrapper = data;
+  if (wrapper->rpl_event) {
+    mariadb_free_rpl_event(wrapper->rpl_event);
+  }
+  if (wrapper->rpl) {
+    mariadb_rpl_close(wrapper->rpl);
+  }
+  free(wrapper->batch_buffer);
+  ruby_xfree(wrapper);
+}
+
+static const rb_data_type_t rbm2_replication_client_type = {
+  "Mysql2Replication::Client",
+  {
+    rbm2_replication_client_mark,
+    rbm2_replication_client_free,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+#define RBM2_DEFAULT_MAX_RECONNECT_ATTEMPTS 10
+#define RBM2_DEFAULT_RECONNECT_INTERVAL 1.0
+#define RBM2_MAX_RECONNECT_INTERVAL 60.0
+
+static VALUE
+rbm2_replication_client_alloc(VALUE klass)
+{
+  rbm2_replication_client_wrapper *wrapper;
+  VALUE rb_wrapper = TypedData_Make_Struct(klass,
+                                           rbm2_replication_client_wrapper,
+                                           &rbm2_replication_client_type,
+                                           wrapper);
+  wrapper->rpl = NULL;
+  wrapper->rpl_event = NULL;
+  wrapper->rb_client = RUBY_Qnil;
+  wrapper->rb_gtid = RUBY_Qnil;
+  wrapper->binlog_dump_gtid = false;
+  wrapper->rb_checksum_query = RUBY_Qnil;
+  wrapper->rb_current_file_name = RUBY_Qnil;
+  wrapper->current_position = 0;
+  wrapper->rb_next_file_name = RUBY_Qnil;
+  wrapper->next_position = 0;
+  wrapper->transaction_state.in_transaction = false;
+  wrapper->transaction_state.need_commit = false;
+  wrapper->transaction_state.rb_gtid = RUBY_Qnil;
+  wrapper->transaction_state.have_xid = false;
+  wrapper->transaction_state.xid = 0;
+  wrapper->auto_reconnect = false;
+  wrapper->max_reconnect_attempts = RBM2_DEFAULT_MAX_RECONNECT_ATTEMPTS;
+  wrapper->reconnect_interval = RBM2_DEFAULT_RECONNECT_INTERVAL;
+  wrapper->heartbeat_period = -1.0;
+  rbm2_decoder_init(&(wrapper->decoder));
+  wrapper->batch_buffer = NULL;
+  wrapper->batch_buffer_size = 0;
+  wrapper->batch_buffer_capacity = 0;
+  return rb_wrapper;
+}
+
+static inline rbm2_replication_client_wrapper *
+rbm2_replication_client_get_wrapper(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper;
+  TypedData_Get_Struct(self,
+                       rbm2_replication_client_wrapper,
+                       &rbm2_replication_client_type,
+                       wrapper);
+  return wrapper;
+}
+
+static inline mysql_client_wrapper *
+rbm2_replication_client_wrapper_get_client_wrapper(
+  rbm2_replication_client_wrapper *replication_client_wrapper)
+{
+  GET_CLIENT(replication_client_wrapper->rb_client);
+  return wrapper;
+}
+
+static inline MYSQL *
+rbm2_replication_client_wrapper_get_client(
+  rbm2_replication_client_wrapper *wrapper)
+{
+  return rbm2_replication_client_wrapper_get_client_wrapper(wrapper)->client;
+}
+
+static void
+rbm2_replication_client_raise(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  mysql_client_wrapper *client_wrapper =
+    rbm2_replication_client_wrapper_get_client_wrapper(wrapper);
+  VALUE rb_error_message =
+    rb_enc_str_new_cstr(mysql_error(client_wrapper->client),
+                        rb_utf8_encoding());
+  VALUE rb_sql_state =
+    rb_enc_str_new_cstr(mysql_sqlstate(client_wrapper->client),
+                        rb_usascii_encoding());
+  ID new_with_args;
+  CONST_ID(new_with_args, "new_with_args");
+  VALUE rb_error = rb_funcall(rb_eMysql2Error,
+                              new_with_args,
+                              4,
+                              rb_error_message,
+                              LONG2NUM(client_wrapper->server_version),
+                              UINT2NUM(mysql_errno(client_wrapper->client)),
+                              rb_sql_state);
+  rb_exc_raise(rb_error);
+}
+
+static VALUE
+rbm2_replication_client_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_client;
+  VALUE rb_options;
+  VALUE rb_checksum = RUBY_Qnil;
+
+  rb_scan_args(argc, argv, "10:", &rb_client, &rb_options);
+  if (!RB_NIL_P(rb_options)) {
+    rb_options = rb_hash_dup(rb_options);
+    rb_checksum = rb_hash_delete(rb_options, rb_id2sym(rb_intern("checksum")));
+  }
+
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  rbm2_decoder_parse_options(&(wrapper->decoder), rb_options);
+  wrapper->decoder.options.rb_stats = rbm2_stats_new();
+  wrapper->rb_client = rb_client;
+  wrapper->rpl =
+    mariadb_rpl_init(rbm2_replication_client_wrapper_get_client(wrapper));
+  if (!wrapper->rpl) {
+    rbm2_replication_client_raise(self);
+  }
+
+  {
+    VALUE rb_query;
+    if (RB_NIL_P(rb_checksum)) {
+      rb_query = rb_str_new_cstr("SET @master_binlog_checksum = "
+                                 "@@global.binlog_checksum");
+    } else {
+      rb_query = rb_sprintf("SET @master_binlog_checksum = '%"PRIsVALUE"'",
+                            rb_checksum);
+    }
+    ID id_query;
+    CONST_ID(id_query, "query");
+    rb_funcall(rb_client, id_query, 1, rb_query);
+    wrapper->rb_checksum_query = rb_query;
+  }
+  if (rb_equal(rb_str_new_cstr("NONE"), rb_checksum)) {
+    wrapper->decoder.force_disable_use_checksum = true;
+  } else {
+    wrapper->decoder.force_disable_use_checksum = false;
+  }
+  wrapper->decoder.format_description_processed = false;
+
+  return RUBY_Qnil;
+}
+
+static VALUE
+rbm2_replication_client_get_file_name(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  const char *file_name;
+  size_t file_name_length;
+  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
+                                        MARIADB_RPL_FILENAME,
+                                        &file_name,
+                                        &file_name_length);
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return rb_str_new(file_name, file_name_length);
+}
+
+static VALUE
+rbm2_replication_client_set_file_name(VALUE self, VALUE file_name)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  int result;
+  if (RB_NIL_P(file_name)) {
+    result = mariadb_rpl_optionsv(wrapper->rpl,
+                                  MARIADB_RPL_FILENAME,
+                                  NULL,
+                                  0);
+  } else {
+    result = mariadb_rpl_optionsv(wrapper->rpl,
+                                  MARIADB_RPL_FILENAME,
+                                  RSTRING_PTR(file_name),
+                                  RSTRING_LEN(file_name));
+  }
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return file_name;
+}
+
+static VALUE
+rbm2_replication_client_get_start_position(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  unsigned long start_position;
+  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
+                                        MARIADB_RPL_START,
+                                        &start_position);
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return ULONG2NUM(start_position);
+}
+
+static VALUE
+rbm2_replication_client_set_start_position(VALUE self, VALUE start_position)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  int result = mariadb_rpl_optionsv(wrapper->rpl,
+                                    MARIADB_RPL_START,
+                                    NUM2ULONG(start_position));
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return start_position;
+}
+
+static VALUE
+rbm2_replication_stats_get_n_events(VALUE self)
+{
+  return ULL2NUM(rbm2_stats_get(self)->n_events);
+}
+
+static VALUE
+rbm2_replication_stats_get_n_bytes(VALUE self)
+{
+  return ULL2NUM(rbm2_stats_get(self)->n_bytes);
+}
+
+static VALUE
+rbm2_replication_stats_get_n_decoded_rows(VALUE self)
+{
+  return ULL2NUM(rbm2_stats_get(self)->n_decoded_rows);
+}
+
+/*
+ * Seconds between now and the timestamp of the last event. nil until
+ * an event that has timestamp is read.
+ */
+static VALUE
+rbm2_replication_stats_get_lag(VALUE self)
+{
+  rbm2_stats *stats = rbm2_stats_get(self);
+  if (stats->last_timestamp == 0) {
+    return RUBY_Qnil;
+  }
+  int64_t lag = (int64_t)time(NULL) - stats->last_timestamp;
+  if (lag < 0) {
+    lag = 0;
+  }
+  return LL2NUM(lag);
+}
+
+static double
+rbm2_stats_elapsed_time(rbm2_stats *stats)
+{
+  return (rbm2_monotonic_time_ns() - stats->started_time_ns) / 1e9;
+}
+
+static VALUE
+rbm2_replication_stats_get_elapsed_time(VALUE self)
+{
+  return DBL2NUM(rbm2_stats_elapsed_time(rbm2_stats_get(self)));
+}
+
+static VALUE
+rbm2_replication_stats_get_events_per_second(VALUE self)
+{
+  rbm2_stats *stats = rbm2_stats_get(self);
+  double elapsed_time = rbm2_stats_elapsed_time(stats);
+  if (elapsed_time <= 0) {
+    return DBL2NUM(0.0);
+  }
+  return DBL2NUM(stats->n_events / elapsed_time);
+}
+
+static VALUE
+rbm2_replication_stats_get_bytes_per_second(VALUE self)
+{
+  rbm2_stats *stats = rbm2_stats_get(self);
+  double elapsed_time = rbm2_stats_elapsed_time(stats);
+  if (elapsed_time <= 0) {
+    return DBL2NUM(0.0);
+  }
+  return DBL2NUM(stats->n_bytes / elapsed_time);
+}
+
+/* Seconds spent for decoding events. */
+static VALUE
+rbm2_replication_stats_get_time_with_gvl(VALUE self)
+{
+  return DBL2NUM(rbm2_stats_get(self)->time_with_gvl_ns / 1e9);
+}
+
+/* Seconds spent for waiting and reading events from the server. */
+static VALUE
+rbm2_replication_stats_get_time_without_gvl(VALUE self)
+{
+  return DBL2NUM(rbm2_stats_get(self)->time_without_gvl_ns / 1e9);
+}
+
+static VALUE
+rbm2_replication_stats_reset(VALUE self)
+{
+  rbm2_stats_reset(rbm2_stats_get(self));
+  return self;
+}
+
+static VALUE
+rbm2_replication_stats_to_h(VALUE self)
+{
+  VALUE rb_hash = rb_hash_new();
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("n_events")),
+               rbm2_replication_stats_get_n_events(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("n_bytes")),
+               rbm2_replication_stats_get_n_bytes(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("n_decoded_rows")),
+               rbm2_replication_stats_get_n_decoded_rows(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("lag")),
+               rbm2_replication_stats_get_lag(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("elapsed_time")),
+               rbm2_replication_stats_get_elapsed_time(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("events_per_second")),
+               rbm2_replication_stats_get_events_per_second(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("bytes_per_second")),
+               rbm2_replication_stats_get_bytes_per_second(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("time_with_gvl")),
+               rbm2_replication_stats_get_time_with_gvl(self));
+  rb_hash_aset(rb_hash,
+               rb_id2sym(rb_intern("time_without_gvl")),
+               rbm2_replication_stats_get_time_without_gvl(self));
+  return rb_hash;
+}
+
+static VALUE
+rbm2_replication_stats_inspect(VALUE self)
+{
+  return rb_sprintf("#<%" PRIsVALUE " %+" PRIsVALUE ">",
+                    rb_obj_class(self),
+                    rbm2_replication_stats_to_h(self));
+}
+
+static VALUE
+rbm2_replication_client_get_heartbeat_period(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  if (wrapper->heartbeat_period < 0) {
+    return RUBY_Qnil;
+  }
+  return DBL2NUM(wrapper->heartbeat_period);
+}
+
+/*
+ * The interval in seconds of HEARTBEAT_LOG_EVENT sent while no events
+ * are available. It's used on the next open. Flags::IGNORE_HEARTBEAT
+ * must not be set to receive them.
+ */
+static VALUE
+rbm2_replication_client_set_heartbeat_period(VALUE self, VALUE period)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  if (RB_NIL_P(period)) {
+    wrapper->heartbeat_period = -1.0;
+  } else {
+    wrapper->heartbeat_period = NUM2DBL(period);
+  }
+  return period;
+}
+
+static VALUE
+rbm2_replication_client_get_stats(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  return wrapper->decoder.options.rb_stats;
+}
+
+static VALUE
+rbm2_replication_client_get_gtid(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  return wrapper->rb_gtid;
+}
+
+/*
+ * Starts from the given GTID instead of file_name and start_position
+ * when it isn't nil. It's a GTID position such as "0-1-100" for
+ * MariaDB and a GTID set of executed transactions such as
+ * "3E11FA47-71CA-11E1-9E33-C80AA9429562:1-5" for MySQL.
+ */
+static VALUE
+rbm2_replication_client_set_gtid(VALUE self, VALUE gtid)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  if (RB_NIL_P(gtid)) {
+    wrapper->rb_gtid = RUBY_Qnil;
+  } else {
+    wrapper->rb_gtid = rb_str_new_frozen(StringValue(gtid));
+  }
+  return gtid;
+}
+
+static VALUE
+rbm2_replication_client_auto_reconnect_p(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  return wrapper->auto_reconnect ? RUBY_Qtrue : RUBY_Qfalse;
+}
+
+/*
+ * Reconnects and continues from current_file_name and
+ * current_position when the connection is lost. Events in the
+ * transaction that was being read when the connection is lost are
+ * read again.
+ */
+static VALUE
+rbm2_replication_client_set_auto_reconnect(VALUE self, VALUE auto_reconnect)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  wrapper->auto_reconnect = RB_TEST(auto_reconnect);
+  return auto_reconnect;
+}
+
+static VALUE
+rbm2_replication_client_get_max_reconnect_attempts(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  if (wrapper->max_reconnect_attempts < 0) {
+    return RUBY_Qnil;
+  }
+  return INT2NUM(wrapper->max_reconnect_attempts);
+}
+
+/* nil means unlimited. */
+static VALUE
+rbm2_replication_client_set_max_reconnect_attempts(VALUE self,
+                                                   VALUE max_attempts)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  if (RB_NIL_P(max_attempts)) {
+    wrapper->max_reconnect_attempts = -1;
+  } else {
+    wrapper->max_reconnect_attempts = NUM2INT(max_attempts);
+  }
+  return max_attempts;
+}
+
+static VALUE
+rbm2_replication_client_get_reconnect_interval(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  return DBL2NUM(wrapper->reconnect_interval);
+}
+
+static VALUE
+rbm2_replication_client_set_reconnect_interval(VALUE self, VALUE interval)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  wrapper->reconnect_interval = NUM2DBL(interval);
+  return interval;
+}
+
+/*
+ * The file name and the position to resume from: just after the last
+ * fully processed transaction. nil until they're known.
+ */
+static VALUE
+rbm2_replication_client_get_current_file_name(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  return wrapper->rb_current_file_name;
+}
+
+static VALUE
+rbm2_replication_client_get_current_position(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  if (RB_NIL_P(wrapper->rb_current_file_name)) {
+    return RUBY_Qnil;
+  }
+  return ULL2NUM(wrapper->current_position);
+}
+
+static VALUE
+rbm2_replication_client_get_server_id(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  unsigned int server_id;
+  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
+                                        MARIADB_RPL_SERVER_ID,
+                                        &server_id);
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return UINT2NUM(server_id);
+}
+
+static VALUE
+rbm2_replication_client_set_server_id(VALUE self, VALUE server_id)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  int result = mariadb_rpl_optionsv(wrapper->rpl,
+                                    MARIADB_RPL_SERVER_ID,
+                                    NUM2UINT(server_id));
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return server_id;
+}
+
+static VALUE
+rbm2_replication_client_get_flags(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  unsigned int flags;
+  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
+                                        MARIADB_RPL_FLAGS,
+                                        &flags);
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return UINT2NUM(flags);
+}
+
+static VALUE
+rbm2_replication_client_set_flags(VALUE self, VALUE flags)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  int result = mariadb_rpl_optionsv(wrapper->rpl,
+                                    MARIADB_RPL_FLAGS,
+                                    NUM2UINT(flags));
+  if (result != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  return flags;
+}
+
+static void *
+rbm2_replication_client_close_without_gvl(void *data)
+{
+  rbm2_replication_client_wrapper *wrapper = data;
+  if (wrapper->rpl_event) {
+    mariadb_free_rpl_event(wrapper->rpl_event);
+    wrapper->rpl_event = NULL;
+  }
+  if (wrapper->rpl) {
+    mariadb_rpl_close(wrapper->rpl);
+    wrapper->rpl = NULL;
+  }
+  return NULL;
+}
+
+static VALUE
+rbm2_replication_client_close(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  rb_thread_call_without_gvl(rbm2_replication_client_close_without_gvl,
+                             wrapper,
+                             RUBY_UBF_IO,
+                             0);
+  return Qnil;
+}
+
+static void *
+rbm2_replication_client_open_without_gvl(void *data)
+{
+  rbm2_replication_client_wrapper *wrapper = data;
+  int result = mariadb_rpl_open(wrapper->rpl);
+  return (void *)(intptr_t)result;
+}
+
+static uint64_t
+rbm2_gtid_set_parse_number(VALUE rb_gtid_set, const char **current)
+{
+  char *end;
+  if (!ISDIGIT(**current)) {
+    rb_raise(rb_eArgError, "invalid GTID set: %+" PRIsVALUE, rb_gtid_set);
+  }
+  uint64_t number = strtoull(*current, &end, 10);
+  *current = end;
+  return number;
+}
+
+/*
+ * Encodes a MySQL GTID set such as
+ * "3E11FA47-71CA-11E1-9E33-C80AA9429562:1-5:7,..." for
+ * COM_BINLOG_DUMP_GTID. The format is the same as
+ * PREVIOUS_GTIDS_LOG_EVENT. See also rbm2_previous_gtids_event_parse().
+ */
+static VALUE
+rbm2_gtid_set_encode(VALUE rb_gtid_set)
+{
+  VALUE rb_data = rb_str_buf_new(8);
+  uint8_t buffer[16] = {0};
+  uint64_t n_sids = 0;
+  rb_str_buf_cat(rb_data, (const char *)buffer, 8);
+  const char *current = RSTRING_PTR(rb_gtid_set);
+  const char *end = current + RSTRING_LEN(rb_gtid_set);
+  while (current < end) {
+    if (ISSPACE(*current) || *current == ',') {
+      current++;
+      continue;
+    }
+    int n_digits = 0;
+    while (current < end && n_digits < 32) {
+      if (*current == '-') {
+        current++;
+        continue;
+      }
+      if (!ISXDIGIT(*current)) {
+        break;
+      }
+      uint8_t value;
+      if (ISDIGIT(*current)) {
+        value = *current - '0';
+      } else {
+        value = TOLOWER(*current) - 'a' + 10;
+      }
+      if ((n_digits % 2) == 0) {
+        buffer[n_digits / 2] = value << 4;
+      } else {
+        buffer[n_digits / 2] |= value;
+      }
+      n_digits++;
+      current++;
+    }
+    if (n_digits != 32) {
+      rb_raise(rb_eArgError, "invalid GTID set: %+" PRIsVALUE, rb_gtid_set);
+    }
+    rb_str_buf_cat(rb_data, (const char *)buffer, 16);
+    long n_intervals_offset = RSTRING_LEN(rb_data);
+    uint64_t n_intervals = 0;
+    rb_str_buf_cat(rb_data, (const char *)buffer, 8);
+    while (current < end && *current == ':') {
+      current++;
+      uint64_t start = rbm2_gtid_set_parse_number(rb_gtid_set, &current);
+      uint64_t last = start;
+      if (current < end && *current == '-') {
+        current++;
+        last = rbm2_gtid_set_parse_number(rb_gtid_set, &current);
+      }
+      /* The end of an interval is exclusive. */
+      rbm2_write_uint64(buffer, start);
+      rbm2_write_uint64(buffer + 8, last + 1);
+      rb_str_buf_cat(rb_data, (const char *)buffer, 16);
+      n_intervals++;
+    }
+    rbm2_write_uint64((uint8_t *)RSTRING_PTR(rb_data) + n_intervals_offset,
+                      n_intervals);
+    n_sids++;
+  }
+  rbm2_write_uint64((uint8_t *)RSTRING_PTR(rb_data), n_sids);
+  return rb_data;
+}
+
+/* BINLOG_THROUGH_GTID */
+#define RBM2_BINLOG_DUMP_THROUGH_GTID 0x04
+#define RBM2_COM_BINLOG_DUMP_GTID 0x1e
+
+typedef struct
+{
+  MARIADB_RPL *rpl;
+  const char *command;
+  size_t command_size;
+} rbm2_replication_client_binlog_dump_gtid_data;
+
+static void *
+rbm2_replication_client_binlog_dump_gtid_without_gvl(void *user_data)
+{
+  rbm2_replication_client_binlog_dump_gtid_data *data = user_data;
+  MYSQL *client = data->rpl->mysql;
+  int result =
+    client->methods->db_command(
+      client,
+      (enum enum_server_command)RBM2_COM_BINLOG_DUMP_GTID,
+      data->command,
+      data->command_size,
+      1,
+      NULL);
+  return (void *)(intptr_t)result;
+}
+
+/*
+ * libmariadb doesn't support COM_BINLOG_DUMP_GTID. This sends it
+ * instead of mariadb_rpl_open(). mariadb_rpl_fetch() can read events
+ * after this.
+ *
+ * https://dev.mysql.com/doc/dev/mysql-server/latest/page_protocol_com_binlog_dump_gtid.html
+ *
+ * flags(2) + server_id(4) + binlog_name_info_size(4) + binlog_name +
+ * binlog_position(8) + data_size(4) + data
+ */
+static int
+rbm2_replication_client_binlog_dump_gtid(
+  rbm2_replication_client_wrapper *wrapper)
+{
+  VALUE rb_data = rbm2_gtid_set_encode(wrapper->rb_gtid);
+  VALUE rb_command = rb_str_buf_new(2 + 4 + 4 + 8 + 4 + RSTRING_LEN(rb_data));
+  uint8_t buffer[8];
+  rbm2_write_uint16(buffer,
+                    (wrapper->rpl->flags & 0xffff) |
+                    RBM2_BINLOG_DUMP_THROUGH_GTID);
+  rb_str_buf_cat(rb_command, (const char *)buffer, 2);
+  rbm2_write_uint32(buffer, wrapper->rpl->server_id);
+  rb_str_buf_cat(rb_command, (const char *)buffer, 4);
+  /* No binlog_name */
+  rbm2_write_uint32(buffer, 0);
+  rb_str_buf_cat(rb_command, (const char *)buffer, 4);
+  /* The first event */
+  rbm2_write_uint64(buffer, 4);
+  rb_str_buf_cat(rb_command, (const char *)buffer, 8);
+  rbm2_write_uint32(buffer, (uint32_t)RSTRING_LEN(rb_data));
+  rb_str_buf_cat(rb_command, (const char *)buffer, 4);
+  rb_str_buf_append(rb_command, rb_data);
+
+  rbm2_replication_client_binlog_dump_gtid_data data;
+  data.rpl = wrapper->rpl;
+  data.command = RSTRING_PTR(rb_command);
+  data.command_size = RSTRING_LEN(rb_command);
+  int result =
+    (intptr_t)rb_thread_call_without_gvl(
+      rbm2_replication_client_binlog_dump_gtid_without_gvl,
+      &data,
+      RUBY_UBF_IO,
+      0);
+  RB_GC_GUARD(rb_command);
+  return result;
+}
+
+/*
+ * MariaDB starts from @slave_connect_state instead of the file name
+ * and the position of COM_BINLOG_DUMP.
+ *
+ * https://mariadb.com/kb/en/com_binlog_dump/
+ */
+static void
+rbm2_replication_client_set_slave_connect_state(
+  rbm2_replication_client_wrapper *wrapper)
+{
+  ID id_query;
+  ID id_escape;
+  CONST_ID(id_query, "query");
+  CONST_ID(id_escape, "escape");
+  VALUE rb_client = wrapper->rb_client;
+  /* MARIA_SLAVE_CAPABILITY_GTID */
+  rb_funcall(rb_client,
+             id_query,
+             1,
+             rb_str_new_cstr("SET @mariadb_slave_capability = 4"));
+  VALUE rb_gtid = rb_funcall(rb_client, id_escape, 1, wrapper->rb_gtid);
+  rb_funcall(rb_client,
+             id_query,
+             1,
+             rb_sprintf("SET @slave_connect_state = '%" PRIsVALUE "'",
+                        rb_gtid));
+}
+
+/*
+ * Starts replication from the GTID when use_gtid is true and the GTID
+ * is set. Starts from the file name and the position otherwise.
+ */
+static int
+rbm2_replication_client_wrapper_open(rbm2_replication_client_wrapper *wrapper,
+                                     bool use_gtid)
+{
+  MYSQL *client = rbm2_replication_client_wrapper_get_client(wrapper);
+  bool is_mariadb = (strstr(mysql_get_server_info(client), "MariaDB") != NULL);
+  if (wrapper->heartbeat_period >= 0) {
+    /* In nanoseconds */
+    ID id_query;
+    CONST_ID(id_query, "query");
+    rb_funcall(wrapper->rb_client,
+               id_query,
+               1,
+               rb_sprintf("SET @master_heartbeat_period = %" PRIu64,
+                          (uint64_t)(wrapper->heartbeat_period * 1e9)));
+  }
+  use_gtid = use_gtid && !RB_NIL_P(wrapper->rb_gtid);
+  wrapper->binlog_dump_gtid = (use_gtid && !is_mariadb);
+  if (wrapper->binlog_dump_gtid) {
+    return rbm2_replication_client_binlog_dump_gtid(wrapper);
+  }
+  if (use_gtid) {
+    rbm2_replication_client_set_slave_connect_state(wrapper);
+  }
+  return (intptr_t)rb_thread_call_without_gvl(
+    rbm2_replication_client_open_without_gvl,
+    wrapper,
+    RUBY_UBF_IO,
+    0);
+}
+
+static VALUE
+rbm2_replication_client_open(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  wrapper->rb_current_file_name = RUBY_Qnil;
+  wrapper->current_position = 0;
+  if (RB_NIL_P(wrapper->rb_gtid) && wrapper->rpl->filename_length > 0) {
+    wrapper->rb_current_file_name =
+      rb_str_new(wrapper->rpl->filename, wrapper->rpl->filename_length);
+    wrapper->current_position = wrapper->rpl->start_position;
+  }
+  wrapper->rb_next_file_name = wrapper->rb_current_file_name;
+  wrapper->next_position = wrapper->current_position;
+  rbm2_stats_reset(rbm2_stats_get(wrapper->decoder.options.rb_stats));
+  if (rbm2_replication_client_wrapper_open(wrapper, true) != 0) {
+    rbm2_replication_client_raise(self);
+  }
+  if (rb_block_given_p()) {
+    return rb_ensure(rb_yield, self,
+                     rbm2_replication_client_close, self);
+  } else {
+    return Qnil;
+  }
+}
+
+static void *
+rbm2_replication_client_fetch_without_gvl(void *data)
+{
+  rbm2_replication_client_wrapper *wrapper = data;
+  wrapper->rpl_event = mariadb_rpl_fetch(wrapper->rpl, wrapper->rpl_event);
+  return wrapper->rpl_event;
+}
+
+static VALUE
+rbm2_row_parse(const uint8_t **row_data,
+               const uint8_t *row_data_end,
+               uint32_t n_columns,
+               const uint8_t *column_bitmap,
+               const rbm2_table *table,
+               const rbm2_decode_options *options)
+{
+  VALUE rb_row;
+  if (options->row_format == RBM2_ROW_FORMAT_ARRAY) {
+    rb_row = rb_ary_new_capa(n_columns);
+  } else {
+    rb_row = rb_hash_new();
+  }
+  uint32_t i;
+  uint32_t n_present_columns = 0;
+  for (i = 0; i < n_columns; i++) {
+    if (rbm2_bitmap_is_set(column_bitmap, i)) {
+      n_present_columns++;
+    }
+  }
+  /* The NULL bitmap only has bits for columns in column_bitmap. */
+  rbm2_row_data_ensure(*row_data, row_data_end, (n_present_columns + 7) / 8);
+  const uint8_t *row_null_bitmap = *row_data;
+  (*row_data) += (n_present_columns + 7) / 8;
+  uint32_t present_column_index = 0;
+  for (i = 0; i < n_columns; i++) {
+    if (!rbm2_bitmap_is_set(column_bitmap, i)) {
+      if (options->row_format == RBM2_ROW_FORMAT_ARRAY) {
+        rb_ary_push(rb_row, RUBY_Qnil);
+      }
+      continue;
+    }
+    VALUE rb_column_value = RUBY_Qnil;
+    if (!rbm2_bitmap_is_set(row_null_bitmap, present_column_index)) {
+      rb_column_value = rbm2_column_parse(&(table->columns[i]),
+                                         options,
+                                         row_data,
+                                         row_data_end);
+    }
+    present_column_index++;
+    switch (options->row_format) {
+    case RBM2_ROW_FORMAT_ARRAY:
+      rb_ary_push(rb_row, rb_column_value);
+      break;
+    case RBM2_ROW_FORMAT_NAME:
+      /* Columns without name use their index. */
+      rb_hash_aset(rb_row,
+                   RARRAY_AREF(table->rb_column_names, i),
+                   rb_column_value);
+      break;
+    default:
+      rb_hash_aset(rb_row, UINT2NUM(i), rb_column_value);
+      break;
+    }
+  }
+  return rb_row;
+}
+
+typedef enum
+{
+  RBM2_EVENT_KIND_GENERIC,
+  RBM2_EVENT_KIND_ROTATE,
+  RBM2_EVENT_KIND_FORMAT_DESCRIPTION,
+  RBM2_EVENT_KIND_TABLE_MAP,
+  RBM2_EVENT_KIND_ROWS,
+  RBM2_EVENT_KIND_GTID,
+  RBM2_EVENT_KIND_GTID_LIST,
+  RBM2_EVENT_KIND_QUERY,
+  RBM2_EVENT_KIND_XID,
+  RBM2_EVENT_KIND_ROWS_QUERY,
+  RBM2_EVENT_KIND_HEARTBEAT,
+} rbm2_event_kind;
+
+/*
+ * Storage of Mysql2Replication::Event and its subclasses. The
+ * fields in body are used by kind.
+ */
+typedef struct
+{
+  rbm2_event_kind kind;
+  uint32_t type;
+  uint32_t timestamp;
+  uint32_t server_id;
+  uint32_t length;
+  uint32_t next_position;
+  uint16_t flags;
+  union
+  {
+    struct
+    {
+      uint64_t position;
+      VALUE rb_file_name;
+    } rotate;
+    struct
+    {
+      uint16_t format;
+      uint32_t header_length;
+      VALUE rb_server_version;
+    } format_description;
+    struct
+    {
+      uint64_t table_id;
+      VALUE rb_database;
+      VALUE rb_table_name;
+      VALUE rb_columns;
+      /* nil when the table is filtered out */
+      VALUE rb_table;
+    } table_map;
+    struct
+    {
+      uint64_t table_id;
+      uint16_t flags;
+      VALUE rb_table_map;
+      /* Raw rows (rbm2_rows) until they're decoded */
+      VALUE rb_raw_rows;
+      VALUE rb_rows;
+      VALUE rb_updated_rows;
+    } rows;
+    struct
+    {
+      /* nil for ANONYMOUS_GTID_LOG_EVENT */
+      VALUE rb_gtid;
+      bool standalone;
+    } gtid;
+    struct
+    {
+      VALUE rb_gtids;
+    } gtid_list;
+    struct
+    {
+      uint32_t thread_id;
+      uint32_t execution_time;
+      uint16_t error_code;
+      VALUE rb_database;
+      VALUE rb_query;
+    } query;
+    struct
+    {
+      uint64_t xid;
+    } xid;
+    struct
+    {
+      VALUE rb_query;
+    } rows_query;
+    struct
+    {
+      VALUE rb_file_name;
+    } heartbeat;
+  } body;
+} rbm2_event;
+
+static void
+rbm2_event_mark(void *data)
+{
+  rbm2_event *event = data;
+  switch (event->kind) {
+  case RBM2_EVENT_KIND_ROTATE:
+    rb_gc_mark(event->body.rotate.rb_file_name);
+    break;
+  case RBM2_EVENT_KIND_FORMAT_DESCRIPTION:
+    rb_gc_mark(event->body.format_description.rb_server_version);
+    break;
+  case RBM2_EVENT_KIND_TABLE_MAP:
+    rb_gc_mark(event->body.table_map.rb_database);
+    rb_gc_mark(event->body.table_map.rb_table_name);
+    rb_gc_mark(event->body.table_map.rb_columns);
+    rb_gc_mark(event->body.table_map.rb_table);
+    break;
+  case RBM2_EVENT_KIND_ROWS:
+    rb_gc_mark(event->body.rows.rb_table_map);
+    rb_gc_mark(event->body.rows.rb_raw_rows);
+    rb_gc_mark(event->body.rows.rb_rows);
+    rb_gc_mark(event->body.rows.rb_updated_rows);
+    break;
+  case RBM2_EVENT_KIND_GTID:
+    rb_gc_mark(event->body.gtid.rb_gtid);
+    break;
+  case RBM2_EVENT_KIND_GTID_LIST:
+    rb_gc_mark(event->body.gtid_list.rb_gtids);
+    break;
+  case RBM2_EVENT_KIND_QUERY:
+    rb_gc_mark(event->body.query.rb_database);
+    rb_gc_mark(event->body.query.rb_query);
+    break;
+  case RBM2_EVENT_KIND_ROWS_QUERY:
+    rb_gc_mark(event->body.rows_query.rb_query);
+    break;
+  case RBM2_EVENT_KIND_HEARTBEAT:
+    rb_gc_mark(event->body.heartbeat.rb_file_name);
+    break;
+  default:
+    break;
+  }
+}
+
+static const rb_data_type_t rbm2_event_type = {
+  "Mysql2Replication::Event",
+  {
+    rbm2_event_mark,
+    RUBY_TYPED_DEFAULT_FREE,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE,
+};
+
+static VALUE
+rbm2_event_new(VALUE klass, rbm2_event_kind kind, rbm2_event **event)
+{
+  VALUE rb_event =
+    TypedData_Make_Struct(klass, rbm2_event, &rbm2_event_type, *event);
+  (*event)->kind = kind;
+  switch (kind) {
+  case RBM2_EVENT_KIND_ROTATE:
+    (*event)->body.rotate.rb_file_name = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_FORMAT_DESCRIPTION:
+    (*event)->body.format_description.rb_server_version = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_TABLE_MAP:
+    (*event)->body.table_map.rb_database = RUBY_Qnil;
+    (*event)->body.table_map.rb_table_name = RUBY_Qnil;
+    (*event)->body.table_map.rb_columns = RUBY_Qnil;
+    (*event)->body.table_map.rb_table = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_ROWS:
+    (*event)->body.rows.rb_table_map = RUBY_Qnil;
+    (*event)->body.rows.rb_raw_rows = RUBY_Qnil;
+    (*event)->body.rows.rb_rows = RUBY_Qnil;
+    (*event)->body.rows.rb_updated_rows = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_GTID:
+    (*event)->body.gtid.rb_gtid = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_GTID_LIST:
+    (*event)->body.gtid_list.rb_gtids = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_QUERY:
+    (*event)->body.query.rb_database = RUBY_Qnil;
+    (*event)->body.query.rb_query = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_ROWS_QUERY:
+    (*event)->body.rows_query.rb_query = RUBY_Qnil;
+    break;
+  case RBM2_EVENT_KIND_HEARTBEAT:
+    (*event)->body.heartbeat.rb_file_name = RUBY_Qnil;
+    break;
+  default:
+    break;
+  }
+  return rb_event;
+}
+
+static inline rbm2_event *
+rbm2_event_get(VALUE rb_event)
+{
+  rbm2_event *event;
+  TypedData_Get_Struct(rb_event, rbm2_event, &rbm2_event_type, event);
+  return event;
+}
+
+/* Returns the table descriptor of a TableMapEvent or nil. */
+static VALUE
+rbm2_table_map_event_get_table(VALUE rb_table_map)
+{
+  if (RB_NIL_P(rb_table_map)) {
+    return RUBY_Qnil;
+  }
+  return rbm2_event_get(rb_table_map)->body.table_map.rb_table;
+}
+
+static void rbm2_file_reader_ensure_opened(VALUE self);
+
+typedef struct
+{
+  /* A frozen copy of the rows data or the owner of the raw event */
+  VALUE rb_data;
+  /* The rows data in the raw event. They're used with the owner. */
+  const uint8_t *data;
+  size_t data_size;
+  VALUE rb_table_map;
+  VALUE rb_table;
+  uint32_t n_columns;
+  bool have_updated_rows;
+  rbm2_decode_options options;
+} rbm2_rows;
+
+static void
+rbm2_rows_mark(void *data)
+{
+  rbm2_rows *rows = data;
+  rb_gc_mark(rows->rb_data);
+  rb_gc_mark(rows->rb_table_map);
+  rb_gc_mark(rows->rb_table);
+  rb_gc_mark(rows->options.rb_stats);
+}
+
+static const rb_data_type_t rbm2_rows_type = {
+  "Mysql2Replication::Rows",
+  {
+    rbm2_rows_mark,
+    RUBY_TYPED_DEFAULT_FREE,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+/*
+ * Keeps the raw rows data of a rows event. The rows data are the
+ * column bitmap, the column update bitmap (only for
+ * UPDATE_ROWS_EVENT) and the row data. They are decoded only when
+ * they are needed.
+ *
+ * The rows data are copied when rb_raw_event_owner is nil. Otherwise
+ * the raw event is kept alive by rb_raw_event_owner and the rows data
+ * are referred without copying.
+ */
+static VALUE
+rbm2_rows_new(struct st_mariadb_rpl_rows_event *rows_event,
+              bool have_updated_rows,
+              VALUE rb_table_map,
+              const rbm2_decode_options *options,
+              VALUE rb_raw_event_owner)
+{
+  rbm2_rows *rows;
+  VALUE rb_rows = TypedData_Make_Struct(0, rbm2_rows, &rbm2_rows_type, rows);
+  rows->rb_data = RUBY_Qnil;
+  rows->data = NULL;
+  rows->data_size = 0;
+  rows->rb_table_map = rb_table_map;
+  rows->rb_table = rbm2_table_map_event_get_table(rb_table_map);
+  rows->n_columns = rows_event->column_count;
+  rows->have_updated_rows = have_updated_rows;
+  rows->options = *options;
+
+  if (!RB_NIL_P(rb_raw_event_owner) && !options->share_strings) {
+    /* They are adjacent in a raw event parsed by rbm2_event_parse(). */
+    const uint8_t *row_data_end =
+      (const uint8_t *)(rows_event->row_data) + rows_event->row_data_size;
+    rows->rb_data = rb_raw_event_owner;
+    rows->data = (const uint8_t *)(rows_event->column_bitmap);
+    rows->data_size = row_data_end - rows->data;
+    return rb_rows;
+  }
+
+  size_t bitmap_size = (rows->n_columns + 7) / 8;
+  size_t data_size = bitmap_size;
+  if (have_updated_rows) {
+    data_size += bitmap_size;
+  }
+  data_size += rows_event->row_data_size;
+  VALUE rb_data = rb_str_buf_new(data_size);
+  rb_str_buf_cat(rb_data,
+                 (const char *)(rows_event->column_bitmap),
+                 bitmap_size);
+  if (have_updated_rows) {
+    rb_str_buf_cat(rb_data,
+                   (const char *)(rows_event->column_update_bitmap),
+                   bitmap_size);
+  }
+  rb_str_buf_cat(rb_data,
+                 (const char *)(rows_event->row_data),
+                 rows_event->row_data_size);
+  rows->rb_data = rb_obj_freeze(rb_data);
+  return rb_rows;
+}
+
+static inline rbm2_rows *
+rbm2_rows_get(VALUE rb_rows)
+{
+  rbm2_rows *rows;
+  TypedData_Get_Struct(rb_rows, rbm2_rows, &rbm2_rows_type, rows);
+  return rows;
+}
+
+typedef struct
+{
+  const rbm2_rows *rows;
+  const rbm2_table *table;
+  const uint8_t *column_bitmap;
+  const uint8_t *column_update_bitmap;
+  const uint8_t *row_data;
+  const uint8_t *row_data_end;
+  VALUE rb_row;
+  VALUE rb_updated_row;
+  VALUE rb_rows;
+  VALUE rb_updated_rows;
+  rbm2_decode_options options;
+} rbm2_rows_parse_data;
+
+static void
+rbm2_rows_parse_data_init(rbm2_rows_parse_data *data, const rbm2_rows *rows)
+{
+  size_t bitmap_size = (rows->n_columns + 7) / 8;
+  const uint8_t *raw_data;
+  const uint8_t *raw_data_end;
+  if (RB_TYPE_P(rows->rb_data, RUBY_T_STRING)) {
+    raw_data = (const uint8_t *)RSTRING_PTR(rows->rb_data);
+    raw_data_end = raw_data + RSTRING_LEN(rows->rb_data);
+  } else {
+    rbm2_file_reader_ensure_opened(rows->rb_data);
+    raw_data = rows->data;
+    raw_data_end = raw_data + rows->data_size;
+  }
+  size_t n_bitmaps = rows->have_updated_rows ? 2 : 1;
+  if ((size_t)(raw_data_end - raw_data) < bitmap_size * n_bitmaps) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "truncated column bitmap in rows event: %+" PRIsVALUE,
+             rows->rb_table_map);
+  }
+  data->rows = rows;
+  data->table = rbm2_table_get(rows->rb_table);
+  data->column_bitmap = raw_data;
+  data->column_update_bitmap = NULL;
+  data->row_data = raw_data + bitmap_size;
+  if (rows->have_updated_rows) {
+    data->column_update_bitmap = data->row_data;
+    data->row_data += bitmap_size;
+  }
+  data->row_data_end = raw_data_end;
+  /* A row without columns is empty. It never reaches row_data_end. */
+  if (data->row_data < data->row_data_end &&
+      (!rbm2_bitmap_has_set(data->column_bitmap, rows->n_columns) ||
+       (rows->have_updated_rows &&
+        !rbm2_bitmap_has_set(data->column_update_bitmap, rows->n_columns)))) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "no column in rows event: %+" PRIsVALUE,
+             rows->rb_table_map);
+  }
+  data->rb_row = RUBY_Qnil;
+  data->rb_updated_row = RUBY_Qnil;
+  data->rb_rows = RUBY_Qnil;
+  data->rb_updated_rows = RUBY_Qnil;
+  data->options = rows->options;
+  if (rows->options.share_strings) {
+    data->options.rb_shared_data = rows->rb_data;
+  }
+  data->options.profile = rbm2_decode_profile_get();
+}
+
+static void
+rbm2_rows_parse_row(rbm2_rows_parse_data *data)
+{
+  if (data->rows->n_columns > data->table->n_columns) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "too many columns in rows event: %u: expected: %u",
+             data->rows->n_columns,
+             data->table->n_columns);
+  }
+  data->rb_row = rbm2_row_parse(&(data->row_data),
+                                data->row_data_end,
+                                data->rows->n_columns,
+                                data->column_bitmap,
+                                data->table,
+                                &(data->options));
+  if (!RB_NIL_P(data->options.rb_stats)) {
+    rbm2_stats_get(data->options.rb_stats)->n_decoded_rows++;
+  }
+  if (data->rows->have_updated_rows) {
+    data->rb_updated_row = rbm2_row_parse(&(data->row_data),
+                                          data->row_data_end,
+                                          data->rows->n_columns,
+                                          data->column_update_bitmap,
+                                          data->table,
+                                          &(data->options));
+  }
+}
+
+static VALUE
+rbm2_rows_parse_row_body(VALUE user_data)
+{
+  rbm2_rows_parse_data *data = (rbm2_rows_parse_data *)user_data;
+  rbm2_rows_parse_row(data);
+  return RUBY_Qnil;
+}
+
+static VALUE
+rbm2_rows_parse_all_body(VALUE user_data)
+{
+  rbm2_rows_parse_data *data = (rbm2_rows_parse_data *)user_data;
+  while (data->row_data < data->row_data_end) {
+    rbm2_rows_parse_row(data);
+    rb_ary_push(data->rb_rows, data->rb_row);
+    if (data->rows->have_updated_rows) {
+      rb_ary_push(data->rb_updated_rows, data->rb_updated_row);
+    }
+  }
+  return RUBY_Qnil;
+}
+
+static VALUE
+rbm2_rows_parse_rescue(VALUE user_data, VALUE error)
+{
+  rbm2_rows_parse_data *data = (rbm2_rows_parse_data *)user_data;
+  rb_raise(rb_eMysql2ReplicationError,
+           "failed to parse rows: %+" PRIsVALUE ": %+" PRIsVALUE,
+           data->rows->rb_table_map,
+           rb_funcall(error, rb_intern("message"), 0));
+  return RUBY_Qnil;
+}
+
+static void
+rbm2_replication_rows_event_parse_rows(VALUE self)
+{
+  rbm2_event *event = rbm2_event_get(self);
+  if (event->kind != RBM2_EVENT_KIND_ROWS) {
+    return;
+  }
+  VALUE rb_rows = event->body.rows.rb_raw_rows;
+  if (RB_NIL_P(rb_rows)) {
+    return;
+  }
+  rbm2_rows *rows = rbm2_rows_get(rb_rows);
+  rbm2_rows_parse_data data;
+  rbm2_rows_parse_data_init(&data, rows);
+  data.rb_rows = rb_ary_new();
+  if (rows->have_updated_rows) {
+    data.rb_updated_rows = rb_ary_new();
+  }
+  rb_rescue(rbm2_rows_parse_all_body, (VALUE)&data,
+            rbm2_rows_parse_rescue, (VALUE)&data);
+  event->body.rows.rb_rows = data.rb_rows;
+  if (rows->have_updated_rows) {
+    event->body.rows.rb_updated_rows = data.rb_updated_rows;
+  }
+  event->body.rows.rb_raw_rows = RUBY_Qnil;
+  RB_GC_GUARD(rb_rows);
+}
+
+static VALUE
+rbm2_replication_event_get_type(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->type);
+}
+
+static VALUE
+rbm2_replication_event_get_timestamp(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->timestamp);
+}
+
+static VALUE
+rbm2_replication_event_get_server_id(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->server_id);
+}
+
+static VALUE
+rbm2_replication_event_get_length(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->length);
+}
+
+static VALUE
+rbm2_replication_event_get_next_position(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->next_position);
+}
+
+static VALUE
+rbm2_replication_event_get_flags(VALUE self)
+{
+  return USHORT2NUM(rbm2_event_get(self)->flags);
+}
+
+static VALUE
+rbm2_replication_event_inspect(VALUE self)
+{
+  rbm2_event *event = rbm2_event_get(self);
+  VALUE rb_inspect = rb_sprintf("#<%" PRIsVALUE
+                                " type=%u"
+                                " timestamp=%u"
+                                " server_id=%u"
+                                " length=%u"
+                                " next_position=%u"
+                                " flags=%u",
+                                rb_obj_class(self),
+                                event->type,
+                                event->timestamp,
+                                event->server_id,
+                                event->length,
+                                event->next_position,
+                                event->flags);
+  switch (event->kind) {
+  case RBM2_EVENT_KIND_ROTATE:
+    rb_str_catf(rb_inspect,
+                " position=%" PRIu64 " file_name=%+" PRIsVALUE,
+                event->body.rotate.position,
+                event->body.rotate.rb_file_name);
+    break;
+  case RBM2_EVENT_KIND_FORMAT_DESCRIPTION:
+    rb_str_catf(rb_inspect,
+                " format=%u server_version=%+" PRIsVALUE
+                " header_length=%u",
+                event->body.format_description.format,
+                event->body.format_description.rb_server_version,
+                event->body.format_description.header_length);
+    break;
+  case RBM2_EVENT_KIND_TABLE_MAP:
+    rb_str_catf(rb_inspect,
+                " table_id=%" PRIu64
+                " database=%+" PRIsVALUE
+                " table=%+" PRIsVALUE
+                " columns=%+" PRIsVALUE,
+                event->body.table_map.table_id,
+                event->body.table_map.rb_database,
+                event->body.table_map.rb_table_name,
+                event->body.table_map.rb_columns);
+    break;
+  case RBM2_EVENT_KIND_ROWS:
+    /* Rows aren't decoded only for inspect. */
+    rb_str_catf(rb_inspect,
+                " table_id=%" PRIu64 " rows_flags=%u",
+                event->body.rows.table_id,
+                event->body.rows.flags);
+    break;
+  case RBM2_EVENT_KIND_GTID:
+    rb_str_catf(rb_inspect,
+                " gtid=%+" PRIsVALUE " standalone=%s",
+                event->body.gtid.rb_gtid,
+                event->body.gtid.standalone ? "true" : "false");
+    break;
+  case RBM2_EVENT_KIND_GTID_LIST:
+    rb_str_catf(rb_inspect,
+                " gtids=%+" PRIsVALUE,
+                event->body.gtid_list.rb_gtids);
+    break;
+  case RBM2_EVENT_KIND_QUERY:
+    rb_str_catf(rb_inspect,
+                " thread_id=%u execution_time=%u error_code=%u"
+                " database=%+" PRIsVALUE
+                " query=%+" PRIsVALUE,
+                event->body.query.thread_id,
+                event->body.query.execution_time,
+                event->body.query.error_code,
+                event->body.query.rb_database,
+                event->body.query.rb_query);
+    break;
+  case RBM2_EVENT_KIND_XID:
+    rb_str_catf(rb_inspect, " xid=%" PRIu64, event->body.xid.xid);
+    break;
+  case RBM2_EVENT_KIND_ROWS_QUERY:
+    rb_str_catf(rb_inspect,
+                " query=%+" PRIsVALUE,
+                event->body.rows_query.rb_query);
+    break;
+  case RBM2_EVENT_KIND_HEARTBEAT:
+    rb_str_catf(rb_inspect,
+                " file_name=%+" PRIsVALUE,
+                event->body.heartbeat.rb_file_name);
+    break;
+  default:
+    break;
+  }
+  rb_str_cat_cstr(rb_inspect, ">");
+  return rb_inspect;
+}
+
+static VALUE
+rbm2_replication_rotate_event_get_position(VALUE self)
+{
+  return ULL2NUM(rbm2_event_get(self)->body.rotate.position);
+}
+
+static VALUE
+rbm2_replication_rotate_event_get_file_name(VALUE self)
+{
+  return rbm2_event_get(self)->body.rotate.rb_file_name;
+}
+
+static VALUE
+rbm2_replication_format_description_event_get_format(VALUE self)
+{
+  return USHORT2NUM(rbm2_event_get(self)->body.format_description.format);
+}
+
+static VALUE
+rbm2_replication_format_description_event_get_server_version(VALUE self)
+{
+  return rbm2_event_get(self)->body.format_description.rb_server_version;
+}
+
+static VALUE
+rbm2_replication_format_description_event_get_header_length(VALUE self)
+{
+  rbm2_event *event = rbm2_event_get(self);
+  return UINT2NUM(event->body.format_description.header_length);
+}
+
+static VALUE
+rbm2_replication_table_map_event_get_table_id(VALUE self)
+{
+  return ULL2NUM(rbm2_event_get(self)->body.table_map.table_id);
+}
+
+static VALUE
+rbm2_replication_table_map_event_get_database(VALUE self)
+{
+  return rbm2_event_get(self)->body.table_map.rb_database;
+}
+
+static VALUE
+rbm2_replication_table_map_event_get_table(VALUE self)
+{
+  return rbm2_event_get(self)->body.table_map.rb_table_name;
+}
+
+static VALUE
+rbm2_replication_table_map_event_get_columns(VALUE self)
+{
+  return rbm2_event_get(self)->body.table_map.rb_columns;
+}
+
+static VALUE
+rbm2_replication_table_map_event_get_primary_key(VALUE self)
+{
+  VALUE rb_table = rbm2_event_get(self)->body.table_map.rb_table;
+  if (RB_NIL_P(rb_table)) {
+    return RUBY_Qnil;
+  }
+  return rbm2_table_get(rb_table)->rb_primary_key;
+}
+
+static VALUE
+rbm2_replication_table_map_event_filtered_p(VALUE self)
+{
+  return RB_NIL_P(rbm2_event_get(self)->body.table_map.rb_table) ?
+    RUBY_Qtrue : RUBY_Qfalse;
+}
+
+static VALUE
+rbm2_replication_gtid_event_get_gtid(VALUE self)
+{
+  return rbm2_event_get(self)->body.gtid.rb_gtid;
+}
+
+static VALUE
+rbm2_replication_gtid_event_standalone_p(VALUE self)
+{
+  rbm2_event *event = rbm2_event_get(self);
+  return event->body.gtid.standalone ? RUBY_Qtrue : RUBY_Qfalse;
+}
+
+static VALUE
+rbm2_replication_gtid_list_event_get_gtids(VALUE self)
+{
+  return rbm2_event_get(self)->body.gtid_list.rb_gtids;
+}
+
+static VALUE
+rbm2_replication_query_event_get_thread_id(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->body.query.thread_id);
+}
+
+static VALUE
+rbm2_replication_query_event_get_execution_time(VALUE self)
+{
+  return UINT2NUM(rbm2_event_get(self)->body.query.execution_time);
+}
+
+static VALUE
+rbm2_replication_query_event_get_error_code(VALUE self)
+{
+  return USHORT2NUM(rbm2_event_get(self)->body.query.error_code);
+}
+
+static VALUE
+rbm2_replication_query_event_get_database(VALUE self)
+{
+  return rbm2_event_get(self)->body.query.rb_database;
+}
+
+static VALUE
+rbm2_replication_query_event_get_query(VALUE self)
+{
+  return rbm2_event_get(self)->body.query.rb_query;
+}
+
+static VALUE
+rbm2_replication_xid_event_get_xid(VALUE self)
+{
+  return ULL2NUM(rbm2_event_get(self)->body.xid.xid);
+}
+
+static VALUE
+rbm2_replication_rows_query_event_get_query(VALUE self)
+{
+  return rbm2_event_get(self)->body.rows_query.rb_query;
+}
+
+/* The current position is next_position. */
+static VALUE
+rbm2_replication_heartbeat_event_get_file_name(VALUE self)
+{
+  return rbm2_event_get(self)->body.heartbeat.rb_file_name;
+}
+
+static VALUE
+rbm2_replication_rows_event_get_table_id(VALUE self)
+{
+  return ULL2NUM(rbm2_event_get(self)->body.rows.table_id);
+}
+
+static VALUE
+rbm2_replication_rows_event_get_table_map(VALUE self)
+{
+  return rbm2_event_get(self)->body.rows.rb_table_map;
+}
+
+static VALUE
+rbm2_replication_rows_event_get_rows_flags(VALUE self)
+{
+  return USHORT2NUM(rbm2_event_get(self)->body.rows.flags);
+}
+
+static VALUE
+rbm2_replication_rows_event_statement_end_p(VALUE self)
+{
+  return (rbm2_event_get(self)->body.rows.flags & FL_STMT_END) ?
+    RUBY_Qtrue : RUBY_Qfalse;
+}
+
+static VALUE
+rbm2_replication_rows_event_get_rows(VALUE self)
+{
+  rbm2_replication_rows_event_parse_rows(self);
+  return rbm2_event_get(self)->body.rows.rb_rows;
+}
+
+static VALUE
+rbm2_replication_update_rows_event_get_updated_rows(VALUE self)
+{
+  rbm2_replication_rows_event_parse_rows(self);
+  return rbm2_event_get(self)->body.rows.rb_updated_rows;
+}
+
+static VALUE
+rbm2_replication_rows_event_each_row(VALUE self)
+{
+  RETURN_ENUMERATOR(self, 0, NULL);
+
+  rbm2_event *event = rbm2_event_get(self);
+  VALUE rb_rows = event->body.rows.rb_raw_rows;
+  if (RB_NIL_P(rb_rows)) {
+    VALUE rb_parsed_rows = event->body.rows.rb_rows;
+    VALUE rb_parsed_updated_rows = event->body.rows.rb_updated_rows;
+    long i;
+    for (i = 0; i < RARRAY_LEN(rb_parsed_rows); i++) {
+      if (RB_NIL_P(rb_parsed_updated_rows)) {
+        rb_yield(RARRAY_AREF(rb_parsed_rows, i));
+      } else {
+        rb_yield_values(2,
+                        RARRAY_AREF(rb_parsed_rows, i),
+                        RARRAY_AREF(rb_parsed_updated_rows, i));
+      }
+    }
+    return self;
+  }
+
+  rbm2_rows *rows = rbm2_rows_get(rb_rows);
+  rbm2_rows_parse_data data;
+  rbm2_rows_parse_data_init(&data, rows);
+  while (data.row_data < data.row_data_end) {
+    rb_rescue(rbm2_rows_parse_row_body, (VALUE)&data,
+              rbm2_rows_parse_rescue, (VALUE)&data);
+    if (rows->have_updated_rows) {
+      rb_yield_values(2, data.rb_row, data.rb_updated_row);
+    } else {
+      rb_yield(data.rb_row);
+    }
+  }
+  RB_GC_GUARD(rb_rows);
+  return self;
+}
+
+typedef enum
+{
+  RBM2_PACKED_TYPE_NONE,
+  RBM2_PACKED_TYPE_INT64,
+  RBM2_PACKED_TYPE_DOUBLE,
+} rbm2_packed_type;
+
+static rbm2_packed_type
+rbm2_column_packed_type(const rbm2_column *column)
+{
+  switch (column->type) {
+  case MYSQL_TYPE_TINY:
+  case MYSQL_TYPE_SHORT:
+  case MYSQL_TYPE_INT24:
+  case MYSQL_TYPE_LONG:
+  case MYSQL_TYPE_LONGLONG:
+  case MYSQL_TYPE_YEAR:
+    return RBM2_PACKED_TYPE_INT64;
+  case MYSQL_TYPE_FLOAT:
+  case MYSQL_TYPE_DOUBLE:
+    return RBM2_PACKED_TYPE_DOUBLE;
+  default:
+    return RBM2_PACKED_TYPE_NONE;
+  }
+}
+
+/*
+ * Reads a numeric value as 8 bytes little endian int64 or double.
+ * BIGINT UNSIGNED values are stored as uint64.
+ */
+static void
+rbm2_column_parse_packed(const rbm2_column *column,
+                         const uint8_t **row_data,
+                         const uint8_t *row_data_end,
+                         rbm2_decode_profile *profile,
+                         uint8_t *packed)
+{
+  uint64_t start_time_ns = rbm2_decode_profile_start(profile);
+  const uint8_t *row_data_start = *row_data;
+  uint64_t value = 0;
+  switch (column->type) {
+  case MYSQL_TYPE_TINY:
+    rbm2_row_data_ensure(*row_data, row_data_end, 1);
+    if (column->is_unsigned) {
+      value = rbm2_read_uint8(*row_data);
+    } else {
+      value = (int64_t)rbm2_read_int8(*row_data);
+    }
+    (*row_data) += 1;
+    break;
+  case MYSQL_TYPE_SHORT:
+    rbm2_row_data_ensure(*row_data, row_data_end, 2);
+    if (column->is_unsigned) {
+      value = rbm2_read_uint16(*row_data);
+    } else {
+      value = (int64_t)rbm2_read_int16(*row_data);
+    }
+    (*row_data) += 2;
+    break;
+  case MYSQL_TYPE_INT24:
+    rbm2_row_data_ensure(*row_data, row_data_end, 3);
+    if (column->is_unsigned) {
+      value = rbm2_read_uint24(*row_data);
+    } else {
+      value = (int64_t)rbm2_read_int24(*row_data);
+    }
+    (*row_data) += 3;
+    break;
+  case MYSQL_TYPE_LONG:
+    rbm2_row_data_ensure(*row_data, row_data_end, 4);
+    if (column->is_unsigned) {
+      value = rbm2_read_uint32(*row_data);
+    } else {
+      value = (int64_t)rbm2_read_int32(*row_data);
+    }
+    (*row_data) += 4;
+    break;
+  case MYSQL_TYPE_LONGLONG:
+    rbm2_row_data_ensure(*row_data, row_data_end, 8);
+    value = rbm2_read_uint64(*row_data);
+    (*row_data) += 8;
+    break;
+  case MYSQL_TYPE_YEAR:
+    rbm2_row_data_ensure(*row_data, row_data_end, 1);
+    value = rbm2_read_uint8(*row_data) + 1900;
+    (*row_data) += 1;
+    break;
+  case MYSQL_TYPE_FLOAT:
+    rbm2_row_data_ensure(*row_data, row_data_end, 4);
+    {
+      double double_value = *((const float *)(*row_data));
+      memcpy(&value, &double_value, sizeof(value));
+      (*row_data) += 4;
+    }
+    break;
+  case MYSQL_TYPE_DOUBLE:
+    rbm2_row_data_ensure(*row_data, row_data_end, 8);
+    {
+      double double_value = *((const double *)(*row_data));
+      memcpy(&value, &double_value, sizeof(value));
+      (*row_data) += 8;
+    }
+    break;
+  default:
+    break;
+  }
+  rbm2_write_uint64(packed, value);
+  if (profile) {
+    rbm2_decode_profile_add(&(profile->columns[column->type]),
+                            start_time_ns,
+                            1,
+                            *row_data - row_data_start);
+  }
+}
+
+/*
+ * Values of a rows event in struct-of-arrays layout. rb_values has
+ * one Array (or one packed String) per column and rb_nulls has one
+ * NULL bitmap String per column. The Nth bit (LSB first) is set when
+ * the Nth row has NULL or doesn't have the column.
+ */
+typedef struct
+{
+  VALUE rb_values;
+  VALUE rb_nulls;
+} rbm2_columnar;
+
+static void
+rbm2_columnar_init(rbm2_columnar *columnar,
+                   const rbm2_table *table,
+                   uint32_t n_columns,
+                   bool packed)
+{
+  columnar->rb_values = rb_ary_new_capa(n_columns);
+  columnar->rb_nulls = rb_ary_new_capa(n_columns);
+  uint32_t i;
+  for (i = 0; i < n_columns; i++) {
+    const rbm2_column *column = &(table->columns[i]);
+    if (packed && rbm2_column_packed_type(column) != RBM2_PACKED_TYPE_NONE) {
+      rb_ary_push(columnar->rb_values, rb_str_buf_new(0));
+    } else {
+      rb_ary_push(columnar->rb_values, rb_ary_new());
+    }
+    rb_ary_push(columnar->rb_nulls, rb_str_buf_new(0));
+  }
+}
+
+static void
+rbm2_columnar_parse_row(rbm2_columnar *columnar,
+                        long nth_row,
+                        const uint8_t **row_data,
+                        const uint8_t *row_data_end,
+                        uint32_t n_columns,
+                        const uint8_t *column_bitmap,
+                        const rbm2_table *table,
+                        const rbm2_decode_options *options)
+{
+  uint32_t i;
+  uint32_t n_present_columns = 0;
+  for (i = 0; i < n_columns; i++) {
+    if (rbm2_bitmap_is_set(column_bitmap, i)) {
+      n_present_columns++;
+    }
+  }
+  /* See also rbm2_row_parse(). */
+  rbm2_row_data_ensure(*row_data, row_data_end, (n_present_columns + 7) / 8);
+  const uint8_t *row_null_bitmap = *row_data;
+  (*row_data) += (n_present_columns + 7) / 8;
+  uint32_t present_column_index = 0;
+  for (i = 0; i < n_columns; i++) {
+    VALUE rb_nulls = RARRAY_AREF(columnar->rb_nulls, i);
+    if ((nth_row % 8) == 0) {
+      rb_str_buf_cat(rb_nulls, "\0", 1);
+    }
+    bool is_null = true;
+    if (rbm2_bitmap_is_set(column_bitmap, i)) {
+      is_null = rbm2_bitmap_is_set(row_null_bitmap, present_column_index);
+      present_column_index++;
+    }
+    if (is_null) {
+      RSTRING_PTR(rb_nulls)[nth_row / 8] |= (1 << (nth_row % 8));
+    }
+    VALUE rb_column_values = RARRAY_AREF(columnar->rb_values, i);
+    if (RB_TYPE_P(rb_column_values, RUBY_T_STRING)) {
+      uint8_t packed[8] = {0};
+      if (!is_null) {
+        rbm2_column_parse_packed(&(table->columns[i]),
+                                 row_data,
+                                 row_data_end,
+                                 options->profile,
+                                 packed);
+      }
+      rb_str_buf_cat(rb_column_values, (const char *)packed, sizeof(packed));
+    } else {
+      VALUE rb_value = RUBY_Qnil;
+      if (!is_null) {
+        rb_value = rbm2_column_parse(&(table->columns[i]),
+                                     options,
+                                     row_data,
+                                     row_data_end);
+      }
+      rb_ary_push(rb_column_values, rb_value);
+    }
+  }
+}
+
+typedef struct
+{
+  rbm2_rows_parse_data *data;
+  rbm2_columnar columnar;
+  rbm2_columnar updated_columnar;
+  long n_rows;
+} rbm2_columnar_parse_data;
+
+static VALUE
+rbm2_columnar_parse_body(VALUE user_data)
+{
+  rbm2_columnar_parse_data *columnar_data =
+    (rbm2_columnar_parse_data *)user_data;
+  rbm2_rows_parse_data *data = columnar_data->data;
+  const rbm2_rows *rows = data->rows;
+  while (data->row_data < data->row_data_end) {
+    rbm2_columnar_parse_row(&(columnar_data->columnar),
+                            columnar_data->n_rows,
+                            &(data->row_data),
+                            data->row_data_end,
+                            rows->n_columns,
+                            data->column_bitmap,
+                            data->table,
+                            &(data->options));
+    if (rows->have_updated_rows) {
+      rbm2_columnar_parse_row(&(columnar_data->updated_columnar),
+                              columnar_data->n_rows,
+                              &(data->row_data),
+                              data->row_data_end,
+                              rows->n_columns,
+                              data->column_update_bitmap,
+                              data->table,
+                              &(data->options));
+    }
+    columnar_data->n_rows++;
+    if (!RB_NIL_P(data->options.rb_stats)) {
+      rbm2_stats_get(data->options.rb_stats)->n_decoded_rows++;
+    }
+  }
+  return RUBY_Qnil;
+}
+
+static VALUE
+rbm2_columnar_parse_rescue(VALUE user_data, VALUE error)
+{
+  rbm2_columnar_parse_data *columnar_data =
+    (rbm2_columnar_parse_data *)user_data;
+  return rbm2_rows_parse_rescue((VALUE)(columnar_data->data), error);
+}
+
+/*
+ * Decodes rows into the struct-of-arrays layout:
+ *
+ *   {
+ *     n_rows: Integer,
+ *     values: [column0_values, column1_values, ...],
+ *     nulls: [column0_null_bitmap, column1_null_bitmap, ...],
+ *     # Only for UpdateRowsEvent
+ *     updated_values: [...],
+ *     updated_nulls: [...],
+ *   }
+ *
+ * Integer and floating point column values are packed into a String
+ * of 8 bytes little endian int64/double values with packed: true.
+ * NULL values are packed as 0.
+ *
+ * This decodes the raw rows. It can't be used after rows are decoded
+ * by #rows, #updated_rows or shareable: true.
+ */
+static VALUE
+rbm2_replication_rows_event_columnar(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_options;
+  rb_scan_args(argc, argv, "0:", &rb_options);
+  bool packed = false;
+  if (!RB_NIL_P(rb_options)) {
+    static ID keyword_ids[1];
+    VALUE keyword_args[1];
+    if (keyword_ids[0] == 0) {
+      CONST_ID(keyword_ids[0], "packed");
+    }
+    rb_get_kwargs(rb_options, keyword_ids, 0, 1, keyword_args);
+    if (keyword_args[0] != RUBY_Qundef) {
+      packed = RB_TEST(keyword_args[0]);
+    }
+  }
+
+  rbm2_event *event = rbm2_event_get(self);
+  VALUE rb_rows = event->body.rows.rb_raw_rows;
+  VALUE rb_columnar = rb_hash_new();
+  if (RB_NIL_P(rb_rows)) {
+    if (!RB_NIL_P(rbm2_table_map_event_get_table(
+                    event->body.rows.rb_table_map))) {
+      rb_raise(rb_eMysql2ReplicationError,
+               "rows are already decoded: %+" PRIsVALUE,
+               self);
+    }
+    /* Rows of an unknown or filtered table aren't decoded. */
+    rb_hash_aset(rb_columnar, rb_id2sym(rb_intern("n_rows")), INT2FIX(0));
+    rb_hash_aset(rb_columnar, rb_id2sym(rb_intern("values")), rb_ary_new());
+    rb_hash_aset(rb_columnar, rb_id2sym(rb_intern("nulls")), rb_ary_new());
+    return rb_columnar;
+  }
+
+  rbm2_rows *rows = rbm2_rows_get(rb_rows);
+  rbm2_rows_parse_data data;
+  rbm2_rows_parse_data_init(&data, rows);
+  if (rows->n_columns > data.table->n_columns) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "too many columns in rows event: %u: expected: %u",
+             rows->n_columns,
+             data.table->n_columns);
+  }
+  rbm2_columnar_parse_data columnar_data;
+  columnar_data.data = &data;
+  columnar_data.n_rows = 0;
+  rbm2_columnar_init(&(columnar_data.columnar),
+                     data.table,
+                     rows->n_columns,
+                     packed);
+  columnar_data.updated_columnar.rb_values = RUBY_Qnil;
+  columnar_data.updated_columnar.rb_nulls = RUBY_Qnil;
+  if (rows->have_updated_rows) {
+    rbm2_columnar_init(&(columnar_data.updated_columnar),
+                       data.table,
+                       rows->n_columns,
+                       packed);
+  }
+  rb_rescue(rbm2_columnar_parse_body, (VALUE)&columnar_data,
+            rbm2_columnar_parse_rescue, (VALUE)&columnar_data);
+  rb_hash_aset(rb_columnar,
+               rb_id2sym(rb_intern("n_rows")),
+               LONG2NUM(columnar_data.n_rows));
+  rb_hash_aset(rb_columnar,
+               rb_id2sym(rb_intern("values")),
+               columnar_data.columnar.rb_values);
+  rb_hash_aset(rb_columnar,
+               rb_id2sym(rb_intern("nulls")),
+               columnar_data.columnar.rb_nulls);
+  if (rows->have_updated_rows) {
+    rb_hash_aset(rb_columnar,
+                 rb_id2sym(rb_intern("updated_values")),
+                 columnar_data.updated_columnar.rb_values);
+    rb_hash_aset(rb_columnar,
+                 rb_id2sym(rb_intern("updated_nulls")),
+                 columnar_data.updated_columnar.rb_nulls);
+  }
+  RB_GC_GUARD(rb_rows);
+  return rb_columnar;
+}
+
+static bool
+rbm2_event_parse_table_map(struct st_mariadb_rpl_table_map_event *e,
+                           const uint8_t *data,
+                           const uint8_t *data_end)
+{
+  /* https://mariadb.com/kb/en/table_map_event/ */
+  uint64_t value;
+  if (data_end - data < 6 + 2 + 1) {
+    return false;
+  }
+  e->table_id = rbm2_read_uint48(data);
+  data += 6;
+  data += 2; /* flags */
+  e->database.length = data[0];
+  data += 1;
+  if ((size_t)(data_end - data) < e->database.length + 1 + 1) {
+    return false;
+  }
+  e->database.str = (char *)data;
+  data += e->database.length + 1;
+  e->table.length = data[0];
+  data += 1;
+  if ((size_t)(data_end - data) < e->table.length + 1) {
+    return false;
+  }
+  e->table.str = (char *)data;
+  data += e->table.length + 1;
+  if (!rbm2_read_packed_integer(&data, data_end, &value)) {
+    return false;
+  }
+  e->column_count = value;
+  if ((uint64_t)(data_end - data) < e->column_count) {
+    return false;
+  }
+  e->column_types.str = (char *)data;
+  e->column_types.length = e->column_count;
+  data += e->column_count;
+  if (!rbm2_read_packed_integer(&data, data_end, &value)) {
+    return false;
+  }
+  if ((uint64_t)(data_end - data) < value) {
+    return false;
+  }
+  e->metadata.str = (char *)data;
+  e->metadata.length = value;
+  data += value;
+  if ((size_t)(data_end - data) < (e->column_count + 7) / 8) {
+    return false;
+  }
+  e->null_indicator = (void *)data;
+  return true;
+}
+
+/*
+ * Finds the event body without the header and the checksum. data and
+ * data_end are NULL on failure.
+ */
+static bool
+rbm2_raw_event_get_body(const uint8_t *raw_event,
+                        size_t raw_event_size,
+                        bool use_checksum,
+                        const uint8_t **data,
+                        const uint8_t **data_end)
+{
+  *data = NULL;
+  *data_end = NULL;
+  if (raw_event_size < RBM2_EVENT_HEADER_SIZE) {
+    return false;
+  }
+  *data = raw_event + RBM2_EVENT_HEADER_SIZE;
+  *data_end = raw_event + raw_event_size;
+  if (use_checksum) {
+    if (*data_end - *data < RBM2_EVENT_CHECKSUM_SIZE) {
+      return false;
+    }
+    *data_end -= RBM2_EVENT_CHECKSUM_SIZE;
+  }
+  return true;
+}
+
+/*
+ * libmariadb doesn't provide the optional metadata. This finds it in
+ * the raw TABLE_MAP_EVENT.
+ */
+static void
+rbm2_table_map_event_get_optional_metadata(const uint8_t *raw_event,
+                                           size_t raw_event_size,
+                                           bool use_checksum,
+                                           const uint8_t **optional_metadata,
+                                           size_t *optional_metadata_size)
+{
+  *optional_metadata = NULL;
+  *optional_metadata_size = 0;
+  const uint8_t *data;
+  const uint8_t *data_end;
+  if (!rbm2_raw_event_get_body(raw_event,
+                               raw_event_size,
+                               use_checksum,
+                               &data,
+                               &data_end)) {
+    return;
+  }
+  struct st_mariadb_rpl_table_map_event table_map;
+  if (!rbm2_event_parse_table_map(&table_map, data, data_end)) {
+    return;
+  }
+  data = (const uint8_t *)(table_map.null_indicator) +
+    (table_map.column_count + 7) / 8;
+  *optional_metadata = data;
+  *optional_metadata_size = data_end - data;
+}
+
+/*
+ * https://mariadb.com/kb/en/query_event/
+ *
+ * thread_id(4) + execution_time(4) + database_length(1) +
+ * error_code(2) + status_variables_length(2) + status_variables +
+ * database + "\0" + query
+ */
+static bool
+rbm2_query_event_parse(const uint8_t *data,
+                       const uint8_t *data_end,
+                       const uint8_t **database,
+                       size_t *database_size,
+                       const uint8_t **query,
+                       size_t *query_size)
+{
+  if (data_end - data < 13) {
+    return false;
+  }
+  uint8_t database_length = data[8];
+  uint16_t status_variables_length = rbm2_read_uint16(data + 11);
+  data += 13;
+  if ((size_t)(data_end - data) <
+      status_variables_length + database_length + 1) {
+    return false;
+  }
+  data += status_variables_length;
+  *database = data;
+  *database_size = database_length;
+  data += database_length + 1;
+  *query = data;
+  *query_size = data_end - data;
+  return true;
+}
+
+static bool
+rbm2_query_equal(const uint8_t *query, size_t query_size, const char *keyword)
+{
+  size_t keyword_size = strlen(keyword);
+  return query_size == keyword_size &&
+    strncasecmp((const char *)query, keyword, keyword_size) == 0;
+}
+
+static VALUE
+rbm2_sid_to_s(const uint8_t *sid)
+{
+  return rb_sprintf("%02X%02X%02X%02X-"
+                    "%02X%02X-"
+                    "%02X%02X-"
+                    "%02X%02X-"
+                    "%02X%02X%02X%02X%02X%02X",
+                    sid[0], sid[1], sid[2], sid[3],
+                    sid[4], sid[5],
+                    sid[6], sid[7],
+                    sid[8], sid[9],
+                    sid[10], sid[11], sid[12],
+                    sid[13], sid[14], sid[15]);
+}
+
+/* FL_STANDALONE: https://mariadb.com/kb/en/gtid_event/ */
+#define RBM2_MARIADB_GTID_FLAG_STANDALONE 0x01
+
+/*
+ * Parses GTID_EVENT (MariaDB), GTID_LOG_EVENT and
+ * ANONYMOUS_GTID_LOG_EVENT (MySQL) into a GTID string such as
+ * "0-1-100" (MariaDB) or "3E11FA47-71CA-11E1-9E33-C80AA9429562:23"
+ * (MySQL). rb_gtid is nil for ANONYMOUS_GTID_LOG_EVENT.
+ *
+ * standalone is whether the transaction has only one event without
+ * COMMIT such as DDL. It's always false for MySQL. MySQL uses BEGIN
+ * for transactions that need COMMIT.
+ */
+static bool
+rbm2_gtid_event_parse(uint8_t event_type,
+                      uint32_t server_id,
+                      const uint8_t *data,
+                      const uint8_t *data_end,
+                      VALUE *rb_gtid,
+                      bool *standalone)
+{
+  *rb_gtid = RUBY_Qnil;
+  *standalone = false;
+  if (event_type == GTID_EVENT) {
+    /* sequence_number(8) + domain_id(4) + flags(1) */
+    if (data_end - data < 8 + 4 + 1) {
+      return false;
+    }
+    uint64_t sequence_number = rbm2_read_uint64(data);
+    uint32_t domain_id = rbm2_read_uint32(data + 8);
+    uint8_t flags = data[12];
+    *rb_gtid = rb_sprintf("%u-%u-%" PRIu64,
+                          domain_id,
+                          server_id,
+                          sequence_number);
+    *standalone = (flags & RBM2_MARIADB_GTID_FLAG_STANDALONE);
+  } else {
+    /* flags(1) + sid(16) + gno(8) */
+    if (data_end - data < 1 + 16 + 8) {
+      return false;
+    }
+    if (event_type == GTID_LOG_EVENT) {
+      uint64_t gno = rbm2_read_uint64(data + 1 + 16);
+      *rb_gtid = rbm2_sid_to_s(data + 1);
+      rb_str_catf(*rb_gtid, ":%" PRIu64, gno);
+    }
+  }
+  return true;
+}
+
+/*
+ * https://mariadb.com/kb/en/gtid_list_event/
+ *
+ * count(4) + (domain_id(4) + server_id(4) + sequence_number(8)) * count
+ *
+ * The high 4 bits of count are flags.
+ */
+static bool
+rbm2_gtid_list_event_parse(const uint8_t *data,
+                           const uint8_t *data_end,
+                           VALUE *rb_gtids)
+{
+  if (data_end - data < 4) {
+    return false;
+  }
+  uint32_t n_gtids = rbm2_read_uint32(data) & 0x0fffffff;
+  data += 4;
+  if ((size_t)(data_end - data) < (size_t)n_gtids * (4 + 4 + 8)) {
+    return false;
+  }
+  *rb_gtids = rb_ary_new_capa(n_gtids);
+  uint32_t i;
+  for (i = 0; i < n_gtids; i++) {
+    uint32_t domain_id = rbm2_read_uint32(data);
+    uint32_t server_id = rbm2_read_uint32(data + 4);
+    uint64_t sequence_number = rbm2_read_uint64(data + 8);
+    rb_ary_push(*rb_gtids,
+                rb_sprintf("%u-%u-%" PRIu64,
+                           domain_id,
+                           server_id,
+                           sequence_number));
+    data += 4 + 4 + 8;
+  }
+  return true;
+}
+
+/*
+ * https://dev.mysql.com/doc/dev/mysql-server/latest/classmysql_1_1binlog_1_1event_1_1Previous__gtids__event.html
+ *
+ * n_sids(8) + (sid(16) + n_intervals(8) +
+ *              (start(8) + end(8)) * n_intervals) * n_sids
+ *
+ * Each SID is formatted as a GTID set such as
+ * "3E11FA47-71CA-11E1-9E33-C80AA9429562:1-5:7". end is exclusive.
+ */
+static bool
+rbm2_previous_gtids_event_parse(const uint8_t *data,
+                                const uint8_t *data_end,
+                                VALUE *rb_gtids)
+{
+  if (data_end - data < 8) {
+    return false;
+  }
+  uint64_t n_sids = rbm2_read_uint64(data);
+  data += 8;
+  *rb_gtids = rb_ary_new();
+  uint64_t i;
+  for (i = 0; i < n_sids; i++) {
+    if (data_end - data < 16 + 8) {
+      return false;
+    }
+    VALUE rb_gtid = rbm2_sid_to_s(data);
+    uint64_t n_intervals = rbm2_read_uint64(data + 16);
+    data += 16 + 8;
+    if ((uint64_t)(data_end - data) / (8 + 8) < n_intervals) {
+      return false;
+    }
+    uint64_t j;
+    for (j = 0; j < n_intervals; j++) {
+      uint64_t start = rbm2_read_uint64(data);
+      uint64_t end = rbm2_read_uint64(data + 8);
+      if (end - 1 == start) {
+        rb_str_catf(rb_gtid, ":%" PRIu64, start);
+      } else {
+        rb_str_catf(rb_gtid, ":%" PRIu64 "-%" PRIu64, start, end - 1);
+      }
+      data += 8 + 8;
+    }
+    rb_ary_push(*rb_gtids, rb_gtid);
+  }
+  return true;
+}
+
+static bool
+rbm2_event_parse_rows(struct st_mariadb_rpl_rows_event *e,
+                      enum mariadb_rpl_event event_type,
+                      const uint8_t *data,
+                      const uint8_t *data_end)
+{
+  /* https://mariadb.com/kb/en/rows_event_v1v2-rows_compressed_event_v1/ */
+  uint64_t value;
+  e->type = event_type;
+  if (data_end - data < 6 + 2) {
+    return false;
+  }
+  e->table_id = rbm2_read_uint48(data);
+  data += 6;
+  e->flags = rbm2_read_uint16(data);
+  data += 2;
+  switch (event_type) {
+  case WRITE_ROWS_EVENT:
+  case UPDATE_ROWS_EVENT:
+  case DELETE_ROWS_EVENT:
+    {
+      if (data_end - data < 2) {
+        return false;
+      }
+      /* The extra data length includes the length itself. */
+      uint16_t extra_data_size = rbm2_read_uint16(data);
+      if (extra_data_size < 2 || data_end - data < extra_data_size) {
+        return false;
+      }
+      e->extra_data_size = extra_data_size - 2;
+      e->extra_data = (void *)(data + 2);
+      data += extra_data_size;
+    }
+    break;
+  default:
+    break;
+  }
+  if (!rbm2_read_packed_integer(&data, data_end, &value)) {
+    return false;
+  }
+  e->column_count = value;
+  size_t bitmap_size = (e->column_count + 7) / 8;
+  if ((size_t)(data_end - data) < bitmap_size) {
+    return false;
+  }
+  e->column_bitmap = (void *)data;
+  data += bitmap_size;
+  switch (event_type) {
+  case UPDATE_ROWS_EVENT_V1:
+  case UPDATE_ROWS_EVENT:
+    if ((size_t)(data_end - data) < bitmap_size) {
+      return false;
+    }
+    e->column_update_bitmap = (void *)data;
+    data += bitmap_size;
+    break;
+  default:
+    break;
+  }
+  e->row_data = (void *)data;
+  e->row_data_size = data_end - data;
+  return true;
+}
+
+/*
+ * Parses a raw event (header, body and checksum) into MARIADB_RPL_EVENT
+ * like mariadb_rpl_fetch() does. Only events that
+ * rbm2_decoder_event_new() uses are parsed. Strings in the parsed
+ * event refer raw_event.
+ */
+static bool
+rbm2_event_parse(MARIADB_RPL_EVENT *event,
+                 const uint8_t *raw_event,
+                 size_t raw_event_size,
+                 bool use_checksum)
+{
+  /* https://mariadb.com/kb/en/2-binlog-event-header/ */
+  if (raw_event_size < RBM2_EVENT_HEADER_SIZE) {
+    return false;
+  }
+  memset(event, 0, sizeof(MARIADB_RPL_EVENT));
+  event->timestamp = rbm2_read_uint32(raw_event);
+  event->event_type = raw_event[4];
+  event->server_id = rbm2_read_uint32(raw_event + 5);
+  event->event_length = rbm2_read_uint32(raw_event + 9);
+  event->next_event_pos = rbm2_read_uint32(raw_event + 13);
+  event->flags = rbm2_read_uint16(raw_event + 17);
+
+  const uint8_t *data = raw_event + RBM2_EVENT_HEADER_SIZE;
+  const uint8_t *data_end = raw_event + raw_event_size;
+  if (use_checksum) {
+    if (data_end - data < RBM2_EVENT_CHECKSUM_SIZE) {
+      return false;
+    }
+    data_end -= RBM2_EVENT_CHECKSUM_SIZE;
+  }
+  switch (event->event_type) {
+  case ROTATE_EVENT:
+    {
+      struct st_mariadb_rpl_rotate_event *e = &(event->event.rotate);
+      if (data_end - data < 8) {
+        return false;
+      }
+      e->position = rbm2_read_uint64(data);
+      e->filename.str = (char *)(data + 8);
+      e->filename.length = data_end - data - 8;
+    }
+    return true;
+  case FORMAT_DESCRIPTION_EVENT:
+    {
+      struct st_mariadb_rpl_format_description_event *e =
+        &(event->event.format_description);
+      /* format + server_version + timestamp + header_len */
+      if (data_end - data < 2 + 50 + 4 + 1 ||
+          !memchr(data + 2, '\0', 50)) {
+        return false;
+      }
+      e->format = rbm2_read_uint16(data);
+      e->server_version = (char *)(data + 2);
+      e->timestamp = rbm2_read_uint32(data + 2 + 50);
+      e->header_len = data[2 + 50 + 4];
+    }
+    return true;
+  case TABLE_MAP_EVENT:
+    return rbm2_event_parse_table_map(&(event->event.table_map),
+                                      data,
+                                      data_end);
+  case WRITE_ROWS_EVENT_V1:
+  case WRITE_ROWS_EVENT:
+  case UPDATE_ROWS_EVENT_V1:
+  case UPDATE_ROWS_EVENT:
+  case DELETE_ROWS_EVENT_V1:
+  case DELETE_ROWS_EVENT:
+    return rbm2_event_parse_rows(&(event->event.rows),
+                                 event->event_type,
+                                 data,
+                                 data_end);
+  default:
+    return true;
+  }
+}
+
+/*
+ * Freezes an event deeply in place. Rows are decoded before freezing
+ * because they're decoded lazily otherwise. Nothing is copied: the
+ * returned event is the given event.
+ */
+static VALUE
+rbm2_event_make_shareable(VALUE rb_event)
+{
+  rbm2_replication_rows_event_parse_rows(rb_event);
+#ifdef HAVE_RB_RACTOR_MAKE_SHAREABLE
+  return rb_ractor_make_shareable(rb_event);
+#else
+  return rb_obj_freeze(rb_event);
+#endif
+}
+
+/*
+ * Creates a Mysql2Replication::Event from a parsed event. Returns
+ * Qundef for an event that is filtered out and skipped.
+ *
+ * use_checksum is whether raw_event has checksum or not.
+ *
+ * rb_raw_event_owner must keep raw_event alive when it isn't nil.
+ * See also rbm2_rows_new().
+ */
+static VALUE
+rbm2_decoder_event_decode(rbm2_decoder *decoder,
+                          MARIADB_RPL_EVENT *event,
+                          const uint8_t *raw_event,
+                          size_t raw_event_size,
+                          bool use_checksum,
+                          VALUE rb_raw_event_owner)
+{
+  VALUE klass;
+  VALUE rb_event;
+  rbm2_event *event_data;
+  switch (event->event_type) {
+  case ROTATE_EVENT:
+    klass = rb_cMysql2ReplicationRotateEvent;
+    rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_ROTATE, &event_data);
+    {
+      struct st_mariadb_rpl_rotate_event *e = &(event->event.rotate);
+      event_data->body.rotate.position = e->position;
+      size_t filename_size = e->filename.length;
+      if (event->timestamp == 0) {
+        /* Fake ROTATE_EVENT: https://mariadb.com/kb/en/fake-rotate_event/ */
+        if (!decoder->format_description_processed) {
+          filename_size = raw_event_size -
+            RBM2_EVENT_HEADER_SIZE -
+            sizeof(uint64_t); /* position */
+          if (!decoder->force_disable_use_checksum) {
+            filename_size -= sizeof(uint32_t); /* checksum */
+          }
+        }
+      }
+      event_data->body.rotate.rb_file_name =
+        rb_str_new(e->filename.str, filename_size);
+    }
+    break;
+  case FORMAT_DESCRIPTION_EVENT:
+    klass = rb_cMysql2ReplicationFormatDescriptionEvent;
+    rb_event = rbm2_event_new(klass,
+                              RBM2_EVENT_KIND_FORMAT_DESCRIPTION,
+                              &event_data);
+    {
+      struct st_mariadb_rpl_format_description_event *e =
+        &(event->event.format_description);
+      event_data->body.format_description.format = e->format;
+      event_data->body.format_description.rb_server_version =
+        rb_str_new_cstr(e->server_version);
+      event_data->body.format_description.header_length = e->header_len;
+      decoder->is_mariadb = (strstr(e->server_version, "MariaDB") != NULL);
+    }
+    decoder->format_description_processed = true;
+    break;
+  case TABLE_MAP_EVENT:
+    {
+      struct st_mariadb_rpl_table_map_event *e = &(event->event.table_map);
+      VALUE rb_table_id = ULONG2NUM(e->table_id);
+      bool is_target_table =
+        rbm2_decoder_is_target_table(decoder, e);
+      if (!is_target_table && decoder->skip_filtered_events) {
+        rb_hash_aset(decoder->rb_table_maps, rb_table_id, RUBY_Qfalse);
+        return RUBY_Qundef;
+      }
+      klass = rb_cMysql2ReplicationTableMapEvent;
+      rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_TABLE_MAP, &event_data);
+      event_data->body.table_map.table_id = e->table_id;
+      if (is_target_table) {
+        const uint8_t *optional_metadata;
+        size_t optional_metadata_size;
+        rbm2_table_map_event_get_optional_metadata(raw_event,
+                                                   raw_event_size,
+                                                   use_checksum,
+                                                   &optional_metadata,
+                                                   &optional_metadata_size);
+        VALUE rb_table = rbm2_decoder_find_table(decoder,
+                                                 e,
+                                                 optional_metadata,
+                                                 optional_metadata_size);
+        rbm2_table *table = rbm2_table_get(rb_table);
+        event_data->body.table_map.rb_database = table->rb_database_name;
+        event_data->body.table_map.rb_table_name = table->rb_table_name;
+        event_data->body.table_map.rb_columns = table->rb_columns;
+        event_data->body.table_map.rb_table = rb_table;
+      } else {
+        /* Filtered out: columns aren't parsed. */
+        event_data->body.table_map.rb_database =
+          rb_str_new(e->database.str, e->database.length);
+        event_data->body.table_map.rb_table_name =
+          rb_str_new(e->table.str, e->table.length);
+      }
+      rb_hash_aset(decoder->rb_table_maps, rb_table_id, rb_event);
+    }
+    break;
+  case WRITE_ROWS_EVENT_V1:
+  case WRITE_ROWS_EVENT:
+  case UPDATE_ROWS_EVENT_V1:
+  case UPDATE_ROWS_EVENT:
+  case DELETE_ROWS_EVENT_V1:
+  case DELETE_ROWS_EVENT:
+    switch (event->event_type) {
+    case WRITE_ROWS_EVENT_V1:
+    case WRITE_ROWS_EVENT:
+      klass = rb_cMysql2ReplicationWriteRowsEvent;
+      break;
+    case UPDATE_ROWS_EVENT_V1:
+    case UPDATE_ROWS_EVENT:
+      klass = rb_cMysql2ReplicationUpdateRowsEvent;
+      break;
+    default:
+      klass = rb_cMysql2ReplicationDeleteRowsEvent;
+      break;
+    }
+    {
+      struct st_mariadb_rpl_rows_event *e = &(event->event.rows);
+      VALUE rb_table_id = ULONG2NUM(e->table_id);
+      VALUE rb_table_map = rb_hash_aref(decoder->rb_table_maps, rb_table_id);
+      if (e->flags & FL_STMT_END) {
+        rb_hash_clear(decoder->rb_table_maps);
+      }
+      if (rb_table_map == RUBY_Qfalse) {
+        /* Filtered out and skipped. */
+        return RUBY_Qundef;
+      }
+      rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_ROWS, &event_data);
+      event_data->body.rows.table_id = e->table_id;
+      event_data->body.rows.rb_table_map = rb_table_map;
+      event_data->body.rows.flags = e->flags;
+      bool have_updated_rows = (klass == rb_cMysql2ReplicationUpdateRowsEvent);
+      if (RB_NIL_P(rbm2_table_map_event_get_table(rb_table_map))) {
+        event_data->body.rows.rb_rows = rb_ary_new();
+        if (have_updated_rows) {
+          event_data->body.rows.rb_updated_rows = rb_ary_new();
+        }
+      } else {
+        event_data->body.rows.rb_raw_rows =
+          rbm2_rows_new(e,
+                        have_updated_rows,
+                        rb_table_map,
+                        &(decoder->options),
+                        rb_raw_event_owner);
+      }
+    }
+    break;
+  case GTID_EVENT:
+  case GTID_LOG_EVENT:
+  case ANONYMOUS_GTID_LOG_EVENT:
+  case GTID_LIST_EVENT:
+  case PREVIOUS_GTIDS_LOG_EVENT:
+  case QUERY_EVENT:
+  case XID_EVENT:
+  case ANNOTATE_ROWS_EVENT:
+  case ROWS_QUERY_LOG_EVENT:
+  case HEARTBEAT_LOG_EVENT:
+    {
+      /* libmariadb doesn't parse all of them. We parse raw events. */
+      const uint8_t *data;
+      const uint8_t *data_end;
+      bool parsed = rbm2_raw_event_get_body(raw_event,
+                                            raw_event_size,
+                                            use_checksum,
+                                            &data,
+                                            &data_end);
+      switch (event->event_type) {
+      case GTID_EVENT:
+      case GTID_LOG_EVENT:
+      case ANONYMOUS_GTID_LOG_EVENT:
+        klass = rb_cMysql2ReplicationGtidEvent;
+        rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_GTID, &event_data);
+        parsed = parsed &&
+          rbm2_gtid_event_parse(event->event_type,
+                                event->server_id,
+                                data,
+                                data_end,
+                                &(event_data->body.gtid.rb_gtid),
+                                &(event_data->body.gtid.standalone));
+        break;
+      case GTID_LIST_EVENT:
+        klass = rb_cMysql2ReplicationGtidListEvent;
+        rb_event =
+          rbm2_event_new(klass, RBM2_EVENT_KIND_GTID_LIST, &event_data);
+        parsed = parsed &&
+          rbm2_gtid_list_event_parse(data,
+                                     data_end,
+                                     &(event_data->body.gtid_list.rb_gtids));
+        break;
+      case PREVIOUS_GTIDS_LOG_EVENT:
+        klass = rb_cMysql2ReplicationPreviousGtidsEvent;
+        rb_event =
+          rbm2_event_new(klass, RBM2_EVENT_KIND_GTID_LIST, &event_data);
+        parsed = parsed &&
+          rbm2_previous_gtids_event_parse(
+            data,
+            data_end,
+            &(event_data->body.gtid_list.rb_gtids));
+        break;
+      case QUERY_EVENT:
+        klass = rb_cMysql2ReplicationQueryEvent;
+        rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_QUERY, &event_data);
+        {
+          const uint8_t *database;
+          size_t database_size;
+          const uint8_t *query;
+          size_t query_size;
+          parsed = parsed &&
+            rbm2_query_event_parse(data,
+                                   data_end,
+                                   &database,
+                                   &database_size,
+                                   &query,
+                                   &query_size);
+          if (parsed) {
+            event_data->body.query.thread_id = rbm2_read_uint32(data);
+            event_data->body.query.execution_time =
+              rbm2_read_uint32(data + 4);
+            event_data->body.query.error_code = rbm2_read_uint16(data + 9);
+            event_data->body.query.rb_database =
+              rb_str_new((const char *)database, database_size);
+            event_data->body.query.rb_query =
+              rb_str_new((const char *)query, query_size);
+          }
+        }
+        break;
+      case XID_EVENT:
+        klass = rb_cMysql2ReplicationXidEvent;
+        rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_XID, &event_data);
+        parsed = parsed && data_end - data >= 8;
+        if (parsed) {
+          event_data->body.xid.xid = rbm2_read_uint64(data);
+        }
+        break;
+      case HEARTBEAT_LOG_EVENT:
+        /* https://mariadb.com/kb/en/heartbeat_log_event/ */
+        klass = rb_cMysql2ReplicationHeartbeatEvent;
+        rb_event =
+          rbm2_event_new(klass, RBM2_EVENT_KIND_HEARTBEAT, &event_data);
+        if (parsed) {
+          event_data->body.heartbeat.rb_file_name =
+            rb_str_new((const char *)data, data_end - data);
+        }
+        break;
+      default:
+        klass = rb_cMysql2ReplicationRowsQueryEvent;
+        rb_event =
+          rbm2_event_new(klass, RBM2_EVENT_KIND_ROWS_QUERY, &event_data);
+        if (parsed && event->event_type == ROWS_QUERY_LOG_EVENT) {
+          /* The length(1) is truncated for long queries. It's ignored. */
+          parsed = data_end - data >= 1;
+          data++;
+        }
+        if (parsed) {
+          event_data->body.rows_query.rb_query =
+            rb_str_new((const char *)data, data_end - data);
+        }
+        break;
+      }
+      if (!parsed) {
+        rb_raise(rb_eMysql2ReplicationError,
+                 "failed to parse event: type: %u",
+                 event->event_type);
+      }
+    }
+    break;
+  default:
+    klass = rb_cMysql2ReplicationEvent;
+    rb_event = rbm2_event_new(klass, RBM2_EVENT_KIND_GENERIC, &event_data);
+    break;
+  }
+  event_data->type = event->event_type;
+  event_data->timestamp = event->timestamp;
+  event_data->server_id = event->server_id;
+  event_data->length = event->event_length;
+  event_data->next_position = event->next_event_pos;
+  event_data->flags = event->flags;
+  if (decoder->options.shareable) {
+    rb_event = rbm2_event_make_shareable(rb_event);
+  }
+  return rb_event;
+}
+
+/*
+ * The decode profile of an event includes its rows when they're
+ * decoded eagerly.
+ */
+static VALUE
+rbm2_decoder_event_new(rbm2_decoder *decoder,
+                       MARIADB_RPL_EVENT *event,
+                       const uint8_t *raw_event,
+                       size_t raw_event_size,
+                       bool use_checksum,
+                       VALUE rb_raw_event_owner)
+{
+  rbm2_decode_profile *profile = rbm2_decode_profile_get();
+  uint64_t start_time_ns = rbm2_decode_profile_start(profile);
+  VALUE rb_event = rbm2_decoder_event_decode(decoder,
+                                             event,
+                                             raw_event,
+                                             raw_event_size,
+                                             use_checksum,
+                                             rb_raw_event_owner);
+  if (profile) {
+    rbm2_decode_profile_add(&(profile->events[(uint8_t)(event->event_type)]),
+                            start_time_ns,
+                            1,
+                            raw_event_size);
+  }
+  return rb_event;
+}
+
+typedef struct
+{
+  VALUE rb_gtid;
+  bool have_xid;
+  uint64_t xid;
+  uint32_t timestamp;
+  uint32_t next_position;
+  VALUE rb_events;
+} rbm2_transaction;
+
+static void
+rbm2_transaction_mark(void *data)
+{
+  rbm2_transaction *transaction = data;
+  rb_gc_mark(transaction->rb_gtid);
+  rb_gc_mark(transaction->rb_events);
+}
+
+static const rb_data_type_t rbm2_transaction_type = {
+  "Mysql2Replication::Transaction",
+  {
+    rbm2_transaction_mark,
+    RUBY_TYPED_DEFAULT_FREE,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE,
+};
+
+static inline rbm2_transaction *
+rbm2_transaction_get(VALUE rb_transaction)
+{
+  rbm2_transaction *transaction;
+  TypedData_Get_Struct(rb_transaction,
+                       rbm2_transaction,
+                       &rbm2_transaction_type,
+                       transaction);
+  return transaction;
+}
+
+static void
+rbm2_transaction_state_init(rbm2_transaction_state *state)
+{
+  state->in_transaction = false;
+  state->need_commit = false;
+  state->rb_gtid = RUBY_Qnil;
+  state->have_xid = false;
+  state->xid = 0;
+}
+
+static void
+rbm2_transaction_state_start(rbm2_transaction_state *state,
+                             VALUE rb_gtid,
+                             bool need_commit)
+{
+  state->in_transaction = true;
+  state->need_commit = need_commit;
+  state->rb_gtid = rb_gtid;
+  state->have_xid = false;
+  state->xid = 0;
+}
+
+static void
+rbm2_transaction_state_end(rbm2_transaction_state *state)
+{
+  state->in_transaction = false;
+  state->need_commit = false;
+}
+
+/* Updates the state with a raw event and returns the role of it. */
+static rbm2_transaction_event_role
+rbm2_transaction_state_update(rbm2_transaction_state *state,
+                              const uint8_t *raw_event,
+                              size_t raw_event_size,
+                              bool use_checksum)
+{
+  const uint8_t *data;
+  const uint8_t *data_end;
+  if (!rbm2_raw_event_get_body(raw_event,
+                               raw_event_size,
+                               use_checksum,
+                               &data,
+                               &data_end)) {
+    return RBM2_TRANSACTION_EVENT_OUTSIDE;
+  }
+  uint8_t event_type = raw_event[4];
+  switch (event_type) {
+  case GTID_EVENT:
+  case GTID_LOG_EVENT:
+  case ANONYMOUS_GTID_LOG_EVENT:
+    {
+      VALUE rb_gtid;
+      bool standalone;
+      if (!rbm2_gtid_event_parse(event_type,
+                                 rbm2_read_uint32(raw_event + 5),
+                                 data,
+                                 data_end,
+                                 &rb_gtid,
+                                 &standalone)) {
+        rb_raise(rb_eMysql2ReplicationError,
+                 "failed to parse GTID event: type: %u",
+                 event_type);
+      }
+      rbm2_transaction_state_start(state,
+                                   rb_gtid,
+                                   event_type == GTID_EVENT && !standalone);
+    }
+    return RBM2_TRANSACTION_EVENT_BEGIN;
+  case QUERY_EVENT:
+    {
+      const uint8_t *database;
+      size_t database_size;
+      const uint8_t *query;
+      size_t query_size;
+      if (!rbm2_query_event_parse(data,
+                                  data_end,
+                                  &database,
+                                  &database_size,
+                                  &query,
+                                  &query_size)) {
+        rb_raise(rb_eMysql2ReplicationError, "failed to parse query event");
+      }
+      if (rbm2_query_equal(query, query_size, "BEGIN")) {
+        if (state->in_transaction && !state->need_commit) {
+          /* MySQL: GTID_LOG_EVENT QUERY_EVENT(BEGIN) */
+          state->need_commit = true;
+        } else {
+          rbm2_transaction_state_start(state, RUBY_Qnil, true);
+        }
+        return RBM2_TRANSACTION_EVENT_BEGIN;
+      }
+      if (rbm2_query_equal(query, query_size, "COMMIT") ||
+          rbm2_query_equal(query, query_size, "ROLLBACK")) {
+        rbm2_transaction_state_end(state);
+        return RBM2_TRANSACTION_EVENT_COMMIT;
+      }
+      if (state->need_commit) {
+        return RBM2_TRANSACTION_EVENT_BODY;
+      }
+      if (!state->in_transaction) {
+        rbm2_transaction_state_start(state, RUBY_Qnil, false);
+      }
+      rbm2_transaction_state_end(state);
+    }
+    return RBM2_TRANSACTION_EVENT_LAST;
+  case XID_EVENT:
+    if (data_end - data < 8) {
+      rb_raise(rb_eMysql2ReplicationError, "failed to parse XID event");
+    }
+    state->have_xid = true;
+    state->xid = rbm2_read_uint64(data);
+    rbm2_transaction_state_end(state);
+    return RBM2_TRANSACTION_EVENT_COMMIT;
+  case TABLE_MAP_EVENT:
+  case WRITE_ROWS_EVENT_V1:
+  case WRITE_ROWS_EVENT:
+  case UPDATE_ROWS_EVENT_V1:
+  case UPDATE_ROWS_EVENT:
+  case DELETE_ROWS_EVENT_V1:
+  case DELETE_ROWS_EVENT:
+    /* Replication may be started in the middle of a transaction. */
+    if (!state->in_transaction) {
+      rbm2_transaction_state_start(state, RUBY_Qnil, true);
+    }
+    return RBM2_TRANSACTION_EVENT_BODY;
+  case START_EVENT_V3:
+  case STOP_EVENT:
+  case ROTATE_EVENT:
+  case FORMAT_DESCRIPTION_EVENT:
+  case HEARTBEAT_LOG_EVENT:
+  case PREVIOUS_GTIDS_LOG_EVENT:
+  case BINLOG_CHECKPOINT_EVENT:
+  case GTID_LIST_EVENT:
+  case START_ENCRYPTION_EVENT:
+    return RBM2_TRANSACTION_EVENT_OUTSIDE;
+  default:
+    if (state->in_transaction) {
+      return RBM2_TRANSACTION_EVENT_BODY;
+    } else {
+      return RBM2_TRANSACTION_EVENT_OUTSIDE;
+    }
+  }
+}
+
+/*
+ * Collects events in each transaction. Events that mark boundaries
+ * (GTID, BEGIN, COMMIT and XID) aren't included. Events outside of
+ * transactions such as ROTATE_EVENT are ignored. An incomplete
+ * transaction is dropped when a new transaction is started.
+ */
+typedef struct
+{
+  rbm2_transaction_state state;
+  VALUE rb_events;
+} rbm2_transaction_builder;
+
+static void
+rbm2_transaction_builder_reset(rbm2_transaction_builder *builder)
+{
+  rbm2_transaction_state_init(&(builder->state));
+  builder->rb_events = rb_ary_new();
+}
+
+static VALUE
+rbm2_transaction_builder_finish(rbm2_transaction_builder *builder,
+                                rbm2_decoder *decoder,
+                                const uint8_t *raw_event)
+{
+  rbm2_transaction *transaction;
+  VALUE rb_transaction =
+    TypedData_Make_Struct(rb_cMysql2ReplicationTransaction,
+                          rbm2_transaction,
+                          &rbm2_transaction_type,
+                          transaction);
+  transaction->rb_gtid = builder->state.rb_gtid;
+  transaction->have_xid = builder->state.have_xid;
+  transaction->xid = builder->state.xid;
+  transaction->timestamp = rbm2_read_uint32(raw_event);
+  transaction->next_position = rbm2_read_uint32(raw_event + 13);
+  transaction->rb_events = rb_obj_freeze(builder->rb_events);
+  builder->rb_events = rb_ary_new();
+  if (decoder->options.shareable) {
+#ifdef HAVE_RB_RACTOR_MAKE_SHAREABLE
+    rb_transaction = rb_ractor_make_shareable(rb_transaction);
+#else
+    rb_transaction = rb_obj_freeze(rb_transaction);
+#endif
+  }
+  return rb_transaction;
+}
+
+/*
+ * Feeds a raw event and its Mysql2Replication::Event. rb_event is
+ * Qundef when the event is filtered out and skipped. Returns a
+ * Mysql2Replication::Transaction when the event ends a transaction.
+ * Returns nil otherwise.
+ */
+static VALUE
+rbm2_transaction_builder_feed(rbm2_transaction_builder *builder,
+                              rbm2_decoder *decoder,
+                              const uint8_t *raw_event,
+                              size_t raw_event_size,
+                              bool use_checksum,
+                              VALUE rb_event)
+{
+  rbm2_transaction_event_role role =
+    rbm2_transaction_state_update(&(builder->state),
+                                  raw_event,
+                                  raw_event_size,
+                                  use_checksum);
+  switch (role) {
+  case RBM2_TRANSACTION_EVENT_BEGIN:
+    rb_ary_clear(builder->rb_events);
+    return RUBY_Qnil;
+  case RBM2_TRANSACTION_EVENT_BODY:
+    if (rb_event != RUBY_Qundef) {
+      rb_ary_push(builder->rb_events, rb_event);
+    }
+    return RUBY_Qnil;
+  case RBM2_TRANSACTION_EVENT_LAST:
+    if (rb_event != RUBY_Qundef) {
+      rb_ary_push(builder->rb_events, rb_event);
+    }
+    return rbm2_transaction_builder_finish(builder, decoder, raw_event);
+  case RBM2_TRANSACTION_EVENT_COMMIT:
+    return rbm2_transaction_builder_finish(builder, decoder, raw_event);
+  default:
+    return RUBY_Qnil;
+  }
+}
+
+static VALUE
+rbm2_replication_transaction_get_gtid(VALUE self)
+{
+  return rbm2_transaction_get(self)->rb_gtid;
+}
+
+static VALUE
+rbm2_replication_transaction_get_xid(VALUE self)
+{
+  rbm2_transaction *transaction = rbm2_transaction_get(self);
+  if (!transaction->have_xid) {
+    return RUBY_Qnil;
+  }
+  return ULL2NUM(transaction->xid);
+}
+
+static VALUE
+rbm2_replication_transaction_get_timestamp(VALUE self)
+{
+  return UINT2NUM(rbm2_transaction_get(self)->timestamp);
+}
+
+static VALUE
+rbm2_replication_transaction_get_next_position(VALUE self)
+{
+  return UINT2NUM(rbm2_transaction_get(self)->next_position);
+}
+
+static VALUE
+rbm2_replication_transaction_get_events(VALUE self)
+{
+  return rbm2_transaction_get(self)->rb_events;
+}
+
+static VALUE
+rbm2_replication_transaction_inspect(VALUE self)
+{
+  rbm2_transaction *transaction = rbm2_transaction_get(self);
+  return rb_sprintf("#<%" PRIsVALUE
+                    " gtid=%+" PRIsVALUE
+                    " xid=%+" PRIsVALUE
+                    " timestamp=%u"
+                    " next_position=%u"
+                    " events=%+" PRIsVALUE ">",
+                    rb_obj_class(self),
+                    transaction->rb_gtid,
+                    rbm2_replication_transaction_get_xid(self),
+                    transaction->timestamp,
+                    transaction->next_position,
+                    transaction->rb_events);
+}
+
+/* See also the fake ROTATE_EVENT case in rbm2_decoder_event_new(). */
+static bool
+rbm2_replication_client_wrapper_use_checksum(
+  rbm2_replication_client_wrapper *wrapper)
+{
+  if (wrapper->decoder.format_description_processed) {
+    return wrapper->rpl->use_checksum;
+  } else {
+    return !wrapper->decoder.force_disable_use_checksum;
+  }
+}
+
+/*
+ * The next position is advanced only at transaction boundaries. We
+ * can't resume from the middle of a transaction because rows events
+ * need TABLE_MAP_EVENT at the start of the transaction.
+ */
+static void
+rbm2_replication_client_wrapper_track_position(
+  rbm2_replication_client_wrapper *wrapper,
+  const uint8_t *raw_event,
+  size_t raw_event_size,
+  bool use_checksum,
+  VALUE rb_event)
+{
+  rbm2_transaction_state_update(&(wrapper->transaction_state),
+                                raw_event,
+                                raw_event_size,
+                                use_checksum);
+  if (raw_event[4] == ROTATE_EVENT && rb_event != RUBY_Qundef) {
+    rbm2_event *event = rbm2_event_get(rb_event);
+    wrapper->rb_next_file_name = event->body.rotate.rb_file_name;
+    wrapper->next_position = event->body.rotate.position;
+    return;
+  }
+  if (wrapper->transaction_state.in_transaction) {
+    return;
+  }
+  uint32_t next_position = rbm2_read_uint32(raw_event + 13);
+  /* 0 is used for artificial events such as the first FDE. */
+  if (next_position == 0) {
+    return;
+  }
+  wrapper->next_position = next_position;
+}
+
+static void
+rbm2_replication_client_wrapper_commit_position(
+  rbm2_replication_client_wrapper *wrapper)
+{
+  wrapper->rb_current_file_name = wrapper->rb_next_file_name;
+  wrapper->current_position = wrapper->next_position;
+}
+
+/*
+ * mariadb_reconnect() requires MYSQL_OPT_RECONNECT. It's enabled only
+ * while reconnecting. The original value is restored not to change
+ * how the Mysql2::Client handles a lost connection of normal queries.
+ */
+static void *
+rbm2_replication_client_reconnect_without_gvl(void *data)
+{
+  MYSQL *client = data;
+  my_bool original_reconnect = 0;
+  mysql_get_optionv(client, MYSQL_OPT_RECONNECT, &original_reconnect);
+  my_bool reconnect = 1;
+  mysql_optionsv(client, MYSQL_OPT_RECONNECT, &reconnect);
+  my_bool failed = mariadb_reconnect(client);
+  mysql_optionsv(client, MYSQL_OPT_RECONNECT, &original_reconnect);
+  return (void *)(intptr_t)failed;
+}
+
+static VALUE
+rbm2_replication_client_reopen_body(VALUE user_data)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    (rbm2_replication_client_wrapper *)user_data;
+  MYSQL *client = rbm2_replication_client_wrapper_get_client(wrapper);
+  if (rb_thread_call_without_gvl(rbm2_replication_client_reconnect_without_gvl,
+                                 client,
+                                 RUBY_UBF_IO,
+                                 0)) {
+    return RUBY_Qfalse;
+  }
+
+  /* MARIADB_RPL only has options. It's reused for the new connection. */
+  bool use_gtid = RB_NIL_P(wrapper->rb_current_file_name);
+  if (!use_gtid) {
+    mariadb_rpl_optionsv(wrapper->rpl,
+                         MARIADB_RPL_FILENAME,
+                         RSTRING_PTR(wrapper->rb_current_file_name),
+                         RSTRING_LEN(wrapper->rb_current_file_name));
+    mariadb_rpl_optionsv(wrapper->rpl,
+                         MARIADB_RPL_START,
+                         (unsigned long)(wrapper->current_position));
+  }
+
+  ID id_query;
+  CONST_ID(id_query, "query");
+  rb_funcall(wrapper->rb_client, id_query, 1, wrapper->rb_checksum_query);
+
+  wrapper->decoder.format_description_processed = false;
+  rb_hash_clear(wrapper->decoder.rb_table_maps);
+  rbm2_transaction_state_init(&(wrapper->transaction_state));
+  if (rbm2_replication_client_wrapper_open(wrapper, use_gtid) != 0) {
+    return RUBY_Qfalse;
+  }
+  return RUBY_Qtrue;
+}
+
+static VALUE
+rbm2_replication_client_reopen_rescue(VALUE user_data, VALUE error)
+{
+  return RUBY_Qfalse;
+}
+
+/*
+ * Reconnects with backoff when auto_reconnect is enabled and the
+ * connection is lost. Replication is continued from the position
+ * after the last read transaction. Events in an incomplete
+ * transaction are read again.
+ */
+static bool
+rbm2_replication_client_reconnect(rbm2_replication_client_wrapper *wrapper)
+{
+  if (!wrapper->auto_reconnect) {
+    return false;
+  }
+  MYSQL *client = rbm2_replication_client_wrapper_get_client(wrapper);
+  unsigned int error_number = mysql_errno(client);
+  if (!(error_number == CR_SERVER_GONE_ERROR ||
+        error_number == CR_SERVER_LOST)) {
+    return false;
+  }
+  /* All read events are returned before this. */
+  rbm2_replication_client_wrapper_commit_position(wrapper);
+  double interval = wrapper->reconnect_interval;
+  int i;
+  for (i = 0;
+       wrapper->max_reconnect_attempts < 0 ||
+         i < wrapper->max_reconnect_attempts;
+       i++) {
+    rb_thread_wait_for(rb_time_interval(DBL2NUM(interval)));
+    interval *= 2;
+    if (interval > RBM2_MAX_RECONNECT_INTERVAL) {
+      interval = RBM2_MAX_RECONNECT_INTERVAL;
+    }
+    /* Only Mysql2::Error is retried. Interrupt and so on are raised. */
+    VALUE reopened = rb_rescue2(rbm2_replication_client_reopen_body,
+                                (VALUE)wrapper,
+                                rbm2_replication_client_reopen_rescue,
+                                RUBY_Qnil,
+                                rb_eMysql2Error,
+                                (VALUE)0);
+    if (RB_TEST(reopened)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static VALUE
+rbm2_replication_client_wrapper_event_new(
+  rbm2_replication_client_wrapper *wrapper,
+  MARIADB_RPL_EVENT *event,
+  const uint8_t *raw_event,
+  size_t raw_event_size)
+{
+  rbm2_stats *stats = rbm2_stats_get(wrapper->decoder.options.rb_stats);
+  uint64_t start_time_ns = rbm2_monotonic_time_ns();
+  rbm2_stats_count_event(stats, event, raw_event_size);
+  bool use_checksum = rbm2_replication_client_wrapper_use_checksum(wrapper);
+  VALUE rb_event = rbm2_decoder_event_new(&(wrapper->decoder),
+                                          event,
+                                          raw_event,
+                                          raw_event_size,
+                                          use_checksum,
+                                          RUBY_Qnil);
+  if (event->event_type == FORMAT_DESCRIPTION_EVENT) {
+    if (wrapper->decoder.force_disable_use_checksum) {
+      wrapper->rpl->use_checksum = false;
+    } else if (wrapper->binlog_dump_gtid) {
+      /* mariadb_rpl_open() isn't used. */
+      wrapper->rpl->use_checksum =
+        rbm2_format_description_event_use_checksum(raw_event,
+                                                   raw_event_size);
+    }
+  }
+  rbm2_replication_client_wrapper_track_position(wrapper,
+                                                 raw_event,
+                                                 raw_event_size,
+                                                 use_checksum,
+                                                 rb_event);
+  stats->time_with_gvl_ns += rbm2_monotonic_time_ns() - start_time_ns;
+  return rb_event;
+}
+
+/*
+ * Reads the next event. Returns nil at the end. Returns Qundef when
+ * no event is available yet or the event is skipped. raw_event is
+ * NULL when no event is available.
+ */
+static VALUE
+rbm2_replication_client_read(VALUE self,
+                             const uint8_t **raw_event,
+                             size_t *raw_event_size,
+                             bool *use_checksum)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  MYSQL *client = rbm2_replication_client_wrapper_get_client(wrapper);
+  *raw_event = NULL;
+  *raw_event_size = 0;
+  rbm2_replication_client_wrapper_commit_position(wrapper);
+  uint64_t start_time_ns = rbm2_monotonic_time_ns();
+  MARIADB_RPL_EVENT *event =
+    rb_thread_call_without_gvl(rbm2_replication_client_fetch_without_gvl,
+                               wrapper,
+                               RUBY_UBF_IO,
+                               0);
+  rbm2_stats_get(wrapper->decoder.options.rb_stats)->time_without_gvl_ns +=
+    rbm2_monotonic_time_ns() - start_time_ns;
+  rbm2_decode_profile *profile = rbm2_decode_profile_get();
+  if (profile && event) {
+    rbm2_decode_profile_add(&(profile->fetch),
+                            start_time_ns,
+                            1,
+                            wrapper->rpl->buffer_size);
+  }
+  if (mysql_errno(client) != 0) {
+    if (!rbm2_replication_client_reconnect(wrapper)) {
+      rbm2_replication_client_raise(self);
+    }
+    return RUBY_Qundef;
+  }
+  if (!event) {
+    if (wrapper->rpl->buffer_size == 0) {
+      return RUBY_Qnil;
+    }
+    return RUBY_Qundef;
+  }
+  *raw_event = wrapper->rpl->buffer + 1;
+  *raw_event_size = wrapper->rpl->buffer_size - 1;
+  *use_checksum = rbm2_replication_client_wrapper_use_checksum(wrapper);
+  return rbm2_replication_client_wrapper_event_new(wrapper,
+                                                   event,
+                                                   *raw_event,
+                                                   *raw_event_size);
+}
+
+static VALUE
+rbm2_replication_client_fetch(VALUE self)
+{
+  do {
+    const uint8_t *raw_event;
+    size_t raw_event_size;
+    bool use_checksum;
+    VALUE rb_event = rbm2_replication_client_read(self,
+                                                  &raw_event,
+                                                  &raw_event_size,
+                                                  &use_checksum);
+    if (rb_event == RUBY_Qundef) {
+      continue;
+    }
+    return rb_event;
+  } while (true);
+}
+
+static VALUE
+rbm2_replication_client_each(VALUE self)
+{
+  do {
+    const uint8_t *raw_event;
+    size_t raw_event_size;
+    bool use_checksum;
+    VALUE rb_event = rbm2_replication_client_read(self,
+                                                  &raw_event,
+                                                  &raw_event_size,
+                                                  &use_checksum);
+    if (RB_NIL_P(rb_event)) {
+      break;
+    }
+    if (rb_event == RUBY_Qundef) {
+      continue;
+    }
+    rb_yield(rb_event);
+  } while (true);
+  return RUBY_Qnil;
+}
+
+/*
+ * Yields a Mysql2Replication::Transaction for each transaction. See
+ * rbm2_transaction_builder for how events are grouped.
+ */
+static VALUE
+rbm2_replication_client_each_transaction(VALUE self)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  rbm2_transaction_builder builder;
+  rbm2_transaction_builder_reset(&builder);
+  do {
+    const uint8_t *raw_event;
+    size_t raw_event_size;
+    bool use_checksum;
+    VALUE rb_event = rbm2_replication_client_read(self,
+                                                  &raw_event,
+                                                  &raw_event_size,
+                                                  &use_checksum);
+    if (RB_NIL_P(rb_event)) {
+      break;
+    }
+    if (!raw_event) {
+      continue;
+    }
+    VALUE rb_transaction =
+      rbm2_transaction_builder_feed(&builder,
+                                    &(wrapper->decoder),
+                                    raw_event,
+                                    raw_event_size,
+                                    use_checksum,
+                                    rb_event);
+    if (!RB_NIL_P(rb_transaction)) {
+      rb_yield(rb_transaction);
+    }
+  } while (true);
+  RB_GC_GUARD(builder.state.rb_gtid);
+  RB_GC_GUARD(builder.rb_events);
+  return RUBY_Qnil;
+}
+
+static bool
+rbm2_replication_client_wrapper_append_raw_event(
+  rbm2_replication_client_wrapper *wrapper,
+  const uint8_t *raw_event,
+  uint32_t raw_event_size)
+{
+  size_t required_size =
+    wrapper->batch_buffer_size + sizeof(uint32_t) + raw_event_size;
+  if (required_size > wrapper->batch_buffer_capacity) {
+    size_t capacity = wrapper->batch_buffer_capacity * 2;
+    if (capacity < 4096) {
+      capacity = 4096;
+    }
+    if (capacity < required_size) {
+      capacity = required_size;
+    }
+    /* This is called without GVL. We can't use ruby_xrealloc() here. */
+    uint8_t *batch_buffer = realloc(wrapper->batch_buffer, capacity);
+    if (!batch_buffer) {
+      return false;
+    }
+    wrapper->batch_buffer = batch_buffer;
+    wrapper->batch_buffer_capacity = capacity;
+  }
+  memcpy(wrapper->batch_buffer + wrapper->batch_buffer_size,
+         &raw_event_size,
+         sizeof(uint32_t));
+  wrapper->batch_buffer_size += sizeof(uint32_t);
+  memcpy(wrapper->batch_buffer + wrapper->batch_buffer_size,
+         raw_event,
+         raw_event_size);
+  wrapper->batch_buffer_size += raw_event_size;
+  return true;
+}
+
+typedef struct
+{
+  rbm2_replication_client_wrapper *wrapper;
+  MYSQL *client;
+  long max_n_events;
+  size_t max_n_bytes;
+  int timeout;
+  long n_events;
+  size_t n_bytes;
+  bool finished;
+  bool no_memory;
+} rbm2_replication_client_fetch_batch_data;
+
+/*
+ * libmariadb reads ahead from the socket into the pvio cache. Events
+ * in the cache aren't visible to poll(). With TLS, decrypted data is
+ * also read into the cache.
+ */
+static bool
+rbm2_replication_client_has_buffered_data(MYSQL *client)
+{
+#ifdef HAVE_MA_PVIO_H
+  MARIADB_PVIO *pvio = client->net.pvio;
+  if (!pvio || !pvio->cache) {
+    return false;
+  }
+  return pvio->cache + pvio->cache_size > pvio->cache_pos;
+#else
+  return false;
+#endif
+}
+
+static bool
+rbm2_replication_client_fetch_batch_wait(
+  rbm2_replication_client_fetch_batch_data *data)
+{
+  if (rbm2_replication_client_has_buffered_data(data->client)) {
+    return true;
+  }
+#ifdef HAVE_POLL_H
+  struct pollfd poll_fd;
+  poll_fd.fd = mysql_get_socket(data->client);
+  poll_fd.events = POLLIN;
+  poll_fd.revents = 0;
+  return poll(&poll_fd, 1, data->timeout) > 0;
+#else
+  return false;
+#endif
+}
+
+static void *
+rbm2_replication_client_fetch_batch_without_gvl(void *user_data)
+{
+  rbm2_replication_client_fetch_batch_data *data = user_data;
+  rbm2_replication_client_wrapper *wrapper = data->wrapper;
+  wrapper->batch_buffer_size = 0;
+  while (data->n_events < data->max_n_events &&
+         data->n_bytes < data->max_n_bytes) {
+    /* Only the first event may block without timeout. */
+    if (data->n_events > 0 && !rbm2_replication_client_fetch_batch_wait(data)) {
+      break;
+    }
+    wrapper->rpl_event = mariadb_rpl_fetch(wrapper->rpl, wrapper->rpl_event);
+    if (mysql_errno(data->client) != 0) {
+      break;
+    }
+    if (!wrapper->rpl_event) {
+      if (wrapper->rpl->buffer_size == 0) {
+        data->finished = true;
+        break;
+      }
+      continue;
+    }
+    /* Skip the OK packet marker. */
+    const uint8_t *raw_event = wrapper->rpl->buffer + 1;
+    uint32_t raw_event_size = wrapper->rpl->buffer_size - 1;
+    if (!rbm2_replication_client_wrapper_append_raw_event(wrapper,
+                                                          raw_event,
+                                                          raw_event_size)) {
+      data->no_memory = true;
+      break;
+    }
+    data->n_events++;
+    data->n_bytes += raw_event_size;
+    if (wrapper->rpl_event->event_type == FORMAT_DESCRIPTION_EVENT) {
+      /* Checksum usage of the following events may be changed. */
+      break;
+    }
+  }
+  return NULL;
+}
+
+static VALUE
+rbm2_replication_client_fetch_batch_internal(VALUE self,
+                                             long max_n_events,
+                                             size_t max_n_bytes,
+                                             int timeout)
+{
+  rbm2_replication_client_wrapper *wrapper =
+    rbm2_replication_client_get_wrapper(self);
+  rbm2_replication_client_fetch_batch_data data;
+  data.wrapper = wrapper;
+  data.client = rbm2_replication_client_wrapper_get_client(wrapper);
+  data.max_n_events = max_n_events;
+  data.max_n_bytes = max_n_bytes;
+  data.timeout = timeout;
+  data.n_events = 0;
+  data.n_bytes = 0;
+  data.finished = false;
+  data.no_memory = false;
+  rbm2_replication_client_wrapper_commit_position(wrapper);
+  uint64_t start_time_ns = rbm2_monotonic_time_ns();
+  rb_thread_call_without_gvl(rbm2_replication_client_fetch_batch_without_gvl,
+                             &data,
+                             RUBY_UBF_IO,
+                             0);
+  rbm2_stats_get(wrapper->decoder.options.rb_stats)->time_without_gvl_ns +=
+    rbm2_monotonic_time_ns() - start_time_ns;
+  rbm2_decode_profile *profile = rbm2_decode_profile_get();
+  if (profile) {
+    rbm2_decode_profile_add(&(profile->fetch),
+                            start_time_ns,
+                            data.n_events,
+                            data.n_bytes);
+  }
+  if (data.no_memory) {
+    rb_memerror();
+  }
+  bool need_reconnect = false;
+  if (mysql_errno(data.client) != 0) {
+    if (!wrapper->auto_reconnect) {
+      rbm2_replication_client_raise(self);
+    }
+    /* Read events are decoded before reconnect. */
+    need_reconnect = true;
+  }
+  if (data.n_events == 0 && data.finished) {
+    return RUBY_Qnil;
+  }
+
+  VALUE rb_events = rb_ary_new_capa(data.n_events);
+  const uint8_t *raw_events = wrapper->batch_buffer;
+  const uint8_t *raw_events_end = raw_events + wrapper->batch_buffer_size;
+  while (raw_events < raw_events_end) {
+    uint32_t raw_event_size = rbm2_read_uint32(raw_events);
+    raw_events += sizeof(uint32_t);
+    bool use_checksum = rbm2_replication_client_wrapper_use_checksum(wrapper);
+    MARIADB_RPL_EVENT event;
+    if (!rbm2_event_parse(&event, raw_events, raw_event_size, use_checksum)) {
+      rb_raise(rb_eMysql2ReplicationError,
+               "failed to parse event: type: %u: size: %u",
+               raw_event_size > 4 ? raw_events[4] : 0,
+               raw_event_size);
+    }
+    VALUE rb_event =
+      rbm2_replication_client_wrapper_event_new(wrapper,
+                                                &event,
+                                                raw_events,
+                                                raw_event_size);
+    if (rb_event != RUBY_Qundef) {
+      rb_ary_push(rb_events, rb_event);
+    }
+    raw_events += raw_event_size;
+  }
+  if (need_reconnect && !rbm2_replication_client_reconnect(wrapper)) {
+    rbm2_replication_client_raise(self);
+  }
+  return rb_events;
+}
+
+static void
+rbm2_replication_client_fetch_batch_parse_args(int argc,
+                                               VALUE *argv,
+                                               long *max_n_events,
+                                               size_t *max_n_bytes,
+                                               int *timeout)
+{
+  VALUE rb_max_n_events;
+  VALUE rb_options;
+  rb_scan_args(argc, argv, "01:", &rb_max_n_events, &rb_options);
+  *max_n_events = 1000;
+  *max_n_bytes = SIZE_MAX;
+  *timeout = 0;
+  if (!RB_NIL_P(rb_max_n_events)) {
+    *max_n_events = NUM2LONG(rb_max_n_events);
+    if (*max_n_events <= 0) {
+      rb_raise(rb_eArgError,
+               "the max number of events must be positive: %ld",
+               *max_n_events);
+    }
+  }
+  if (!RB_NIL_P(rb_options)) {
+    static ID keyword_ids[2];
+    VALUE keyword_args[2];
+    if (keyword_ids[0] == 0) {
+      CONST_ID(keyword_ids[0], "max_bytes");
+      CONST_ID(keyword_ids[1], "timeout");
+    }
+    rb_get_kwargs(rb_options, keyword_ids, 0, 2, keyword_args);
+    if (keyword_args[0] != RUBY_Qundef && !RB_NIL_P(keyword_args[0])) {
+      *max_n_bytes = NUM2SIZET(keyword_args[0]);
+    }
+    if (keyword_args[1] != RUBY_Qundef && !RB_NIL_P(keyword_args[1])) {
+      /* Seconds to milliseconds */
+      *timeout = (int)(NUM2DBL(keyword_args[1]) * 1000);
+    }
+  }
+}
+
+/*
+ * Fetches up to max_events events at once. The first event is waited
+ * but the following events are fetched only when they are already
+ * available or they are available within timeout seconds. Raw events
+ * are read without GVL and they are decoded with GVL after that.
+ *
+ * Returns nil when there are no more events.
+ */
+static VALUE
+rbm2_replication_client_fetch_batch(int argc, VALUE *argv, VALUE self)
+{
+  long max_n_events;
+  size_t max_n_bytes;
+  int timeout;
+  rbm2_replication_client_fetch_batch_parse_args(argc,
+                                                 argv,
+                                                 &max_n_events,
+                                                 &max_n_bytes,
+                                                 &timeout);
+  return rbm2_replication_client_fetch_batch_internal(self,
+                                                      max_n_events,
+                                                      max_n_bytes,
+                                                      timeout);
+}
+
+static VALUE
+rbm2_replication_client_each_batch(int argc, VALUE *argv, VALUE self)
+{
+  RETURN_ENUMERATOR(self, argc, argv);
+
+  long max_n_events;
+  size_t max_n_bytes;
+  int timeout;
+  rbm2_replication_client_fetch_batch_parse_args(argc,
+                                                 argv,
+                                                 &max_n_events,
+                                                 &max_n_bytes,
+                                                 &timeout);
+  do {
+    VALUE rb_events =
+      rbm2_replication_client_fetch_batch_internal(self,
+                                                   max_n_events,
+                                                   max_n_bytes,
+                                                   timeout);
+    if (RB_NIL_P(rb_events)) {
+      break;
+    }
+    if (RARRAY_LEN(rb_events) > 0) {
+      rb_yield(rb_events);
+    }
+  } while (true);
+  return RUBY_Qnil;
+}
+
+#define RBM2_BINLOG_MAGIC "\xfe" "bin"
+#define RBM2_BINLOG_MAGIC_SIZE 4
+
+typedef struct
+{
+  rbm2_decoder decoder;
+  VALUE rb_path;
+  uint8_t *data;
+  size_t data_size;
+  bool mapped;
+  size_t position;
+  bool use_checksum;
+} rbm2_file_reader;
+
+static void
+rbm2_file_reader_unmap(rbm2_file_reader *reader)
+{
+  if (!reader->data) {
+    return;
+  }
+#ifdef HAVE_SYS_MMAN_H
+  if (reader->mapped) {
+    munmap(reader->data, reader->data_size);
+  } else {
+    free(reader->data);
+  }
+#else
+  free(reader->data);
+#endif
+  reader->data = NULL;
+  reader->data_size = 0;
+  reader->mapped = false;
+}
+
+static void
+rbm2_file_reader_mark(void *data)
+{
+  rbm2_file_reader *reader = data;
+  rbm2_decoder_mark(&(reader->decoder));
+  rb_gc_mark(reader->rb_path);
+}
+
+static void
+rbm2_file_reader_free(void *data)
+{
+  rbm2_file_reader *reader = data;
+  rbm2_file_reader_unmap(reader);
+  ruby_xfree(reader);
+}
+
+static const rb_data_type_t rbm2_file_reader_type = {
+  "Mysql2Replication::FileReader",
+  {
+    rbm2_file_reader_mark,
+    rbm2_file_reader_free,
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE
+rbm2_file_reader_alloc(VALUE klass)
+{
+  rbm2_file_reader *reader;
+  VALUE rb_reader = TypedData_Make_Struct(klass,
+                                          rbm2_file_reader,
+                                          &rbm2_file_reader_type,
+                                          reader);
+  rbm2_decoder_init(&(reader->decoder));
+  reader->rb_path = RUBY_Qnil;
+  reader->data = NULL;
+  reader->data_size = 0;
+  reader->mapped = false;
+  reader->position = 0;
+  reader->use_checksum = false;
+  return rb_reader;
+}
+
+static inline rbm2_file_reader *
+rbm2_file_reader_get(VALUE self)
+{
+  rbm2_file_reader *reader;
+  TypedData_Get_Struct(self,
+                       rbm2_file_reader,
+                       &rbm2_file_reader_type,
+                       reader);
+  return reader;
+}
+
+static void
+rbm2_file_reader_ensure_opened(VALUE self)
+{
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  if (!reader->data) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "file reader is already closed: %+" PRIsVALUE,
+             reader->rb_path);
+  }
+}
+
+static uint32_t rbm2_crc32_table[256];
+
+static void
+rbm2_crc32_init(void)
+{
+  uint32_t i;
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    int j;
+    for (j = 0; j < 8; j++) {
+      crc = (crc & 1) ? (0xedb88320 ^ (crc >> 1)) : (crc >> 1);
+    }
+    rbm2_crc32_table[i] = crc;
+  }
+}
+
+static uint32_t
+rbm2_crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+  size_t i;
+  crc = ~crc;
+  for (i = 0; i < size; i++) {
+    crc = rbm2_crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static bool
+rbm2_event_verify_checksum(const uint8_t *raw_event, size_t raw_event_size)
+{
+  if (raw_event_size < RBM2_EVENT_HEADER_SIZE + RBM2_EVENT_CHECKSUM_SIZE) {
+    return false;
+  }
+  size_t size = raw_event_size - RBM2_EVENT_CHECKSUM_SIZE;
+  uint32_t expected_crc = rbm2_read_uint32(raw_event + size);
+  uint32_t crc = 0;
+  if (raw_event[4] == FORMAT_DESCRIPTION_EVENT) {
+    /*
+      LOG_EVENT_BINLOG_IN_USE_F (0x01) is set while the file is
+      written. The checksum is computed without it.
+    */
+    const size_t flags_offset = RBM2_EVENT_HEADER_SIZE - 2;
+    uint8_t flags[2] = {raw_event[flags_offset] & ~0x01,
+                        raw_event[flags_offset + 1]};
+    crc = rbm2_crc32_update(crc, raw_event, flags_offset);
+    crc = rbm2_crc32_update(crc, flags, sizeof(flags));
+    crc = rbm2_crc32_update(crc,
+                            raw_event + RBM2_EVENT_HEADER_SIZE,
+                            size - RBM2_EVENT_HEADER_SIZE);
+  } else {
+    crc = rbm2_crc32_update(crc, raw_event, size);
+  }
+  return crc == expected_crc;
+}
+
+typedef enum
+{
+  RBM2_FILE_READER_ERROR_NONE,
+  RBM2_FILE_READER_ERROR_SYSTEM,
+  RBM2_FILE_READER_ERROR_NOT_BINLOG,
+  RBM2_FILE_READER_ERROR_INVALID_EVENT,
+  RBM2_FILE_READER_ERROR_CHECKSUM_MISMATCH,
+  RBM2_FILE_READER_ERROR_CANCELED,
+} rbm2_file_reader_error;
+
+/*
+ * Opening a file is processed without GVL: mapping, detecting checksum
+ * usage and optionally scanning all event headers and verifying
+ * checksums. Scanning also faults in the mapped pages.
+ */
+typedef struct
+{
+  rbm2_file_reader *reader;
+  /* A copy of reader->rb_path. Ruby objects can't be used without GVL. */
+  char *path;
+  bool scan;
+  bool verify_checksum;
+  rbm2_file_reader_error error;
+  int error_number;
+  size_t error_position;
+} rbm2_file_reader_task;
+
+typedef struct
+{
+  rbm2_file_reader_task *tasks;
+  long n_tasks;
+  long n_workers;
+  long next_task;
+  volatile bool canceled;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t mutex;
+#endif
+} rbm2_file_reader_tasks;
+
+static void
+rbm2_file_reader_task_init(rbm2_file_reader_task *task,
+                           rbm2_file_reader *reader,
+                           bool scan,
+                           bool verify_checksum)
+{
+  task->reader = reader;
+  task->path = ruby_strdup(RSTRING_PTR(reader->rb_path));
+  task->scan = scan || verify_checksum;
+  task->verify_checksum = verify_checksum;
+  task->error = RBM2_FILE_READER_ERROR_NONE;
+  task->error_number = 0;
+  task->error_position = 0;
+}
+
+static bool
+rbm2_file_reader_task_map(rbm2_file_reader_task *task)
+{
+  rbm2_file_reader *reader = task->reader;
+#ifdef O_CLOEXEC
+  int fd = open(task->path, O_RDONLY | O_CLOEXEC);
+#else
+  int fd = open(task->path, O_RDONLY);
+#endif
+  if (fd < 0) {
+    task->error = RBM2_FILE_READER_ERROR_SYSTEM;
+    task->error_number = errno;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    task->error = RBM2_FILE_READER_ERROR_SYSTEM;
+    task->error_number = errno;
+    close(fd);
+    return false;
+  }
+  size_t size = file_stat.st_size;
+  if (size < RBM2_BINLOG_MAGIC_SIZE) {
+    task->error = RBM2_FILE_READER_ERROR_NOT_BINLOG;
+    close(fd);
+    return false;
+  }
+#ifdef HAVE_SYS_MMAN_H
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    task->error = RBM2_FILE_READER_ERROR_SYSTEM;
+    task->error_number = errno;
+    close(fd);
+    return false;
+  }
+#  ifdef MADV_SEQUENTIAL
+  madvise(data, size, MADV_SEQUENTIAL);
+#  endif
+#  ifdef MADV_WILLNEED
+  if (task->scan) {
+    madvise(data, size, MADV_WILLNEED);
+  }
+#  endif
+  reader->mapped = true;
+#else
+  uint8_t *data = malloc(size);
+  if (!data) {
+    task->error = RBM2_FILE_READER_ERROR_SYSTEM;
+    task->error_number = ENOMEM;
+    close(fd);
+    return false;
+  }
+  size_t read_size = 0;
+  while (read_size < size) {
+    ssize_t result = read(fd, (uint8_t *)data + read_size, size - read_size);
+    if (result <= 0) {
+      task->error = RBM2_FILE_READER_ERROR_SYSTEM;
+      task->error_number = (result == 0) ? EIO : errno;
+      free(data);
+      close(fd);
+      return false;
+    }
+    read_size += result;
+  }
+  reader->mapped = false;
+#endif
+  close(fd);
+  reader->data = data;
+  reader->data_size = size;
+  if (memcmp(reader->data, RBM2_BINLOG_MAGIC, RBM2_BINLOG_MAGIC_SIZE) != 0) {
+    task->error = RBM2_FILE_READER_ERROR_NOT_BINLOG;
+    return false;
+  }
+  return true;
+}
+
+static void
+rbm2_file_reader_task_run(rbm2_file_reader_task *task,
+                          volatile bool *canceled)
+{
+  if (*canceled) {
+    task->error = RBM2_FILE_READER_ERROR_CANCELED;
+    return;
+  }
+  if (!rbm2_file_reader_task_map(task)) {
+    return;
+  }
+
+  rbm2_file_reader *reader = task->reader;
+  reader->position = RBM2_BINLOG_MAGIC_SIZE;
+  /* The first event is FORMAT_DESCRIPTION_EVENT. It's processed here
+   * too so that position= can skip it. */
+  const uint8_t *first_event = reader->data + reader->position;
+  size_t rest_size = reader->data_size - reader->position;
+  if (rest_size >= RBM2_EVENT_HEADER_SIZE &&
+      first_event[4] == FORMAT_DESCRIPTION_EVENT) {
+    uint32_t first_event_size = rbm2_read_uint32(first_event + 9);
+    if (first_event_size <= rest_size) {
+      reader->use_checksum =
+        rbm2_format_description_event_use_checksum(first_event,
+                                                   first_event_size);
+    }
+  }
+  if (!task->scan) {
+    return;
+  }
+
+  bool use_checksum = reader->use_checksum;
+  size_t position = reader->position;
+  while (reader->data_size - position >= RBM2_EVENT_HEADER_SIZE) {
+    if (*canceled) {
+      task->error = RBM2_FILE_READER_ERROR_CANCELED;
+      return;
+    }
+    const uint8_t *raw_event = reader->data + position;
+    uint32_t raw_event_size = rbm2_read_uint32(raw_event + 9);
+    if (raw_event_size < RBM2_EVENT_HEADER_SIZE) {
+      task->error = RBM2_FILE_READER_ERROR_INVALID_EVENT;
+      task->error_position = position;
+      return;
+    }
+    if (raw_event_size > reader->data_size - position) {
+      /* The last event may be still being written. */
+      break;
+    }
+    if (raw_event[4] == FORMAT_DESCRIPTION_EVENT) {
+      use_checksum =
+        rbm2_format_description_event_use_checksum(raw_event,
+                                                   raw_event_size);
+    }
+    if (use_checksum &&
+        task->verify_checksum &&
+        !rbm2_event_verify_checksum(raw_event, raw_event_size)) {
+      task->error = RBM2_FILE_READER_ERROR_CHECKSUM_MISMATCH;
+      task->error_position = position;
+      return;
+    }
+    position += raw_event_size;
+  }
+}
+
+static void
+rbm2_file_reader_task_raise(rbm2_file_reader_task *task)
+{
+  rbm2_file_reader *reader = task->reader;
+  VALUE rb_path = reader->rb_path;
+  rbm2_file_reader_unmap(reader);
+  switch (task->error) {
+  case RBM2_FILE_READER_ERROR_SYSTEM:
+    errno = task->error_number;
+    rb_sys_fail_str(rb_path);
+    break;
+  case RBM2_FILE_READER_ERROR_NOT_BINLOG:
+    rb_raise(rb_eMysql2ReplicationError,
+             "not a binlog file: %+" PRIsVALUE,
+             rb_path);
+    break;
+  case RBM2_FILE_READER_ERROR_INVALID_EVENT:
+    rb_raise(rb_eMysql2ReplicationError,
+             "invalid event size: position: %" PRIsVALUE ": %+" PRIsVALUE,
+             SIZET2NUM(task->error_position),
+             rb_path);
+    break;
+  case RBM2_FILE_READER_ERROR_CHECKSUM_MISMATCH:
+    rb_raise(rb_eMysql2ReplicationError,
+             "checksum mismatch: position: %" PRIsVALUE ": %+" PRIsVALUE,
+             SIZET2NUM(task->error_position),
+             rb_path);
+    break;
+  case RBM2_FILE_READER_ERROR_CANCELED:
+    rb_thread_check_ints();
+    rb_raise(rb_eMysql2ReplicationError,
+             "canceled: %+" PRIsVALUE,
+             rb_path);
+    break;
+  default:
+    break;
+  }
+}
+
+static void *
+rbm2_file_reader_tasks_work(void *user_data)
+{
+  rbm2_file_reader_tasks *tasks = user_data;
+  do {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&(tasks->mutex));
+#endif
+    long i = tasks->next_task++;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&(tasks->mutex));
+#endif
+    if (i >= tasks->n_tasks) {
+      break;
+    }
+    rbm2_file_reader_task_run(&(tasks->tasks[i]), &(tasks->canceled));
+  } while (true);
+  return NULL;
+}
+
+static void *
+rbm2_file_reader_tasks_run_without_gvl(void *user_data)
+{
+  rbm2_file_reader_tasks *tasks = user_data;
+#ifdef HAVE_PTHREAD_H
+  long n_threads = tasks->n_workers;
+  if (n_threads > tasks->n_tasks) {
+    n_threads = tasks->n_tasks;
+  }
+  /* The current thread is also a worker. */
+  n_threads--;
+  pthread_t *threads = NULL;
+  if (n_threads > 0) {
+    threads = malloc(sizeof(pthread_t) * n_threads);
+    if (!threads) {
+      n_threads = 0;
+    }
+  }
+  long n_created_threads = 0;
+  while (n_created_threads < n_threads) {
+    if (pthread_create(&(threads[n_created_threads]),
+                       NULL,
+                       rbm2_file_reader_tasks_work,
+                       tasks) != 0) {
+      break;
+    }
+    n_created_threads++;
+  }
+  rbm2_file_reader_tasks_work(tasks);
+  long i;
+  for (i = 0; i < n_created_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+#else
+  rbm2_file_reader_tasks_work(tasks);
+#endif
+  return NULL;
+}
+
+static void
+rbm2_file_reader_tasks_cancel(void *user_data)
+{
+  rbm2_file_reader_tasks *tasks = user_data;
+  tasks->canceled = true;
+}
+
+/*
+ * Runs tasks on n_workers native threads without GVL. Tasks are
+ * freed. The first failed task in the given order is raised.
+ */
+static void
+rbm2_file_reader_tasks_run(rbm2_file_reader_task *raw_tasks,
+                           long n_tasks,
+                           long n_workers)
+{
+  rbm2_file_reader_tasks tasks;
+  tasks.tasks = raw_tasks;
+  tasks.n_tasks = n_tasks;
+  tasks.n_workers = n_workers;
+  tasks.next_task = 0;
+  tasks.canceled = false;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init(&(tasks.mutex), NULL);
+#endif
+  rb_thread_call_without_gvl(rbm2_file_reader_tasks_run_without_gvl,
+                             &tasks,
+                             rbm2_file_reader_tasks_cancel,
+                             &tasks);
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_destroy(&(tasks.mutex));
+#endif
+
+  long failed_task_index = -1;
+  long i;
+  for (i = 0; i < n_tasks; i++) {
+    rbm2_file_reader_task *task = &(raw_tasks[i]);
+    ruby_xfree(task->path);
+    task->path = NULL;
+    if (failed_task_index == -1 &&
+        task->error != RBM2_FILE_READER_ERROR_NONE) {
+      failed_task_index = i;
+    }
+  }
+  if (failed_task_index == -1) {
+    ruby_xfree(raw_tasks);
+    return;
+  }
+
+  for (i = 0; i < n_tasks; i++) {
+    rbm2_file_reader_unmap(raw_tasks[i].reader);
+  }
+  /* raw_tasks must be freed before raising. */
+  rbm2_file_reader_task failed_task = raw_tasks[failed_task_index];
+  ruby_xfree(raw_tasks);
+  rbm2_file_reader_task_raise(&failed_task);
+}
+
+static void
+rbm2_file_reader_setup(rbm2_file_reader *reader,
+                       VALUE rb_path,
+                       VALUE rb_options,
+                       bool *verify_checksum)
+{
+  /* Lazily decoded rows refer the mapped data. It must not be
+   * replaced. */
+  if (!RB_NIL_P(reader->rb_path)) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "file reader is already initialized: %+" PRIsVALUE,
+             reader->rb_path);
+  }
+  FilePathValue(rb_path);
+  *verify_checksum = false;
+  if (!RB_NIL_P(rb_options)) {
+    rb_options = rb_hash_dup(rb_options);
+    *verify_checksum =
+      RB_TEST(rb_hash_delete(rb_options,
+                             rb_id2sym(rb_intern("verify_checksum"))));
+  }
+  rbm2_decoder_parse_options(&(reader->decoder), rb_options);
+  reader->decoder.options.rb_stats = rbm2_stats_new();
+  reader->rb_path = rb_str_new_frozen(rb_path);
+}
+
+/*
+ * Reads events from a local binlog file. The file is mapped to memory
+ * and events are decoded in place. No server connection is needed.
+ *
+ * All event checksums are verified before the first event is read
+ * with verify_checksum: true.
+ */
+static VALUE
+rbm2_file_reader_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rb_path;
+  VALUE rb_options;
+  rb_scan_args(argc, argv, "10:", &rb_path, &rb_options);
+
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  bool verify_checksum;
+  rbm2_file_reader_setup(reader, rb_path, rb_options, &verify_checksum);
+  rbm2_file_reader_task *tasks = ALLOC_N(rbm2_file_reader_task, 1);
+  rbm2_file_reader_task_init(&(tasks[0]), reader, false, verify_checksum);
+  rbm2_file_reader_tasks_run(tasks, 1, 1);
+  return RUBY_Qnil;
+}
+
+static long
+rbm2_n_processors(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_processors > 0) {
+    return n_processors;
+  }
+#endif
+  return 1;
+}
+
+/*
+ * Opens binlog files concurrently on n_workers native threads (the
+ * number of processors by default). Each file is mapped, its event
+ * headers are scanned (and its checksums are verified with
+ * verify_checksum: true) without GVL.
+ *
+ * Returns FileReaders in the same order as paths. Each FileReader has
+ * its own TABLE_MAP_EVENT state. Events in all files are read in
+ * order by reading the returned FileReaders in order.
+ */
+static VALUE
+rbm2_file_reader_s_open_parallel(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE rb_paths;
+  VALUE rb_options;
+  rb_scan_args(argc, argv, "10:", &rb_paths, &rb_options);
+  rb_paths = rb_convert_type(rb_paths, RUBY_T_ARRAY, "Array", "to_ary");
+
+  long n_workers = rbm2_n_processors();
+  if (!RB_NIL_P(rb_options)) {
+    rb_options = rb_hash_dup(rb_options);
+    VALUE rb_n_workers =
+      rb_hash_delete(rb_options, rb_id2sym(rb_intern("n_workers")));
+    if (!RB_NIL_P(rb_n_workers)) {
+      n_workers = NUM2LONG(rb_n_workers);
+      if (n_workers <= 0) {
+        rb_raise(rb_eArgError,
+                 "the number of workers must be positive: %ld",
+                 n_workers);
+      }
+    }
+  }
+
+  long n_paths = RARRAY_LEN(rb_paths);
+  if ((size_t)n_paths > SIZE_MAX / sizeof(rbm2_file_reader_task)) {
+    rb_raise(rb_eArgError, "too many paths: %ld", n_paths);
+  }
+  VALUE rb_readers = rb_ary_new_capa(n_paths);
+  bool verify_checksum = false;
+  long i;
+  for (i = 0; i < n_paths; i++) {
+    VALUE rb_reader = rb_obj_alloc(klass);
+    rbm2_file_reader_setup(rbm2_file_reader_get(rb_reader),
+                           RARRAY_AREF(rb_paths, i),
+                           rb_options,
+                           &verify_checksum);
+    rb_ary_push(rb_readers, rb_reader);
+  }
+  if (n_paths == 0) {
+    return rb_readers;
+  }
+
+  rbm2_file_reader_task *tasks = ALLOC_N(rbm2_file_reader_task, n_paths);
+  for (i = 0; i < n_paths; i++) {
+    rbm2_file_reader_task_init(&(tasks[i]),
+                               rbm2_file_reader_get(RARRAY_AREF(rb_readers,
+                                                                i)),
+                               true,
+                               verify_checksum);
+  }
+  rbm2_file_reader_tasks_run(tasks, n_paths, n_workers);
+  return rb_readers;
+}
+
+static VALUE
+rbm2_file_reader_get_path(VALUE self)
+{
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  return reader->rb_path;
+}
+
+static VALUE
+rbm2_file_reader_get_position(VALUE self)
+{
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  return SIZET2NUM(reader->position);
+}
+
+/*
+ * The position must be the start of an event. Table maps read before
+ * are discarded.
+ */
+static VALUE
+rbm2_file_reader_set_position(VALUE self, VALUE position)
+{
+  rbm2_file_reader_ensure_opened(self);
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  size_t raw_position = NUM2SIZET(position);
+  if (raw_position < RBM2_BINLOG_MAGIC_SIZE ||
+      raw_position > reader->data_size) {
+    rb_raise(rb_eArgError,
+             "position must be %u..%" PRIsVALUE ": %+" PRIsVALUE,
+             RBM2_BINLOG_MAGIC_SIZE,
+             SIZET2NUM(reader->data_size),
+             position);
+  }
+  reader->position = raw_position;
+  rb_hash_clear(reader->decoder.rb_table_maps);
+  return position;
+}
+
+/*
+ * Reads the next event. Returns nil at the end. Returns Qundef when
+ * the event is skipped.
+ */
+static VALUE
+rbm2_file_reader_read(VALUE self,
+                      const uint8_t **raw_event_output,
+                      size_t *raw_event_size_output)
+{
+  rbm2_file_reader_ensure_opened(self);
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  {
+    size_t rest_size = reader->data_size - reader->position;
+    if (rest_size < RBM2_EVENT_HEADER_SIZE) {
+      return RUBY_Qnil;
+    }
+    const uint8_t *raw_event = reader->data + reader->position;
+    uint32_t raw_event_size = rbm2_read_uint32(raw_event + 9);
+    if (raw_event_size < RBM2_EVENT_HEADER_SIZE) {
+      rb_raise(rb_eMysql2ReplicationError,
+               "invalid event size: %u: position: %" PRIsVALUE,
+               raw_event_size,
+               SIZET2NUM(reader->position));
+    }
+    if (raw_event_size > rest_size) {
+      /* The last event may be still being written. */
+      return RUBY_Qnil;
+    }
+    if (raw_event[4] == FORMAT_DESCRIPTION_EVENT) {
+      reader->use_checksum =
+        rbm2_format_description_event_use_checksum(raw_event,
+                                                   raw_event_size);
+    }
+    MARIADB_RPL_EVENT event;
+    if (!rbm2_event_parse(&event,
+                          raw_event,
+                          raw_event_size,
+                          reader->use_checksum)) {
+      rb_raise(rb_eMysql2ReplicationError,
+               "failed to parse event: type: %u: position: %" PRIsVALUE,
+               raw_event[4],
+               SIZET2NUM(reader->position));
+    }
+    reader->position += raw_event_size;
+    *raw_event_output = raw_event;
+    *raw_event_size_output = raw_event_size;
+    rbm2_stats *stats = rbm2_stats_get(reader->decoder.options.rb_stats);
+    uint64_t start_time_ns = rbm2_monotonic_time_ns();
+    rbm2_stats_count_event(stats, &event, raw_event_size);
+    VALUE rb_event = rbm2_decoder_event_new(&(reader->decoder),
+                                            &event,
+                                            raw_event,
+                                            raw_event_size,
+                                            reader->use_checksum,
+                                            self);
+    stats->time_with_gvl_ns += rbm2_monotonic_time_ns() - start_time_ns;
+    return rb_event;
   }
-  return rb_value;
 }
 
-static inline bool
-rbm2_bitmap_is_set(const uint8_t *bitmap, uint32_t i)
+static VALUE
+rbm2_file_reader_fetch(VALUE self)
 {
-  return (bitmap[i >> 3] >> (i & 0x07)) & 1;
+  do {
+    const uint8_t *raw_event;
+    size_t raw_event_size;
+    VALUE rb_event = rbm2_file_reader_read(self, &raw_event, &raw_event_size);
+    if (rb_event == RUBY_Qundef) {
+      continue;
+    }
+    return rb_event;
+  } while (true);
 }
 
-typedef struct
+static VALUE
+rbm2_file_reader_each(VALUE self)
 {
-  MARIADB_RPL *rpl;
-  MARIADB_RPL_EVENT *rpl_event;
-  VALUE rb_client;
-  VALUE rb_table_maps;
-  bool force_disable_use_checksum;
-  bool format_description_processed;
-} rbm2_replication_client_wrapper;
+  RETURN_ENUMERATOR(self, 0, NULL);
 
-static void
-rbm2_replication_client_mark(void *data)
-{
-  rbm2_replication_client_wrapper *wrapper = data;
-  rb_gc_mark(wrapper->rb_client);
-  rb_gc_mark(wrapper->rb_table_maps);
+  do {
+    VALUE rb_event = rbm2_file_reader_fetch(self);
+    if (RB_NIL_P(rb_event)) {
+      break;
+    }
+    rb_yield(rb_event);
+  } while (true);
+  return self;
 }
 
-static void
-rbm2_replication_client_free(void *data)
+/*
+ * Yields a Mysql2Replication::Transaction for each transaction. See
+ * rbm2_transaction_builder for how events are grouped.
+ */
+static VALUE
+rbm2_file_reader_each_transaction(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper = data;
-  if (wrapper->rpl_event) {
-    mariadb_free_rpl_event(wrapper->rpl_event);
-  }
-  if (wrapper->rpl) {
-    mariadb_rpl_close(wrapper->rpl);
-  }
-  ruby_xfree(wrapper);
-}
+  RETURN_ENUMERATOR(self, 0, NULL);
 
-static const rb_data_type_t rbm2_replication_client_type = {
-  "Mysql2Replication::Client",
-  {
-    rbm2_replication_client_mark,
-    rbm2_replication_client_free,
-  },
-  NULL,
-  NULL,
-  RUBY_TYPED_FREE_IMMEDIATELY,
-};
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  rbm2_transaction_builder builder;
+  rbm2_transaction_builder_reset(&builder);
+  do {
+    const uint8_t *raw_event;
+    size_t raw_event_size;
+    VALUE rb_event = rbm2_file_reader_read(self, &raw_event, &raw_event_size);
+    if (RB_NIL_P(rb_event)) {
+      break;
+    }
+    VALUE rb_transaction =
+      rbm2_transaction_builder_feed(&builder,
+                                    &(reader->decoder),
+                                    raw_event,
+                                    raw_event_size,
+                                    reader->use_checksum,
+                                    rb_event);
+    if (!RB_NIL_P(rb_transaction)) {
+      rb_yield(rb_transaction);
+    }
+  } while (true);
+  RB_GC_GUARD(builder.state.rb_gtid);
+  RB_GC_GUARD(builder.rb_events);
+  return self;
+}
 
+/*
+ * Rows of events read before can't be decoded after this.
+ */
 static VALUE
-rbm2_replication_client_alloc(VALUE klass)
+rbm2_file_reader_close(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper;
-  VALUE rb_wrapper = TypedData_Make_Struct(klass,
-                                           rbm2_replication_client_wrapper,
-                                           &rbm2_replication_client_type,
-                                           wrapper);
-  wrapper->rpl = NULL;
-  wrapper->rpl_event = NULL;
-  wrapper->rb_client = RUBY_Qnil;
-  wrapper->rb_table_maps = rb_hash_new();
-  return rb_wrapper;
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  rbm2_file_reader_unmap(reader);
+  return RUBY_Qnil;
 }
 
-static inline rbm2_replication_client_wrapper *
-rbm2_replication_client_get_wrapper(VALUE self)
+static VALUE
+rbm2_file_reader_closed_p(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper;
-  TypedData_Get_Struct(self,
-                       rbm2_replication_client_wrapper,
-                       &rbm2_replication_client_type,
-                       wrapper);
-  return wrapper;
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  return reader->data ? RUBY_Qfalse : RUBY_Qtrue;
 }
 
-static inline mysql_client_wrapper *
-rbm2_replication_client_wrapper_get_client_wrapper(
-  rbm2_replication_client_wrapper *replication_client_wrapper)
+/*
+ * The same as Client#stats. time_without_gvl is always 0 because
+ * events are read from the mapped file.
+ */
+static VALUE
+rbm2_file_reader_get_stats(VALUE self)
 {
-  GET_CLIENT(replication_client_wrapper->rb_client);
-  return wrapper;
+  rbm2_file_reader *reader = rbm2_file_reader_get(self);
+  return reader->decoder.options.rb_stats;
 }
 
-static inline MYSQL *
-rbm2_replication_client_wrapper_get_client(
-  rbm2_replication_client_wrapper *wrapper)
+static rbm2_decoder *
+rbm2_decoder_get(VALUE self)
 {
-  return rbm2_replication_client_wrapper_get_client_wrapper(wrapper)->client;
+  if (rb_typeddata_is_kind_of(self, &rbm2_file_reader_type)) {
+    return &(rbm2_file_reader_get(self)->decoder);
+  } else {
+    return &(rbm2_replication_client_get_wrapper(self)->decoder);
+  }
 }
 
-static void
-rbm2_replication_client_raise(VALUE self)
+static VALUE
+rbm2_decoder_get_row_format(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  mysql_client_wrapper *client_wrapper =
-    rbm2_replication_client_wrapper_get_client_wrapper(wrapper);
-  VALUE rb_error_message =
-    rb_enc_str_new_cstr(mysql_error(client_wrapper->client),
-                        rb_utf8_encoding());
-  VALUE rb_sql_state =
-    rb_enc_str_new_cstr(mysql_sqlstate(client_wrapper->client),
-                        rb_usascii_encoding());
-  ID new_with_args;
-  CONST_ID(new_with_args, "new_with_args");
-  VALUE rb_error = rb_funcall(rb_eMysql2Error,
-                              new_with_args,
-                              4,
-                              rb_error_message,
-                              LONG2NUM(client_wrapper->server_version),
-                              UINT2NUM(mysql_errno(client_wrapper->client)),
-                              rb_sql_state);
-  rb_exc_raise(rb_error);
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return rbm2_row_format_to_symbol(decoder->options.row_format);
 }
 
 static VALUE
-rbm2_replication_client_initialize(int argc, VALUE *argv, VALUE self)
+rbm2_decoder_set_row_format(VALUE self, VALUE row_format)
 {
-  VALUE rb_client;
-  VALUE rb_options;
-  VALUE rb_checksum = RUBY_Qnil;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->options.row_format = rbm2_row_format_parse(row_format);
+  return row_format;
+}
 
-  rb_scan_args(argc, argv, "10:", &rb_client, &rb_options);
-  if (!RB_NIL_P(rb_options)) {
-    static ID keyword_ids[1];
-    VALUE keyword_args[1];
-    if (keyword_ids[0] == 0) {
-      CONST_ID(keyword_ids[0], "checksum");
-    }
-    rb_get_kwargs(rb_options, keyword_ids, 0, 1, keyword_args);
-    if (keyword_args[0] != RUBY_Qundef) {
-      rb_checksum = keyword_args[0];
-    }
-  }
+static VALUE
+rbm2_decoder_get_decimal_format(VALUE self)
+{
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return rbm2_decimal_format_to_symbol(decoder->options.decimal_format);
+}
 
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  wrapper->rb_client = rb_client;
-  wrapper->rpl =
-    mariadb_rpl_init(rbm2_replication_client_wrapper_get_client(wrapper));
-  if (!wrapper->rpl) {
-    rbm2_replication_client_raise(self);
-  }
+static VALUE
+rbm2_decoder_set_decimal_format(VALUE self, VALUE decimal_format)
+{
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->options.decimal_format = rbm2_decimal_format_parse(decimal_format);
+  return decimal_format;
+}
 
-  {
-    VALUE rb_query;
-    if (RB_NIL_P(rb_checksum)) {
-      rb_query = rb_str_new_cstr("SET @master_binlog_checksum = "
-                                 "@@global.binlog_checksum");
-    } else {
-      rb_query = rb_sprintf("SET @master_binlog_checksum = '%"PRIsVALUE"'",
-                            rb_checksum);
-    }
-    ID id_query;
-    CONST_ID(id_query, "query");
-    rb_funcall(rb_client, id_query, 1, rb_query);
-  }
-  if (rb_equal(rb_str_new_cstr("NONE"), rb_checksum)) {
-    wrapper->force_disable_use_checksum = true;
-  } else {
-    wrapper->force_disable_use_checksum = false;
-  }
-  wrapper->format_description_processed = false;
+static VALUE
+rbm2_decoder_get_time_format(VALUE self)
+{
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return rbm2_time_format_to_symbol(decoder->options.time_format);
+}
 
-  return RUBY_Qnil;
+static VALUE
+rbm2_decoder_set_time_format(VALUE self, VALUE time_format)
+{
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->options.time_format = rbm2_time_format_parse(time_format);
+  return time_format;
 }
 
 static VALUE
-rbm2_replication_client_get_file_name(VALUE self)
+rbm2_decoder_get_json_format(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  const char *file_name;
-  size_t file_name_length;
-  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
-                                        MARIADB_RPL_FILENAME,
-                                        &file_name,
-                                        &file_name_length);
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return rb_str_new(file_name, file_name_length);
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return rbm2_json_format_to_symbol(decoder->options.json_format);
 }
 
 static VALUE
-rbm2_replication_client_set_file_name(VALUE self, VALUE file_name)
+rbm2_decoder_set_json_format(VALUE self, VALUE json_format)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  int result;
-  if (RB_NIL_P(file_name)) {
-    result = mariadb_rpl_optionsv(wrapper->rpl,
-                                  MARIADB_RPL_FILENAME,
-                                  NULL,
-                                  0);
-  } else {
-    result = mariadb_rpl_optionsv(wrapper->rpl,
-                                  MARIADB_RPL_FILENAME,
-                                  RSTRING_PTR(file_name),
-                                  RSTRING_LEN(file_name));
-  }
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return file_name;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->options.json_format = rbm2_json_format_parse(json_format);
+  return json_format;
 }
 
 static VALUE
-rbm2_replication_client_get_start_position(VALUE self)
+rbm2_decoder_get_table_cache_size(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  unsigned long start_position;
-  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
-                                        MARIADB_RPL_START,
-                                        &start_position);
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return ULONG2NUM(start_position);
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return LONG2NUM(decoder->table_cache_size);
 }
 
 static VALUE
-rbm2_replication_client_set_start_position(VALUE self, VALUE start_position)
+rbm2_decoder_set_table_cache_size(VALUE self, VALUE table_cache_size)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  int result = mariadb_rpl_optionsv(wrapper->rpl,
-                                    MARIADB_RPL_START,
-                                    NUM2ULONG(start_position));
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return start_position;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->table_cache_size = NUM2LONG(table_cache_size);
+  rb_hash_clear(decoder->rb_tables);
+  return table_cache_size;
 }
 
 static VALUE
-rbm2_replication_client_get_server_id(VALUE self)
+rbm2_decoder_get_include_tables(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  unsigned int server_id;
-  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
-                                        MARIADB_RPL_SERVER_ID,
-                                        &server_id);
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return UINT2NUM(server_id);
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return rbm2_table_filter_to_patterns(decoder->rb_include_tables);
 }
 
 static VALUE
-rbm2_replication_client_set_server_id(VALUE self, VALUE server_id)
+rbm2_decoder_set_include_tables(VALUE self, VALUE include_tables)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  int result = mariadb_rpl_optionsv(wrapper->rpl,
-                                    MARIADB_RPL_SERVER_ID,
-                                    NUM2UINT(server_id));
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return server_id;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->rb_include_tables = rbm2_table_filter_parse(include_tables);
+  return include_tables;
 }
 
 static VALUE
-rbm2_replication_client_get_flags(VALUE self)
+rbm2_decoder_get_exclude_tables(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  unsigned int flags;
-  int result = mariadb_rpl_get_optionsv(wrapper->rpl,
-                                        MARIADB_RPL_FLAGS,
-                                        &flags);
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return UINT2NUM(flags);
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return rbm2_table_filter_to_patterns(decoder->rb_exclude_tables);
 }
 
 static VALUE
-rbm2_replication_client_set_flags(VALUE self, VALUE flags)
+rbm2_decoder_set_exclude_tables(VALUE self, VALUE exclude_tables)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  int result = mariadb_rpl_optionsv(wrapper->rpl,
-                                    MARIADB_RPL_FLAGS,
-                                    NUM2UINT(flags));
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  return flags;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->rb_exclude_tables = rbm2_table_filter_parse(exclude_tables);
+  return exclude_tables;
 }
 
-static void *
-rbm2_replication_client_close_without_gvl(void *data)
+static VALUE
+rbm2_decoder_skip_filtered_events_p(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper = data;
-  if (wrapper->rpl_event) {
-    mariadb_free_rpl_event(wrapper->rpl_event);
-    wrapper->rpl_event = NULL;
-  }
-  if (wrapper->rpl) {
-    mariadb_rpl_close(wrapper->rpl);
-    wrapper->rpl = NULL;
-  }
-  return NULL;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return decoder->skip_filtered_events ? RUBY_Qtrue : RUBY_Qfalse;
 }
 
 static VALUE
-rbm2_replication_client_close(VALUE self)
+rbm2_decoder_set_skip_filtered_events(VALUE self, VALUE skip_filtered_events)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  rb_thread_call_without_gvl(rbm2_replication_client_close_without_gvl,
-                             wrapper,
-                             RUBY_UBF_IO,
-                             0);
-  return Qnil;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->skip_filtered_events = RB_TEST(skip_filtered_events);
+  return skip_filtered_events;
 }
 
-static void *
-rbm2_replication_client_open_without_gvl(void *data)
+static VALUE
+rbm2_decoder_shareable_p(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper = data;
-  int result = mariadb_rpl_open(wrapper->rpl);
-  return (void *)(intptr_t)result;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return decoder->options.shareable ? RUBY_Qtrue : RUBY_Qfalse;
 }
 
 static VALUE
-rbm2_replication_client_open(VALUE self)
+rbm2_decoder_set_shareable(VALUE self, VALUE shareable)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  int result =
-    (intptr_t)rb_thread_call_without_gvl(
-      rbm2_replication_client_open_without_gvl,
-      wrapper,
-      RUBY_UBF_IO,
-      0);
-  if (result != 0) {
-    rbm2_replication_client_raise(self);
-  }
-  if (rb_block_given_p()) {
-    return rb_ensure(rb_yield, self,
-                     rbm2_replication_client_close, self);
-  } else {
-    return Qnil;
-  }
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->options.shareable = RB_TEST(shareable);
+  return shareable;
 }
 
-static void *
-rbm2_replication_client_fetch_without_gvl(void *data)
+static VALUE
+rbm2_decoder_share_strings_p(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper = data;
-  wrapper->rpl_event = mariadb_rpl_fetch(wrapper->rpl, wrapper->rpl_event);
-  return wrapper->rpl_event;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  return decoder->options.share_strings ? RUBY_Qtrue : RUBY_Qfalse;
 }
 
 static VALUE
-rbm2_row_parse(const uint8_t **row_data,
-               uint32_t n_columns,
-               const uint8_t *column_bitmap,
-               VALUE rb_columns)
+rbm2_decoder_set_share_strings(VALUE self, VALUE share_strings)
 {
-  VALUE rb_row = rb_hash_new();
-  uint32_t i;
-  const uint8_t *row_null_bitmap = *row_data;
-  (*row_data) += (n_columns + 7) / 8;
-  for (i = 0; i < n_columns; i++) {
-    if (!rbm2_bitmap_is_set(column_bitmap, i)) {
-      continue;
-    }
-    if (rbm2_bitmap_is_set(row_null_bitmap, i)) {
-      rb_hash_aset(rb_row, UINT2NUM(i), RUBY_Qnil);
-    } else {
-      VALUE rb_column = RARRAY_PTR(rb_columns)[i];
-      VALUE rb_column_value = rbm2_column_parse(rb_column, row_data);
-      rb_hash_aset(rb_row, UINT2NUM(i), rb_column_value);
-    }
-  }
-  return rb_row;
+  rbm2_decoder *decoder = rbm2_decoder_get(self);
+  decoder->options.share_strings = RB_TEST(share_strings);
+  return share_strings;
 }
 
-typedef struct
+static void
+rbm2_decoder_define_methods(VALUE klass)
 {
-  struct st_mariadb_rpl_rows_event *rows_event;
-  VALUE rb_klass;
-  VALUE rb_rows;
-  VALUE rb_updated_rows;
-  VALUE rb_table_map;
-} rbm2_replication_rows_event_parse_rows_data;
-
-static VALUE
-rbm2_replication_rows_event_parse_rows_body(VALUE user_data)
-{
-  rbm2_replication_rows_event_parse_rows_data *data =
-    (rbm2_replication_rows_event_parse_rows_data *)user_data;
-
-  const uint8_t *column_bitmap =
-    (const uint8_t *)(data->rows_event->column_bitmap);
-  const uint8_t *column_update_bitmap =
-    (const uint8_t *)(data->rows_event->column_update_bitmap);
-  const uint8_t *row_data = data->rows_event->row_data;
-  const uint8_t *row_data_end = row_data + data->rows_event->row_data_size;
-  VALUE rb_columns = rb_iv_get(data->rb_table_map, "@columns");
-  while (row_data < row_data_end) {
-    VALUE rb_row = rbm2_row_parse(&row_data,
-                                  data->rows_event->column_count,
-                                  column_bitmap,
-                                  rb_columns);
-    rb_ary_push(data->rb_rows, rb_row);
-    if (data->rb_klass == rb_cMysql2ReplicationUpdateRowsEvent) {
-      VALUE rb_updated_row = rbm2_row_parse(&row_data,
-                                            data->rows_event->column_count,
-                                            column_update_bitmap,
-                                            rb_columns);
-      rb_ary_push(data->rb_updated_rows, rb_updated_row);
-    }
-  }
-  return RUBY_Qnil;
+  rb_define_method(klass,
+                   "row_format", rbm2_decoder_get_row_format, 0);
+  rb_define_method(klass,
+                   "row_format=", rbm2_decoder_set_row_format, 1);
+  rb_define_method(klass,
+                   "decimal_format", rbm2_decoder_get_decimal_format, 0);
+  rb_define_method(klass,
+                   "decimal_format=", rbm2_decoder_set_decimal_format, 1);
+  rb_define_method(klass,
+                   "time_format", rbm2_decoder_get_time_format, 0);
+  rb_define_method(klass,
+                   "time_format=", rbm2_decoder_set_time_format, 1);
+  rb_define_method(klass,
+                   "json_format", rbm2_decoder_get_json_format, 0);
+  rb_define_method(klass,
+                   "json_format=", rbm2_decoder_set_json_format, 1);
+  rb_define_method(klass,
+                   "table_cache_size", rbm2_decoder_get_table_cache_size, 0);
+  rb_define_method(klass,
+                   "table_cache_size=", rbm2_decoder_set_table_cache_size, 1);
+  rb_define_method(klass,
+                   "include_tables", rbm2_decoder_get_include_tables, 0);
+  rb_define_method(klass,
+                   "include_tables=", rbm2_decoder_set_include_tables, 1);
+  rb_define_method(klass,
+                   "exclude_tables", rbm2_decoder_get_exclude_tables, 0);
+  rb_define_method(klass,
+                   "exclude_tables=", rbm2_decoder_set_exclude_tables, 1);
+  rb_define_method(klass,
+                   "skip_filtered_events?",
+                   rbm2_decoder_skip_filtered_events_p, 0);
+  rb_define_method(klass,
+                   "skip_filtered_events=",
+                   rbm2_decoder_set_skip_filtered_events, 1);
+  rb_define_method(klass,
+                   "shareable?", rbm2_decoder_shareable_p, 0);
+  rb_define_method(klass,
+                   "shareable=", rbm2_decoder_set_shareable, 1);
+  rb_define_method(klass,
+                   "share_strings?", rbm2_decoder_share_strings_p, 0);
+  rb_define_method(klass,
+                   "share_strings=", rbm2_decoder_set_share_strings, 1);
 }
 
 static VALUE
-rbm2_replication_rows_event_parse_rows_rescue(VALUE user_data, VALUE error)
+rbm2_decode_profile_available_p(VALUE self)
 {
-  rbm2_replication_rows_event_parse_rows_data *data =
-    (rbm2_replication_rows_event_parse_rows_data *)user_data;
-  rb_raise(rb_eMysql2ReplicationError,
-           "failed to parse rows: %+" PRIsVALUE ": %+" PRIsVALUE,
-           data->rb_table_map,
-           rb_funcall(error, rb_intern("message"), 0));
-  return RUBY_Qnil;
+#ifdef RBM2_ENABLE_DECODE_PROFILE
+  return RUBY_Qtrue;
+#else
+  return RUBY_Qfalse;
+#endif
 }
 
 static VALUE
-rbm2_replication_event_new(rbm2_replication_client_wrapper *wrapper,
-                           MARIADB_RPL_EVENT *event)
+rbm2_decode_profile_enabled_p(VALUE self)
 {
-  VALUE klass;
-  VALUE rb_event;
-  switch (event->event_type) {
-  case ROTATE_EVENT:
-    klass = rb_cMysql2ReplicationRotateEvent;
-    rb_event = rb_class_new_instance(0, NULL, klass);
-    {
-      struct st_mariadb_rpl_rotate_event *e = &(event->event.rotate);
-      rb_iv_set(rb_event, "@position", ULL2NUM(e->position));
-      size_t filename_size = e->filename.length;
-      if (event->timestamp == 0) {
-        /* Fake ROTATE_EVENT: https://mariadb.com/kb/en/fake-rotate_event/ */
-        if (!wrapper->format_description_processed) {
-          filename_size = wrapper->rpl->buffer_size -
-            EVENT_HEADER_OFS -
-            sizeof(uint64_t); /* position */
-          if (!wrapper->force_disable_use_checksum) {
-            filename_size -= sizeof(uint32_t); /* checksum */
-          }
-        }
-      }
-      rb_iv_set(rb_event,
-                "@file_name",
-                rb_str_new(e->filename.str, filename_size));
-    }
-    break;
-  case FORMAT_DESCRIPTION_EVENT:
-    klass = rb_cMysql2ReplicationFormatDescriptionEvent;
-    rb_event = rb_class_new_instance(0, NULL, klass);
-    {
-      struct st_mariadb_rpl_format_description_event *e =
-        &(event->event.format_description);
-      rb_iv_set(rb_event, "@format", USHORT2NUM(e->format));
-      rb_iv_set(rb_event, "@server_version", rb_str_new_cstr(e->server_version));
-      rb_iv_set(rb_event, "@timestamp", UINT2NUM(e->timestamp));
-      rb_iv_set(rb_event, "@header_length", UINT2NUM(e->header_len));
-    }
-    if (wrapper->force_disable_use_checksum) {
-      wrapper->rpl->use_checksum = false;
-    }
-    wrapper->format_description_processed = true;
-    break;
-  case TABLE_MAP_EVENT:
-    klass = rb_cMysql2ReplicationTableMapEvent;
-    rb_event = rb_class_new_instance(0, NULL, klass);
-    {
-      struct st_mariadb_rpl_table_map_event *e = &(event->event.table_map);
-      VALUE rb_table_id = ULONG2NUM(e->table_id);
-      rb_iv_set(rb_event, "@table_id", rb_table_id);
-      rb_iv_set(rb_event, "@database", rb_str_new(e->database.str,
-                                                  e->database.length));
-      rb_iv_set(rb_event, "@table", rb_str_new(e->table.str,
-                                               e->table.length));
-      {
-        VALUE rb_columns = rb_ary_new_capa(e->column_count);
-        const uint8_t *column_types = (const uint8_t *)(e->column_types.str);
-        const uint8_t *metadata = (const uint8_t *)(e->metadata.str);
-        uint32_t i;
-        for (i = 0; i < e->column_count; i++) {
-          uint8_t column_type = column_types[i];
-          enum enum_field_types real_column_type = column_type;
-          VALUE rb_column = rb_hash_new();
-          rbm2_metadata_parse(&real_column_type,
-                              &metadata,
-                              rb_column);
-          rb_hash_aset(rb_column,
-                       rb_id2sym(rb_intern("type")),
-                       rbm2_column_type_to_symbol(real_column_type));
-          rb_hash_aset(rb_column,
-                       rb_id2sym(rb_intern("type_id")),
-                       UINT2NUM(real_column_type));
-          rb_ary_push(rb_columns, rb_column);
-        }
-        rb_iv_set(rb_event, "@columns", rb_columns);
-      }
-      rb_hash_aset(wrapper->rb_table_maps, rb_table_id, rb_event);
-    }
-    break;
-  case WRITE_ROWS_EVENT_V1:
-  case WRITE_ROWS_EVENT:
-  case UPDATE_ROWS_EVENT_V1:
-  case UPDATE_ROWS_EVENT:
-  case DELETE_ROWS_EVENT_V1:
-  case DELETE_ROWS_EVENT:
-    switch (event->event_type) {
-    case WRITE_ROWS_EVENT_V1:
-    case WRITE_ROWS_EVENT:
-      klass = rb_cMysql2ReplicationWriteRowsEvent;
-      break;
-    case UPDATE_ROWS_EVENT_V1:
-    case UPDATE_ROWS_EVENT:
-      klass = rb_cMysql2ReplicationUpdateRowsEvent;
-      break;
-    default:
-      klass = rb_cMysql2ReplicationDeleteRowsEvent;
-      break;
-    }
-    rb_event = rb_class_new_instance(0, NULL, klass);
-    {
-      struct st_mariadb_rpl_rows_event *e = &(event->event.rows);
-      VALUE rb_table_id = ULONG2NUM(e->table_id);
-      VALUE rb_table_map = rb_hash_aref(wrapper->rb_table_maps, rb_table_id);
-      rb_iv_set(rb_event, "@table_id", rb_table_id);
-      rb_iv_set(rb_event, "@table_map", rb_table_map);
-      rb_iv_set(rb_event, "@rows_flags", USHORT2NUM(e->flags));
-      VALUE rb_rows = rb_ary_new();
-      VALUE rb_updated_rows = RUBY_Qnil;
-      if (klass == rb_cMysql2ReplicationUpdateRowsEvent) {
-        rb_updated_rows = rb_ary_new();
-      }
-      if (!RB_NIL_P(rb_table_map)) {
-        rbm2_replication_rows_event_parse_rows_data data;
-        data.rows_event = e;
-        data.rb_klass = klass;
-        data.rb_rows = rb_rows;
-        data.rb_updated_rows = rb_updated_rows;
-        data.rb_table_map = rb_table_map;
-        rb_rescue(rbm2_replication_rows_event_parse_rows_body, (VALUE)&data,
-                  rbm2_replication_rows_event_parse_rows_rescue, (VALUE)&data);
-      }
-      rb_iv_set(rb_event, "@rows", rb_rows);
-      if (klass == rb_cMysql2ReplicationUpdateRowsEvent) {
-        rb_iv_set(rb_event, "@updated_rows", rb_updated_rows);
-      }
-      if (e->flags & FL_STMT_END) {
-        rb_hash_clear(wrapper->rb_table_maps);
-      }
-    }
-    break;
-  default:
-    klass = rb_cMysql2ReplicationEvent;
-    rb_event = rb_class_new_instance(0, NULL, klass);
-    break;
+  return rbm2_decode_profile_get() ? RUBY_Qtrue : RUBY_Qfalse;
+}
+
+static VALUE
+rbm2_decode_profile_set_enabled(VALUE self, VALUE enabled)
+{
+#ifdef RBM2_ENABLE_DECODE_PROFILE
+  rbm2_decode_profile_state *state =
+    rbm2_decode_profile_state_get(RTEST(enabled));
+  if (state) {
+    state->enabled = RTEST(enabled);
   }
-  rb_iv_set(rb_event, "@type", UINT2NUM(event->event_type));
-  rb_iv_set(rb_event, "@timestamp", UINT2NUM(event->timestamp));
-  rb_iv_set(rb_event, "@server_id", UINT2NUM(event->server_id));
-  rb_iv_set(rb_event, "@length", UINT2NUM(event->event_length));
-  rb_iv_set(rb_event, "@next_position", UINT2NUM(event->next_event_pos));
-  rb_iv_set(rb_event, "@flags", USHORT2NUM(event->flags));
-  return rb_event;
+#else
+  if (RTEST(enabled)) {
+    rb_raise(rb_eMysql2ReplicationError,
+             "decode profile isn't available: "
+             "rebuild without --disable-decode-profile");
+  }
+#endif
+  return enabled;
 }
 
 static VALUE
-rbm2_replication_client_fetch(VALUE self)
+rbm2_decode_profile_reset(VALUE self)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  MYSQL *client = rbm2_replication_client_wrapper_get_client(wrapper);
-  do {
-    MARIADB_RPL_EVENT *event =
-      rb_thread_call_without_gvl(rbm2_replication_client_fetch_without_gvl,
-                                 wrapper,
-                                 RUBY_UBF_IO,
-                                 0);
-    if (mysql_errno(client) != 0) {
-      rbm2_replication_client_raise(self);
-    }
-    if (!event) {
-      if (wrapper->rpl->buffer_size == 0) {
-        return RUBY_Qnil;
-      }
-      continue;
-    }
-    return rbm2_replication_event_new(wrapper, event);
-  } while (true);
+  rbm2_decode_profile_state *state = rbm2_decode_profile_state_get(false);
+  if (state) {
+    memset(&(state->profile), 0, sizeof(state->profile));
+  }
+  return RUBY_Qnil;
 }
 
 static VALUE
-rbm2_replication_client_each(VALUE self)
+rbm2_decode_profile_entry_to_h(const rbm2_decode_profile_entry *entry)
 {
-  rbm2_replication_client_wrapper *wrapper =
-    rbm2_replication_client_get_wrapper(self);
-  MYSQL *client = rbm2_replication_client_wrapper_get_client(wrapper);
-  do {
-    MARIADB_RPL_EVENT *event =
-      rb_thread_call_without_gvl(rbm2_replication_client_fetch_without_gvl,
-                                 wrapper,
-                                 RUBY_UBF_IO,
-                                 0);
-    if (mysql_errno(client) != 0) {
-      rbm2_replication_client_raise(self);
+  VALUE rb_entry = rb_hash_new();
+  rb_hash_aset(rb_entry,
+               rb_id2sym(rb_intern("count")),
+               ULL2NUM(entry->count));
+  rb_hash_aset(rb_entry,
+               rb_id2sym(rb_intern("n_bytes")),
+               ULL2NUM(entry->n_bytes));
+  /* In seconds */
+  rb_hash_aset(rb_entry,
+               rb_id2sym(rb_intern("time")),
+               DBL2NUM(entry->time_ns / 1e9));
+  return rb_entry;
+}
+
+/*
+ * Returns the decode profile as a Hash:
+ *
+ *   {
+ *     fetch: {count:, n_bytes:, time:},
+ *     events: {EVENT_TYPE => {count:, n_bytes:, time:}, ...},
+ *     metadata: {COLUMN_TYPE_SYMBOL => {count:, n_bytes:, time:}, ...},
+ *     columns: {COLUMN_TYPE_SYMBOL => {count:, n_bytes:, time:}, ...},
+ *   }
+ *
+ * fetch is the time waiting for events from the server. Types that
+ * aren't used aren't included.
+ */
+static VALUE
+rbm2_decode_profile_to_h(VALUE self)
+{
+  static const rbm2_decode_profile empty_profile;
+  const rbm2_decode_profile *profile = &empty_profile;
+  rbm2_decode_profile_state *state = rbm2_decode_profile_state_get(false);
+  if (state) {
+    profile = &(state->profile);
+  }
+  VALUE rb_profile = rb_hash_new();
+  const rbm2_decode_profile_entry *fetch = &(profile->fetch);
+  rb_hash_aset(rb_profile,
+               rb_id2sym(rb_intern("fetch")),
+               rbm2_decode_profile_entry_to_h(fetch));
+  VALUE rb_events = rb_hash_new();
+  VALUE rb_metadata = rb_hash_new();
+  VALUE rb_columns = rb_hash_new();
+  int i;
+  for (i = 0; i < 256; i++) {
+    const rbm2_decode_profile_entry *entry;
+    entry = &(profile->events[i]);
+    if (entry->count > 0) {
+      rb_hash_aset(rb_events,
+                   INT2NUM(i),
+                   rbm2_decode_profile_entry_to_h(entry));
     }
-    if (!event) {
-      if (wrapper->rpl->buffer_size == 0) {
-        return RUBY_Qnil;
-      }
-      continue;
+    entry = &(profile->metadata[i]);
+    if (entry->count > 0) {
+      rb_hash_aset(rb_metadata,
+                   rbm2_column_type_to_symbol(i),
+                   rbm2_decode_profile_entry_to_h(entry));
     }
-    rb_yield(rbm2_replication_event_new(wrapper, event));
-  } while (true);
-  return RUBY_Qnil;
+    entry = &(profile->columns[i]);
+    if (entry->count > 0) {
+      rb_hash_aset(rb_columns,
+                   rbm2_column_type_to_symbol(i),
+                   rbm2_decode_profile_entry_to_h(entry));
+    }
+  }
+  rb_hash_aset(rb_profile, rb_id2sym(rb_intern("events")), rb_events);
+  rb_hash_aset(rb_profile, rb_id2sym(rb_intern("metadata")), rb_metadata);
+  rb_hash_aset(rb_profile, rb_id2sym(rb_intern("columns")), rb_columns);
+  return rb_profile;
 }
 
 void
 Init_mysql2_replication(void)
 {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  rb_ext_ractor_safe(true);
+#endif
+
   rb_cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+#ifdef HAVE_RUBY_RACTOR_H
+  rbm2_date_cache_key = rb_ractor_local_storage_value_newkey();
+#  ifdef RBM2_ENABLE_DECODE_PROFILE
+  rbm2_decode_profile_state_key =
+    rb_ractor_local_storage_ptr_newkey(RB_RACTOR_LOCAL_STORAGE_TYPE_FREE);
+#  endif
+#else
+  rbm2_date_cache = rb_hash_new();
+  rb_gc_register_address(&rbm2_date_cache);
+#endif
+
+  rbm2_crc32_init();
+
+  CONST_ID(id_BigDecimal, "BigDecimal");
+  CONST_ID(id_multiply, "*");
+  {
+    uint32_t scale;
+    for (scale = 0; scale <= RBM2_DECIMAL_MAX_SCALE; scale++) {
+      rbm2_decimal_denominators[scale] =
+        rb_funcall(INT2FIX(10), rb_intern("**"), 1, UINT2NUM(scale));
+      rb_gc_register_mark_object(rbm2_decimal_denominators[scale]);
+      rbm2_decimal_scale_factors[scale] =
+        rb_funcall(rb_mKernel,
+                   id_BigDecimal,
+                   1,
+                   rb_sprintf("1e-%u", scale));
+      rb_gc_register_mark_object(rbm2_decimal_scale_factors[scale]);
+    }
+  }
 
   VALUE rb_mMysql2 = rb_const_get(rb_cObject, rb_intern("Mysql2"));
   rb_eMysql2Error = rb_const_get(rb_mMysql2, rb_intern("Error"));
 
   VALUE rb_mMysql2Replication = rb_define_module("Mysql2Replication");
+  rb_define_singleton_method(rb_mMysql2Replication,
+                             "decode_profile_available?",
+                             rbm2_decode_profile_available_p, 0);
+  rb_define_singleton_method(rb_mMysql2Replication,
+                             "decode_profile_enabled?",
+                             rbm2_decode_profile_enabled_p, 0);
+  rb_define_singleton_method(rb_mMysql2Replication,
+                             "decode_profile_enabled=",
+                             rbm2_decode_profile_set_enabled, 1);
+  rb_define_singleton_method(rb_mMysql2Replication,
+                             "decode_profile",
+                             rbm2_decode_profile_to_h, 0);
+  rb_define_singleton_method(rb_mMysql2Replication,
+                             "reset_decode_profile",
+                             rbm2_decode_profile_reset, 0);
   rb_eMysql2ReplicationError =
     rb_define_class_under(rb_mMysql2Replication,
                           "Error",
@@ -1423,41 +8595,82 @@ Init_mysql2_replication(void)
 
   rb_cMysql2ReplicationEvent =
     rb_define_class_under(rb_mMysql2Replication, "Event", rb_cObject);
-  rb_define_attr(rb_cMysql2ReplicationEvent, "type", true, false);
-  rb_define_attr(rb_cMysql2ReplicationEvent, "timestamp", true, false);
-  rb_define_attr(rb_cMysql2ReplicationEvent, "server_id", true, false);
-  rb_define_attr(rb_cMysql2ReplicationEvent, "length", true, false);
-  rb_define_attr(rb_cMysql2ReplicationEvent, "next_position", true, false);
-  rb_define_attr(rb_cMysql2ReplicationEvent, "flags", true, false);
+  /* Events are created only by Client and FileReader. */
+  rb_undef_alloc_func(rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "type", rbm2_replication_event_get_type, 0);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "timestamp", rbm2_replication_event_get_timestamp, 0);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "server_id", rbm2_replication_event_get_server_id, 0);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "length", rbm2_replication_event_get_length, 0);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "next_position",
+                   rbm2_replication_event_get_next_position, 0);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "flags", rbm2_replication_event_get_flags, 0);
+  rb_define_method(rb_cMysql2ReplicationEvent,
+                   "inspect", rbm2_replication_event_inspect, 0);
 
   rb_cMysql2ReplicationRotateEvent =
     rb_define_class_under(rb_mMysql2Replication,
                           "RotateEvent",
                           rb_cMysql2ReplicationEvent);
-  rb_define_attr(rb_cMysql2ReplicationRotateEvent, "position", true, false);
-  rb_define_attr(rb_cMysql2ReplicationRotateEvent, "file_name", true, false);
+  rb_define_method(rb_cMysql2ReplicationRotateEvent,
+                   "position",
+                   rbm2_replication_rotate_event_get_position, 0);
+  rb_define_method(rb_cMysql2ReplicationRotateEvent,
+                   "file_name",
+                   rbm2_replication_rotate_event_get_file_name, 0);
 
   rb_cMysql2ReplicationFormatDescriptionEvent =
     rb_define_class_under(rb_mMysql2Replication,
                           "FormatDescriptionEvent",
                           rb_cMysql2ReplicationEvent);
-  rb_define_attr(rb_cMysql2ReplicationFormatDescriptionEvent,
-                 "format", true, false);
-  rb_define_attr(rb_cMysql2ReplicationFormatDescriptionEvent,
-                 "server_version", true, false);
-  rb_define_attr(rb_cMysql2ReplicationFormatDescriptionEvent,
-                 "timestamp", true, false);
-  rb_define_attr(rb_cMysql2ReplicationFormatDescriptionEvent,
-                 "header_length", true, false);
+  rb_define_method(rb_cMysql2ReplicationFormatDescriptionEvent,
+                   "format",
+                   rbm2_replication_format_description_event_get_format,
+                   0);
+  rb_define_method(
+    rb_cMysql2ReplicationFormatDescriptionEvent,
+    "server_version",
+    rbm2_replication_format_description_event_get_server_version,
+    0);
+  rb_define_method(
+    rb_cMysql2ReplicationFormatDescriptionEvent,
+    "header_length",
+    rbm2_replication_format_description_event_get_header_length,
+    0);
 
   VALUE rb_cMysql2ReplicationRowsEvent =
     rb_define_class_under(rb_mMysql2Replication,
                           "RowsEvent",
                           rb_cMysql2ReplicationEvent);
-  rb_define_attr(rb_cMysql2ReplicationRowsEvent, "table_id", true, false);
-  rb_define_attr(rb_cMysql2ReplicationRowsEvent, "table_map", true, false);
-  rb_define_attr(rb_cMysql2ReplicationRowsEvent, "rows_flags", true, false);
-  rb_define_attr(rb_cMysql2ReplicationRowsEvent, "rows", true, false);
+  rb_define_method(rb_cMysql2ReplicationRowsEvent,
+                   "table_id",
+                   rbm2_replication_rows_event_get_table_id,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationRowsEvent,
+                   "table_map",
+                   rbm2_replication_rows_event_get_table_map,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationRowsEvent,
+                   "rows_flags",
+                   rbm2_replication_rows_event_get_rows_flags,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationRowsEvent,
+                   "rows",
+                   rbm2_replication_rows_event_get_rows,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationRowsEvent,
+                   "each_row",
+                   rbm2_replication_rows_event_each_row,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationRowsEvent,
+                   "columnar",
+                   rbm2_replication_rows_event_columnar,
+                   -1);
   rb_define_method(rb_cMysql2ReplicationRowsEvent,
                    "statement_end?",
                    rbm2_replication_rows_event_statement_end_p,
@@ -1471,8 +8684,10 @@ Init_mysql2_replication(void)
     rb_define_class_under(rb_mMysql2Replication,
                           "UpdateRowsEvent",
                           rb_cMysql2ReplicationRowsEvent);
-  rb_define_attr(rb_cMysql2ReplicationUpdateRowsEvent,
-                 "updated_rows", true, false);
+  rb_define_method(rb_cMysql2ReplicationUpdateRowsEvent,
+                   "updated_rows",
+                   rbm2_replication_update_rows_event_get_updated_rows,
+                   0);
   rb_cMysql2ReplicationDeleteRowsEvent =
     rb_define_class_under(rb_mMysql2Replication,
                           "DeleteRowsEvent",
@@ -1482,10 +8697,148 @@ Init_mysql2_replication(void)
     rb_define_class_under(rb_mMysql2Replication,
                           "TableMapEvent",
                           rb_cMysql2ReplicationEvent);
-  rb_define_attr(rb_cMysql2ReplicationTableMapEvent, "table_id", true, false);
-  rb_define_attr(rb_cMysql2ReplicationTableMapEvent, "database", true, false);
-  rb_define_attr(rb_cMysql2ReplicationTableMapEvent, "table", true, false);
-  rb_define_attr(rb_cMysql2ReplicationTableMapEvent, "columns", true, false);
+  rb_define_method(rb_cMysql2ReplicationTableMapEvent,
+                   "table_id",
+                   rbm2_replication_table_map_event_get_table_id,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationTableMapEvent,
+                   "database",
+                   rbm2_replication_table_map_event_get_database,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationTableMapEvent,
+                   "table",
+                   rbm2_replication_table_map_event_get_table,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationTableMapEvent,
+                   "columns",
+                   rbm2_replication_table_map_event_get_columns,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationTableMapEvent,
+                   "primary_key",
+                   rbm2_replication_table_map_event_get_primary_key,
+                   0);
+  rb_define_method(rb_cMysql2ReplicationTableMapEvent,
+                   "filtered?",
+                   rbm2_replication_table_map_event_filtered_p,
+                   0);
+
+  rb_cMysql2ReplicationGtidEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "GtidEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationGtidEvent,
+                   "gtid", rbm2_replication_gtid_event_get_gtid, 0);
+  rb_define_method(rb_cMysql2ReplicationGtidEvent,
+                   "standalone?",
+                   rbm2_replication_gtid_event_standalone_p, 0);
+
+  rb_cMysql2ReplicationGtidListEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "GtidListEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationGtidListEvent,
+                   "gtids", rbm2_replication_gtid_list_event_get_gtids, 0);
+
+  rb_cMysql2ReplicationPreviousGtidsEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "PreviousGtidsEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationPreviousGtidsEvent,
+                   "gtids", rbm2_replication_gtid_list_event_get_gtids, 0);
+
+  rb_cMysql2ReplicationQueryEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "QueryEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationQueryEvent,
+                   "thread_id", rbm2_replication_query_event_get_thread_id, 0);
+  rb_define_method(rb_cMysql2ReplicationQueryEvent,
+                   "execution_time",
+                   rbm2_replication_query_event_get_execution_time, 0);
+  rb_define_method(rb_cMysql2ReplicationQueryEvent,
+                   "error_code",
+                   rbm2_replication_query_event_get_error_code, 0);
+  rb_define_method(rb_cMysql2ReplicationQueryEvent,
+                   "database", rbm2_replication_query_event_get_database, 0);
+  rb_define_method(rb_cMysql2ReplicationQueryEvent,
+                   "query", rbm2_replication_query_event_get_query, 0);
+
+  rb_cMysql2ReplicationXidEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "XidEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationXidEvent,
+                   "xid", rbm2_replication_xid_event_get_xid, 0);
+
+  /* ANNOTATE_ROWS_EVENT (MariaDB) and ROWS_QUERY_LOG_EVENT (MySQL) */
+  rb_cMysql2ReplicationRowsQueryEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "RowsQueryEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationRowsQueryEvent,
+                   "query", rbm2_replication_rows_query_event_get_query, 0);
+
+  rb_cMysql2ReplicationHeartbeatEvent =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "HeartbeatEvent",
+                          rb_cMysql2ReplicationEvent);
+  rb_define_method(rb_cMysql2ReplicationHeartbeatEvent,
+                   "file_name",
+                   rbm2_replication_heartbeat_event_get_file_name, 0);
+
+  rb_cMysql2ReplicationTransaction =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "Transaction",
+                          rb_cObject);
+  rb_undef_alloc_func(rb_cMysql2ReplicationTransaction);
+  rb_define_method(rb_cMysql2ReplicationTransaction,
+                   "gtid", rbm2_replication_transaction_get_gtid, 0);
+  rb_define_method(rb_cMysql2ReplicationTransaction,
+                   "xid", rbm2_replication_transaction_get_xid, 0);
+  rb_define_method(rb_cMysql2ReplicationTransaction,
+                   "timestamp",
+                   rbm2_replication_transaction_get_timestamp, 0);
+  rb_define_method(rb_cMysql2ReplicationTransaction,
+                   "next_position",
+                   rbm2_replication_transaction_get_next_position, 0);
+  rb_define_method(rb_cMysql2ReplicationTransaction,
+                   "events", rbm2_replication_transaction_get_events, 0);
+  rb_define_method(rb_cMysql2ReplicationTransaction,
+                   "inspect", rbm2_replication_transaction_inspect, 0);
+
+  rb_cMysql2ReplicationStats =
+    rb_define_class_under(rb_mMysql2Replication, "Stats", rb_cObject);
+  rb_undef_alloc_func(rb_cMysql2ReplicationStats);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "n_events", rbm2_replication_stats_get_n_events, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "n_bytes", rbm2_replication_stats_get_n_bytes, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "n_decoded_rows",
+                   rbm2_replication_stats_get_n_decoded_rows, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "lag", rbm2_replication_stats_get_lag, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "elapsed_time",
+                   rbm2_replication_stats_get_elapsed_time, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "events_per_second",
+                   rbm2_replication_stats_get_events_per_second, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "bytes_per_second",
+                   rbm2_replication_stats_get_bytes_per_second, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "time_with_gvl",
+                   rbm2_replication_stats_get_time_with_gvl, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "time_without_gvl",
+                   rbm2_replication_stats_get_time_without_gvl, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "reset", rbm2_replication_stats_reset, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "to_h", rbm2_replication_stats_to_h, 0);
+  rb_define_method(rb_cMysql2ReplicationStats,
+                   "inspect", rbm2_replication_stats_inspect, 0);
 
   VALUE rb_cMysql2ReplicationClient =
     rb_define_class_under(rb_mMysql2Replication,
@@ -1507,6 +8860,42 @@ Init_mysql2_replication(void)
   rb_define_method(rb_cMysql2ReplicationClient,
                    "start_position=",
                    rbm2_replication_client_set_start_position, 1);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "auto_reconnect?",
+                   rbm2_replication_client_auto_reconnect_p, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "auto_reconnect=",
+                   rbm2_replication_client_set_auto_reconnect, 1);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "max_reconnect_attempts",
+                   rbm2_replication_client_get_max_reconnect_attempts, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "max_reconnect_attempts=",
+                   rbm2_replication_client_set_max_reconnect_attempts, 1);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "reconnect_interval",
+                   rbm2_replication_client_get_reconnect_interval, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "reconnect_interval=",
+                   rbm2_replication_client_set_reconnect_interval, 1);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "current_file_name",
+                   rbm2_replication_client_get_current_file_name, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "current_position",
+                   rbm2_replication_client_get_current_position, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "heartbeat_period",
+                   rbm2_replication_client_get_heartbeat_period, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "heartbeat_period=",
+                   rbm2_replication_client_set_heartbeat_period, 1);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "stats", rbm2_replication_client_get_stats, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "gtid", rbm2_replication_client_get_gtid, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "gtid=", rbm2_replication_client_set_gtid, 1);
   rb_define_method(rb_cMysql2ReplicationClient,
                    "server_id", rbm2_replication_client_get_server_id, 0);
   rb_define_method(rb_cMysql2ReplicationClient,
@@ -1515,6 +8904,7 @@ Init_mysql2_replication(void)
                    "flags", rbm2_replication_client_get_flags, 0);
   rb_define_method(rb_cMysql2ReplicationClient,
                    "flags=", rbm2_replication_client_set_flags, 1);
+  rbm2_decoder_define_methods(rb_cMysql2ReplicationClient);
 
   rb_define_method(rb_cMysql2ReplicationClient,
                    "open", rbm2_replication_client_open, 0);
@@ -1525,6 +8915,48 @@ Init_mysql2_replication(void)
 
   rb_define_method(rb_cMysql2ReplicationClient,
                    "each", rbm2_replication_client_each, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "each_transaction",
+                   rbm2_replication_client_each_transaction, 0);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "fetch_batch", rbm2_replication_client_fetch_batch, -1);
+  rb_define_method(rb_cMysql2ReplicationClient,
+                   "each_batch", rbm2_replication_client_each_batch, -1);
+
+  VALUE rb_cMysql2ReplicationFileReader =
+    rb_define_class_under(rb_mMysql2Replication,
+                          "FileReader",
+                          rb_cObject);
+  rb_define_alloc_func(rb_cMysql2ReplicationFileReader,
+                       rbm2_file_reader_alloc);
+  rb_include_module(rb_cMysql2ReplicationFileReader, rb_mEnumerable);
+
+  rb_define_singleton_method(rb_cMysql2ReplicationFileReader,
+                             "open_parallel",
+                             rbm2_file_reader_s_open_parallel,
+                             -1);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "initialize", rbm2_file_reader_initialize, -1);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "path", rbm2_file_reader_get_path, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "position", rbm2_file_reader_get_position, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "position=", rbm2_file_reader_set_position, 1);
+  rbm2_decoder_define_methods(rb_cMysql2ReplicationFileReader);
+
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "fetch", rbm2_file_reader_fetch, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "each", rbm2_file_reader_each, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "each_transaction", rbm2_file_reader_each_transaction, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "close", rbm2_file_reader_close, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "closed?", rbm2_file_reader_closed_p, 0);
+  rb_define_method(rb_cMysql2ReplicationFileReader,
+                   "stats", rbm2_file_reader_get_stats, 0);
 
   VALUE rb_cMysql2ReplicationFlags =
     rb_define_module_under(rb_mMysql2Replication, "Flags");
@@ -0,0 +1,71 @@
+require "socket"
+
+# A TCP proxy in front of a MySQL server. It emulates a lost
+# connection: the first connection that receives cut_data from the
+# server is closed in the middle of cut_data. Other connections are
+# just forwarded.
+class FaultInjectionProxy
+  attr_reader :port
+  attr_reader :n_connections
+
+  def initialize(host, port, cut_data)
+    @host = host
+    @server_port = port
+    @cut_data = cut_data.b
+    @cut = false
+    @n_connections = 0
+    @server = TCPServer.new("127.0.0.1", 0)
+    @port = @server.addr[1]
+    @threads = []
+    @accept_thread = Thread.new {accept}
+  end
+
+  def cut?
+    @cut
+  end
+
+  def close
+    @server.close
+    @accept_thread.join
+    @threads.each(&:kill)
+    @threads.each(&:join)
+  end
+
+  private
+  def accept
+    loop do
+      client = @server.accept
+      @n_connections += 1
+      server = TCPSocket.new(@host, @server_port)
+      @threads << Thread.new {forward(client, server, false)}
+      @threads << Thread.new {forward(server, client, true)}
+    end
+  rescue IOError
+    # Closed.
+  end
+
+  def forward(input, output, inject)
+    tail = "".b
+    loop do
+      data = input.readpartial(4096)
+      if inject and not @cut
+        buffer = tail + data
+        index = buffer.index(@cut_data)
+        if index
+          @cut = true
+          n_bytes = index + @cut_data.bytesize / 2 - tail.bytesize
+          output.write(data.byteslice(0, n_bytes)) if n_bytes > 0
+          break
+        end
+        tail_size = [buffer.bytesize, @cut_data.bytesize - 1].min
+        tail = buffer.byteslice(buffer.bytesize - tail_size, tail_size)
+      end
+      output.write(data)
+    end
+  rescue IOError, SystemCallError
+    # Closed by the other side.
+  ensure
+    input.close unless input.closed?
+    output.close unless output.closed?
+  end
+end
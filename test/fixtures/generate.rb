@@ -0,0 +1,741 @@
+#!/usr/bin/env ruby
+#
+# Generates small binlog fixtures for tests that don't need a server.
+#
+#   ruby test/fixtures/generate.rb
+#
+# mysql-8.0.binlog is the same as the binlog written by MySQL 8.0.27
+# with binlog_format=ROW, binlog_row_metadata=FULL and
+# binlog_checksum=CRC32 for the following SQL:
+#
+#   CREATE TABLE test.items (
+#     id INT UNSIGNED PRIMARY KEY,
+#     price DECIMAL(10, 2),
+#     amount DECIMAL(30, 10),
+#     duration TIME(3),
+#     created_at DATETIME(6),
+#     document JSON,
+#     name VARCHAR(64) CHARACTER SET utf8mb4 COLLATE utf8mb4_general_ci,
+#     legacy_name VARCHAR(32) CHARACTER SET latin1,
+#     counter BIGINT UNSIGNED,
+#     delta TINYINT
+#   );
+#   INSERT INTO test.items VALUES
+#     (1, 123.45, 12345678901234567890.0123456789, '01:02:03.456',
+#      '2022-01-18 12:34:56.789012', '{"a": 1, "b": [true, null, "x"]}',
+#      'こんにちは', 'café', 18446744073709551615, -1),
+#     (2, -123.45, -1.0000000001, '-00:00:01.500',
+#      NULL, '[1.5, -2]', 'abc', NULL, 0, 127);
+#   UPDATE test.items SET counter = 1 WHERE id = 2;
+#   SET sql_mode = '';
+#   INSERT INTO test.items (id, created_at)
+#     VALUES (3, '0000-00-00 00:00:00');
+#
+# mysql-8.0-2.binlog is binlog.000002 that follows mysql-8.0.binlog:
+#
+#   -- A rows event for test.items without its TABLE_MAP_EVENT. Its
+#   -- TABLE_MAP_EVENT is only in mysql-8.0.binlog.
+#   CREATE TABLE test.numbers (
+#     id INT PRIMARY KEY,
+#     small SMALLINT UNSIGNED,
+#     medium MEDIUMINT,
+#     big BIGINT,
+#     ratio FLOAT,
+#     score DOUBLE,
+#     born YEAR,
+#     label VARCHAR(16) CHARACTER SET utf8mb4 COLLATE utf8mb4_general_ci
+#   );
+#   INSERT INTO test.numbers VALUES
+#     (1, 65535, -8388608, -9223372036854775808, 1.5, -2.25, 2022, 'one'),
+#     (2, NULL, 8388607, 9223372036854775807, NULL, 0.5, NULL, NULL),
+#     (3, 0, 0, 0, -0.5, 1e100, 1901, 'three');
+#   CREATE TABLE test.logs (
+#     id INT PRIMARY KEY,
+#     body TEXT CHARACTER SET utf8mb4 COLLATE utf8mb4_general_ci,
+#     created_on DATE,
+#     flags BIT(10),
+#     code CHAR(4) CHARACTER SET utf8mb4 COLLATE utf8mb4_general_ci,
+#     updated_at TIMESTAMP
+#   );
+#   INSERT INTO test.logs VALUES
+#     (1, 'hello', '2022-01-18', b'0100000001', 'ab', '2022-01-18 12:34:56');
+#   SET sql_mode = '';
+#   INSERT INTO test.logs (id, created_on, updated_at)
+#     VALUES (2, '0000-00-00', '0000-00-00 00:00:00');
+#   SET binlog_row_image = 'MINIMAL';
+#   UPDATE test.numbers SET big = 42, score = NULL WHERE id = 2;
+#   ALTER TABLE test.numbers
+#     ADD COLUMN note VARCHAR(8)
+#       CHARACTER SET utf8mb4 COLLATE utf8mb4_general_ci;
+#   INSERT INTO test.numbers (id, note) VALUES (4, 'new');
+#
+# DDL events are omitted.
+
+require "zlib"
+
+class BinlogWriter
+  MAGIC = "\xfebin".b
+
+  QUERY_EVENT = 2
+  ROTATE_EVENT = 4
+  FORMAT_DESCRIPTION_EVENT = 15
+  XID_EVENT = 16
+  TABLE_MAP_EVENT = 19
+  WRITE_ROWS_EVENT = 30
+  UPDATE_ROWS_EVENT = 31
+  GTID_LOG_EVENT = 33
+  PREVIOUS_GTIDS_LOG_EVENT = 35
+
+  HEADER_SIZE = 19
+  CHECKSUM_SIZE = 4
+
+  SERVER_ID = 1
+  SID = ["3E11FA4771CA11E19E33C80AA9429562"].pack("H*")
+
+  def initialize
+    @data = MAGIC.dup
+    @timestamp = 1642509296
+  end
+
+  def to_s
+    @data
+  end
+
+  def add_event(type, body)
+    size = HEADER_SIZE + body.bytesize + CHECKSUM_SIZE
+    next_position = @data.bytesize + size
+    event = [
+      @timestamp,
+      type,
+      SERVER_ID,
+      size,
+      next_position,
+      0,
+    ].pack("VCVVVv")
+    event << body
+    event << [Zlib.crc32(event)].pack("V")
+    @data << event
+  end
+
+  def add_format_description
+    body = [4].pack("v")
+    body << ["8.0.27"].pack("a50")
+    body << [0].pack("V")
+    body << [HEADER_SIZE].pack("C")
+    # Post header lengths of MySQL 8.0.27
+    body << [
+      56, 13, 0, 8, 0, 18, 0, 4, 4, 4, 4, 18, 0, 0, 95, 0, 4, 26,
+      8, 0, 0, 0, 8, 8, 8, 2, 0, 0, 0, 10, 10, 10, 42, 42, 0, 18,
+      52, 0, 10, 40, 0,
+    ].pack("C*")
+    # CRC32
+    body << [1].pack("C")
+    add_event(FORMAT_DESCRIPTION_EVENT, body)
+  end
+
+  def add_previous_gtids(last_gno)
+    body = [1].pack("Q<")
+    body << SID
+    body << [1, 1, last_gno + 1].pack("Q<Q<Q<")
+    add_event(PREVIOUS_GTIDS_LOG_EVENT, body)
+  end
+
+  def add_gtid(gno)
+    body = [1].pack("C")
+    body << SID
+    body << [gno].pack("Q<")
+    # Logical timestamps
+    body << [2, gno - 1, gno].pack("CQ<Q<")
+    # immediate_commit_timestamp
+    body << [@timestamp * 1_000_000].pack("Q<")[0, 7]
+    # transaction_length
+    body << [0].pack("C")
+    # immediate_server_version
+    body << [80027].pack("V")
+    add_event(GTID_LOG_EVENT, body)
+  end
+
+  def add_query(database, query)
+    status_variables = [
+      # Q_FLAGS2_CODE
+      0, 0,
+      # Q_SQL_MODE_CODE
+      1, 0,
+      # Q_CHARSET_CODE: utf8mb4_0900_ai_ci
+      4, 255, 255, 255,
+    ].pack("CVCQ<Cv3")
+    body = [
+      10,
+      0,
+      database.bytesize,
+      0,
+      status_variables.bytesize,
+    ].pack("VVCvv")
+    body << status_variables
+    body << database << "\0"
+    body << query
+    add_event(QUERY_EVENT, body)
+  end
+
+  def add_table_map(table_id, database, table, columns)
+    body = [table_id].pack("Q<")[0, 6]
+    body << [1].pack("v")
+    body << [database.bytesize].pack("C") << database << "\0"
+    body << [table.bytesize].pack("C") << table << "\0"
+    body << packed_integer(columns.size)
+    body << columns.collect {|column| column[:type]}.pack("C*")
+    metadata = columns.collect {|column| column[:metadata]}.join
+    body << packed_integer(metadata.bytesize) << metadata
+    body << bitmap(columns.collect {|column| column[:nullable]})
+    body << optional_metadata(columns)
+    add_event(TABLE_MAP_EVENT, body)
+  end
+
+  def add_write_rows(table_id, n_columns, rows, columns: nil)
+    body = rows_header(table_id, n_columns, columns)
+    rows.each do |row|
+      body << row
+    end
+    add_event(WRITE_ROWS_EVENT, body)
+  end
+
+  def add_update_rows(table_id,
+                      n_columns,
+                      row_pairs,
+                      columns: nil,
+                      updated_columns: nil)
+    body = rows_header(table_id, n_columns, columns)
+    body << bitmap(updated_columns || [true] * n_columns)
+    row_pairs.each do |before, after|
+      body << before << after
+    end
+    add_event(UPDATE_ROWS_EVENT, body)
+  end
+
+  def add_xid(xid)
+    add_event(XID_EVENT, [xid].pack("Q<"))
+  end
+
+  def add_rotate(file_name)
+    add_event(ROTATE_EVENT, [4].pack("Q<") + file_name)
+  end
+
+  def packed_integer(value)
+    if value < 251
+      [value].pack("C")
+    elsif value < (1 << 16)
+      [0xfc, value].pack("Cv")
+    else
+      [0xfd].pack("C") + [value].pack("V")[0, 3]
+    end
+  end
+
+  def bitmap(bits)
+    bytes = Array.new((bits.size + 7) / 8, 0)
+    bits.each_with_index do |bit, i|
+      bytes[i / 8] |= (1 << (i % 8)) if bit
+    end
+    bytes.pack("C*")
+  end
+
+  private
+  def rows_header(table_id, n_columns, columns)
+    header = [table_id].pack("Q<")[0, 6]
+    # STMT_END_F
+    header << [1].pack("v")
+    # The extra data length includes the length itself.
+    header << [2].pack("v")
+    header << packed_integer(n_columns)
+    header << bitmap(columns || [true] * n_columns)
+    header
+  end
+
+  def optional_metadata(columns)
+    fields = "".b
+    numeric_columns = columns.select {|column| column[:numeric]}
+    signedness = bitmap_msb(numeric_columns.collect {|column| column[:unsigned]})
+    fields << optional_metadata_field(1, signedness)
+    character_columns = columns.select {|column| column[:collation_id]}
+    default_collation_id = character_columns.first[:collation_id]
+    default_charset = packed_integer(default_collation_id)
+    character_columns.each_with_index do |column, i|
+      next if column[:collation_id] == default_collation_id
+      default_charset << packed_integer(i)
+      default_charset << packed_integer(column[:collation_id])
+    end
+    fields << optional_metadata_field(2, default_charset)
+    names = columns.collect do |column|
+      packed_integer(column[:name].bytesize) + column[:name]
+    end
+    fields << optional_metadata_field(4, names.join)
+    primary_key = columns.each_index.select do |i|
+      columns[i][:primary_key]
+    end
+    fields << optional_metadata_field(8,
+                                      primary_key.collect {|i| packed_integer(i)}.join)
+    fields
+  end
+
+  def optional_metadata_field(type, value)
+    [type].pack("C") + packed_integer(value.bytesize) + value
+  end
+
+  def bitmap_msb(bits)
+    bytes = Array.new((bits.size + 7) / 8, 0)
+    bits.each_with_index do |bit, i|
+      bytes[i / 8] |= (0x80 >> (i % 8)) if bit
+    end
+    bytes.pack("C*")
+  end
+end
+
+module Values
+  module_function
+
+  DIGITS_TO_BYTES = [0, 1, 1, 2, 2, 3, 3, 4, 4, 4]
+
+  def decimal(value, precision, scale)
+    negative = value.start_with?("-")
+    integral, fractional = value.delete("-").split(".")
+    fractional = (fractional || "").ljust(scale, "0")
+    integral = integral.rjust(precision - scale, "0")
+    groups = []
+    leading_size = (precision - scale) % 9
+    if leading_size > 0
+      groups << [integral[0, leading_size], DIGITS_TO_BYTES[leading_size]]
+    end
+    integral[leading_size..-1].scan(/\d{9}/) do |group|
+      groups << [group, 4]
+    end
+    fractional.scan(/\d{9}/) do |group|
+      groups << [group, 4]
+    end
+    trailing_size = scale % 9
+    if trailing_size > 0
+      groups << [fractional[-trailing_size..-1], DIGITS_TO_BYTES[trailing_size]]
+    end
+    bytes = groups.collect do |group, size|
+      [group.to_i].pack("N")[-size..-1]
+    end.join.bytes
+    bytes = bytes.collect {|byte| ~byte & 0xff} if negative
+    bytes[0] ^= 0x80
+    bytes.pack("C*")
+  end
+
+  # TIME(3)
+  def time2_3(negative, hour, minute, second, microsecond)
+    hms = (hour << 12) | (minute << 6) | second
+    packed = (hms << 24) + microsecond
+    packed = -packed if negative
+    integer_part = packed >> 24
+    fractional_part = packed.remainder(1 << 24) / 100
+    [integer_part + 0x800000].pack("N")[1, 3] +
+      [fractional_part & 0xffff].pack("n")
+  end
+
+  # DATETIME(6)
+  def datetime2_6(year, month, day, hour, minute, second, microsecond)
+    ymd = (((year * 13) + month) << 5) | day
+    hms = (hour << 12) | (minute << 6) | second
+    integer_part = ((ymd << 17) | hms) + 0x8000000000
+    [integer_part].pack("Q>")[3, 5] + [microsecond].pack("N")[1, 3]
+  end
+
+  def json(binary)
+    [binary.bytesize].pack("V") + binary
+  end
+
+  def varchar(value, max_length)
+    value = value.b
+    if max_length > 255
+      [value.bytesize].pack("v") + value
+    else
+      [value.bytesize].pack("C") + value
+    end
+  end
+end
+
+columns = [
+  {
+    name: "id",
+    type: 3, # LONG
+    metadata: "",
+    numeric: true,
+    unsigned: true,
+    primary_key: true,
+  },
+  {
+    name: "price",
+    type: 246, # NEWDECIMAL
+    metadata: [10, 2].pack("CC"),
+    numeric: true,
+    nullable: true,
+  },
+  {
+    name: "amount",
+    type: 246, # NEWDECIMAL
+    metadata: [30, 10].pack("CC"),
+    numeric: true,
+    nullable: true,
+  },
+  {
+    name: "duration",
+    type: 19, # TIME2
+    metadata: [3].pack("C"),
+    nullable: true,
+  },
+  {
+    name: "created_at",
+    type: 18, # DATETIME2
+    metadata: [6].pack("C"),
+    nullable: true,
+  },
+  {
+    name: "document",
+    type: 245, # JSON
+    metadata: [4].pack("C"),
+    nullable: true,
+  },
+  {
+    name: "name",
+    type: 15, # VARCHAR
+    metadata: [256].pack("v"),
+    nullable: true,
+    collation_id: 45, # utf8mb4_general_ci
+  },
+  {
+    name: "legacy_name",
+    type: 15, # VARCHAR
+    metadata: [32].pack("v"),
+    nullable: true,
+    collation_id: 8, # latin1_swedish_ci
+  },
+  {
+    name: "counter",
+    type: 8, # LONGLONG
+    metadata: "",
+    numeric: true,
+    unsigned: true,
+    nullable: true,
+  },
+  {
+    name: "delta",
+    type: 1, # TINY
+    metadata: "",
+    numeric: true,
+    nullable: true,
+  },
+]
+columns.each do |column|
+  column[:metadata] = column[:metadata].b
+  column[:name] = column[:name].b
+end
+
+# {"a": 1, "b": [true, null, "x"]}
+json_object = [
+  0x00, # small object
+  2, 35,
+  # keys: "a", "b"
+  18, 1,
+  19, 1,
+  # values: 1 (int16), [...] (small array)
+  0x05, 1,
+  0x02, 20,
+].pack("Cvvvvvv" + "CvCv")
+json_object << "ab"
+json_object << [
+  3, 15,
+  # true, null, "x"
+  0x04, 0x01,
+  0x04, 0x00,
+  0x0c, 13,
+].pack("vv" + "Cv" * 3)
+json_object << [1].pack("C") << "x"
+# [1.5, -2]
+json_array = [
+  0x02, # small array
+  2, 18,
+  0x0b, 10,
+  0x05, -2,
+].pack("Cvv" + "Cv" + "Cs<")
+json_array << [1.5].pack("E")
+
+writer = BinlogWriter.new
+n_columns = columns.size
+
+row1 = writer.bitmap([false] * n_columns)
+row1 << [1].pack("V")
+row1 << Values.decimal("123.45", 10, 2)
+row1 << Values.decimal("12345678901234567890.0123456789", 30, 10)
+row1 << Values.time2_3(false, 1, 2, 3, 456000)
+row1 << Values.datetime2_6(2022, 1, 18, 12, 34, 56, 789012)
+row1 << Values.json(json_object)
+row1 << Values.varchar("こんにちは", 256)
+row1 << Values.varchar("caf\xE9".b, 32)
+row1 << [18446744073709551615].pack("Q<")
+row1 << [-1].pack("c")
+
+row2 = lambda do |counter|
+  row = writer.bitmap((0...n_columns).collect {|i| i == 4 or i == 7})
+  row << [2].pack("V")
+  row << Values.decimal("-123.45", 10, 2)
+  row << Values.decimal("-1.0000000001", 30, 10)
+  row << Values.time2_3(true, 0, 0, 1, 500000)
+  row << Values.json(json_array)
+  row << Values.varchar("abc", 256)
+  row << [counter].pack("Q<")
+  row << [127].pack("c")
+  row
+end
+
+row3 = writer.bitmap((0...n_columns).collect {|i| not [0, 4].include?(i)})
+row3 << [3].pack("V")
+row3 << Values.datetime2_6(0, 0, 0, 0, 0, 0, 0)
+
+table_id = 100
+writer.add_format_description
+writer.add_previous_gtids(2)
+
+writer.add_gtid(3)
+writer.add_query("test", "BEGIN")
+writer.add_table_map(table_id, "test", "items", columns)
+writer.add_write_rows(table_id, n_columns, [row1, row2.call(0)])
+writer.add_xid(10)
+
+writer.add_gtid(4)
+writer.add_query("test", "BEGIN")
+writer.add_table_map(table_id, "test", "items", columns)
+writer.add_update_rows(table_id,
+                       n_columns,
+                       [
+                         [
+                           row2.call(0),
+                           row2.call(1),
+                         ],
+                       ])
+writer.add_xid(11)
+
+writer.add_gtid(5)
+writer.add_query("test", "BEGIN")
+writer.add_table_map(table_id, "test", "items", columns)
+writer.add_write_rows(table_id, n_columns, [row3])
+writer.add_xid(12)
+
+writer.add_rotate("binlog.000002")
+
+File.binwrite(File.join(__dir__, "mysql-8.0.binlog"), writer.to_s)
+
+numbers_columns = [
+  {
+    name: "id",
+    type: 3, # LONG
+    metadata: "",
+    numeric: true,
+    primary_key: true,
+  },
+  {
+    name: "small",
+    type: 2, # SHORT
+    metadata: "",
+    numeric: true,
+    unsigned: true,
+    nullable: true,
+  },
+  {
+    name: "medium",
+    type: 9, # INT24
+    metadata: "",
+    numeric: true,
+    nullable: true,
+  },
+  {
+    name: "big",
+    type: 8, # LONGLONG
+    metadata: "",
+    numeric: true,
+    nullable: true,
+  },
+  {
+    name: "ratio",
+    type: 4, # FLOAT
+    metadata: [4].pack("C"),
+    numeric: true,
+    nullable: true,
+  },
+  {
+    name: "score",
+    type: 5, # DOUBLE
+    metadata: [8].pack("C"),
+    numeric: true,
+    nullable: true,
+  },
+  {
+    name: "born",
+    type: 13, # YEAR
+    metadata: "",
+    nullable: true,
+  },
+  {
+    name: "label",
+    type: 15, # VARCHAR
+    metadata: [64].pack("v"),
+    nullable: true,
+    collation_id: 45, # utf8mb4_general_ci
+  },
+]
+new_numbers_columns = numbers_columns + [
+  {
+    name: "note",
+    type: 15, # VARCHAR
+    metadata: [32].pack("v"),
+    nullable: true,
+    collation_id: 45, # utf8mb4_general_ci
+  },
+]
+logs_columns = [
+  {
+    name: "id",
+    type: 3, # LONG
+    metadata: "",
+    numeric: true,
+    primary_key: true,
+  },
+  {
+    name: "body",
+    type: 252, # BLOB
+    metadata: [2].pack("C"),
+    nullable: true,
+    collation_id: 45, # utf8mb4_general_ci
+  },
+  {
+    name: "created_on",
+    type: 10, # DATE
+    metadata: "",
+    nullable: true,
+  },
+  {
+    name: "flags",
+    type: 16, # BIT
+    metadata: [2, 1].pack("CC"),
+    nullable: true,
+  },
+  {
+    name: "code",
+    type: 254, # STRING
+    metadata: [254, 16].pack("CC"),
+    nullable: true,
+    collation_id: 45, # utf8mb4_general_ci
+  },
+  {
+    name: "updated_at",
+    type: 17, # TIMESTAMP2
+    metadata: [0].pack("C"),
+    nullable: true,
+  },
+]
+[numbers_columns, new_numbers_columns, logs_columns].flatten.uniq.each do |column|
+  column[:metadata] = column[:metadata].b
+  column[:name] = column[:name].b
+end
+
+next_writer = BinlogWriter.new
+n_numbers_columns = numbers_columns.size
+
+numbers_row1 = next_writer.bitmap([false] * n_numbers_columns)
+numbers_row1 << [1, 65535, -8388608].pack("l<S<l<")[0, 9]
+numbers_row1 << [-9223372036854775808, 1.5, -2.25].pack("q<eE")
+numbers_row1 << [2022 - 1900].pack("C")
+numbers_row1 << Values.varchar("one", 64)
+
+numbers_row2 = next_writer.bitmap([false, true, false, false,
+                                   true, false, true, true])
+numbers_row2 << [2, 8388607].pack("l<l<")[0, 7]
+numbers_row2 << [9223372036854775807, 0.5].pack("q<E")
+
+numbers_row3 = next_writer.bitmap([false] * n_numbers_columns)
+numbers_row3 << [3, 0, 0].pack("l<S<l<")[0, 9]
+numbers_row3 << [0, -0.5, 1e100].pack("q<eE")
+numbers_row3 << [1901 - 1900].pack("C")
+numbers_row3 << Values.varchar("three", 64)
+
+# MINIMAL row image: the before image only has the primary key and
+# the after image only has the primary key and the changed columns.
+numbers_update_columns = (0...n_numbers_columns).collect {|i| i == 0}
+numbers_updated_columns =
+  (0...n_numbers_columns).collect {|i| [0, 3, 5].include?(i)}
+# The NULL bitmap only has bits for id, big and score.
+numbers_before_row2 = next_writer.bitmap([false])
+numbers_before_row2 << [2].pack("l<")
+numbers_after_row2 = next_writer.bitmap([false, false, true])
+numbers_after_row2 << [2, 42].pack("l<q<")
+
+new_numbers_columns_bitmap =
+  (0...new_numbers_columns.size).collect {|i| [0, 8].include?(i)}
+numbers_row4 = next_writer.bitmap([false, false])
+numbers_row4 << [4].pack("l<")
+numbers_row4 << Values.varchar("new", 32)
+
+logs_row1 = next_writer.bitmap([false] * logs_columns.size)
+logs_row1 << [1].pack("l<")
+logs_row1 << [5].pack("v") << "hello"
+logs_row1 << [(2022 << 9) | (1 << 5) | 18].pack("V")[0, 3]
+logs_row1 << [0b0100000001].pack("n")
+logs_row1 << Values.varchar("ab", 16)
+logs_row1 << [1642509296].pack("N")
+
+logs_row2 = next_writer.bitmap([false, true, false, true, true, false])
+logs_row2 << [2].pack("l<")
+logs_row2 << [0].pack("V")[0, 3]
+logs_row2 << [0].pack("N")
+
+numbers_table_id = 200
+logs_table_id = 201
+next_writer.add_format_description
+next_writer.add_previous_gtids(5)
+
+next_writer.add_gtid(6)
+next_writer.add_query("test", "BEGIN")
+next_writer.add_write_rows(table_id, n_columns, [row3])
+next_writer.add_xid(13)
+
+next_writer.add_gtid(7)
+next_writer.add_query("test", "BEGIN")
+next_writer.add_table_map(numbers_table_id, "test", "numbers", numbers_columns)
+next_writer.add_write_rows(numbers_table_id,
+                           n_numbers_columns,
+                           [numbers_row1, numbers_row2, numbers_row3])
+next_writer.add_xid(14)
+
+next_writer.add_gtid(8)
+next_writer.add_query("test", "BEGIN")
+next_writer.add_table_map(logs_table_id, "test", "logs", logs_columns)
+next_writer.add_write_rows(logs_table_id,
+                           logs_columns.size,
+                           [logs_row1, logs_row2])
+next_writer.add_xid(15)
+
+next_writer.add_gtid(9)
+next_writer.add_query("test", "BEGIN")
+next_writer.add_table_map(numbers_table_id, "test", "numbers", numbers_columns)
+next_writer.add_update_rows(numbers_table_id,
+                            n_numbers_columns,
+                            [[numbers_before_row2, numbers_after_row2]],
+                            columns: numbers_update_columns,
+                            updated_columns: numbers_updated_columns)
+next_writer.add_xid(16)
+
+next_writer.add_gtid(10)
+next_writer.add_query("test", "BEGIN")
+next_writer.add_table_map(numbers_table_id,
+                          "test",
+                          "numbers",
+                          new_numbers_columns)
+next_writer.add_write_rows(numbers_table_id,
+                           new_numbers_columns.size,
+                           [numbers_row4],
+                           columns: new_numbers_columns_bitmap)
+next_writer.add_xid(17)
+
+next_writer.add_rotate("binlog.000003")
+
+File.binwrite(File.join(__dir__, "mysql-8.0-2.binlog"), next_writer.to_s)
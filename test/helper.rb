@@ -0,0 +1,49 @@
+require "tempfile"
+
+require "test-unit"
+
+require "mysql2-replication"
+
+require_relative "fault-injection-proxy"
+
+module Helper
+  def fixture_path(*components)
+    File.join(__dir__, "fixtures", *components)
+  end
+
+  def binlog_path
+    fixture_path("mysql-8.0.binlog")
+  end
+
+  # binlog.000002 that follows binlog_path.
+  def next_binlog_path
+    fixture_path("mysql-8.0-2.binlog")
+  end
+
+  def mysql_client_options
+    {
+      host: ENV["MYSQL_HOST"] || "127.0.0.1",
+      port: Integer(ENV["MYSQL_PORT"] || "3306"),
+      username: ENV["MYSQL_USER"] || "root",
+      password: ENV["MYSQL_PASSWORD"],
+    }
+  end
+
+  # Tests that need a server are omitted when no server is available.
+  # Set MYSQL_HOST, MYSQL_PORT, MYSQL_USER and MYSQL_PASSWORD to use a
+  # server. The server must write binlog with binlog_format=ROW.
+  def connect_mysql(**options)
+    Mysql2::Client.new(**mysql_client_options.merge(options))
+  rescue Mysql2::Error => error
+    omit("MySQL isn't available: #{error.message}")
+  end
+
+  def open_file_reader(path=binlog_path, **options)
+    reader = Mysql2Replication::FileReader.new(path, **options)
+    begin
+      yield(reader)
+    ensure
+      reader.close unless reader.closed?
+    end
+  end
+end
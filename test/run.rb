@@ -0,0 +1,17 @@
+#!/usr/bin/env ruby
+
+$VERBOSE = true
+
+require "pathname"
+
+base_dir = Pathname(__dir__).parent.expand_path
+ext_dir = base_dir + "ext" + "mysql2-replication"
+lib_dir = base_dir + "lib"
+test_dir = base_dir + "test"
+
+$LOAD_PATH.unshift(ext_dir.to_s)
+$LOAD_PATH.unshift(lib_dir.to_s)
+
+require_relative "helper"
+
+exit(Test::Unit::AutoRunner.run(true, test_dir.to_s))
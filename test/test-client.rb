@@ -0,0 +1,134 @@
+class ClientTest < Test::Unit::TestCase
+  include Helper
+
+  def setup
+    @client = connect_mysql
+    @client.query("CREATE DATABASE IF NOT EXISTS mysql2_replication_test")
+    @client.query("DROP TABLE IF EXISTS mysql2_replication_test.items")
+    @client.query(<<~SQL)
+      CREATE TABLE mysql2_replication_test.items (
+        id INT PRIMARY KEY,
+        name VARCHAR(32)
+      )
+    SQL
+    master_status = @client.query("SHOW MASTER STATUS").first
+    @file_name = master_status["File"]
+    @position = master_status["Position"]
+  end
+
+  def teardown
+    @client.close if @client
+  end
+
+  def insert_items(ids)
+    ids.each do |id|
+      @client.query("INSERT INTO mysql2_replication_test.items " +
+                    "VALUES (#{id}, 'item#{id}')")
+    end
+  end
+
+  def open_replication_client(**options)
+    client = connect_mysql(**options)
+    begin
+      replication_client = Mysql2Replication::Client.new(client)
+      replication_client.file_name = @file_name
+      replication_client.start_position = @position
+      # Stop at the end of the binlog instead of waiting new events.
+      replication_client.flags = Mysql2Replication::Flags::BINLOG_DUMP_NON_BLOCK
+      replication_client.open do
+        yield(replication_client)
+      end
+    ensure
+      client.close
+    end
+  end
+
+  sub_test_case("#fetch_batch") do
+    test("buffered events") do
+      insert_items(1..5)
+      batches = []
+      open_replication_client do |replication_client|
+        while (batch = replication_client.fetch_batch)
+          batches << batch
+        end
+      end
+      # All events are small. libmariadb reads them ahead at once. They
+      # must be returned without waiting the socket.
+      rows_batch = batches.find do |batch|
+        batch.any?(Mysql2Replication::WriteRowsEvent)
+      end
+      assert_operator(rows_batch.size, :>, 1,
+                      batches.collect {|batch| batch.collect(&:class)})
+    end
+  end
+
+  sub_test_case("auto_reconnect") do
+    def setup
+      super
+      @proxy = FaultInjectionProxy.new(mysql_client_options[:host],
+                                       mysql_client_options[:port],
+                                       "lost-connection")
+    end
+
+    def teardown
+      @proxy.close if @proxy
+      super
+    end
+
+    test("#each_transaction") do
+      insert_items([1])
+      @client.query("BEGIN")
+      @client.query("INSERT INTO mysql2_replication_test.items " +
+                    "VALUES (2, 'item2')")
+      # The connection is lost in the middle of this transaction.
+      @client.query("INSERT INTO mysql2_replication_test.items " +
+                    "VALUES (3, 'lost-connection')")
+      @client.query("COMMIT")
+      insert_items([4])
+      last_position = @client.query("SHOW MASTER STATUS").first["Position"]
+
+      transactions = []
+      positions = []
+      # The proxy must see plain data.
+      open_replication_client(host: "127.0.0.1",
+                              port: @proxy.port,
+                              ssl_mode: :disabled) do |replication_client|
+        replication_client.auto_reconnect = true
+        replication_client.reconnect_interval = 0.1
+        replication_client.each_transaction do |transaction|
+          ids = transaction.events.flat_map do |event|
+            next [] unless event.is_a?(Mysql2Replication::WriteRowsEvent)
+            event.rows.collect {|row| row[0]}
+          end
+          transactions << [ids, transaction.next_position]
+          # The yielded transaction isn't processed yet. The position
+          # is the end of the previous transaction.
+          positions << [
+            replication_client.current_file_name,
+            replication_client.current_position,
+          ]
+        end
+        positions << [
+          replication_client.current_file_name,
+          replication_client.current_position,
+        ]
+      end
+
+      next_positions = transactions.collect {|_, position| position}
+      assert_equal([
+                     [true, 2],
+                     [[1], [2, 3], [4]],
+                     [@position, *next_positions].collect do |position|
+                       [@file_name, position]
+                     end,
+                     last_position,
+                   ],
+                   [
+                     [@proxy.cut?, @proxy.n_connections],
+                     transactions.collect {|ids, _| ids},
+                     positions,
+                     next_positions.last,
+                   ])
+    end
+  end
+end
@@ -0,0 +1,90 @@
+class DecodeProfileTest < Test::Unit::TestCase
+  include Helper
+
+  setup do
+    unless Mysql2Replication.decode_profile_available?
+      omit("built without --enable-decode-profile")
+    end
+    Mysql2Replication.decode_profile_enabled = true
+    Mysql2Replication.reset_decode_profile
+  end
+
+  teardown do
+    if Mysql2Replication.decode_profile_available?
+      Mysql2Replication.decode_profile_enabled = false
+      Mysql2Replication.reset_decode_profile
+    end
+  end
+
+  def counts(entries)
+    entries.transform_values do |entry|
+      [entry[:count], entry[:n_bytes]]
+    end
+  end
+
+  test("columns") do
+    open_file_reader(next_binlog_path) do |reader|
+      # INSERT test.numbers id = 1, 2 and 3
+      rows_event = reader.each_transaction.to_a[1].events.last
+      Mysql2Replication.reset_decode_profile
+      rows_event.rows
+    end
+    # NULL values aren't decoded.
+    assert_equal({
+                   long: [3, 12],
+                   short: [2, 4],
+                   int24: [3, 9],
+                   longlong: [3, 24],
+                   float: [2, 8],
+                   double: [3, 24],
+                   year: [2, 2],
+                   varchar: [2, 10],
+                 },
+                 counts(Mysql2Replication.decode_profile[:columns]))
+  end
+
+  test("metadata") do
+    open_file_reader(next_binlog_path) do |reader|
+      reader.each.to_a
+    end
+    # The identical TABLE_MAP_EVENT for test.numbers reuses the cached
+    # columns.
+    profile = Mysql2Replication.decode_profile
+    assert_equal([
+                   {
+                     long: [3, 0],
+                     short: [2, 0],
+                     int24: [2, 0],
+                     longlong: [2, 0],
+                     float: [2, 2],
+                     double: [2, 2],
+                     year: [2, 0],
+                     varchar: [3, 6],
+                     blob: [1, 1],
+                     date: [1, 0],
+                     bit: [1, 2],
+                     string: [1, 2],
+                     timestamp2: [1, 1],
+                   },
+                   [4, 297],
+                 ],
+                 [
+                   counts(profile[:metadata]),
+                   counts(profile[:events])[30],
+                 ])
+  end
+
+  test("disabled") do
+    Mysql2Replication.decode_profile_enabled = false
+    open_file_reader(next_binlog_path) do |reader|
+      reader.each_transaction.each do |transaction|
+        transaction.events.last.rows
+      end
+    end
+    assert_equal({fetch: {count: 0, n_bytes: 0, time: 0.0},
+                  events: {},
+                  metadata: {},
+                  columns: {}},
+                 Mysql2Replication.decode_profile)
+  end
+end
@@ -0,0 +1,705 @@
+class DecoderTest < Test::Unit::TestCase
+  include Helper
+
+  # Transactions in binlog_path:
+  #   0: INSERT id = 1 and id = 2
+  #   1: UPDATE id = 2
+  #   2: INSERT id = 3 with zero date
+  #
+  # Transactions in next_binlog_path:
+  #   0: INSERT without TABLE_MAP_EVENT
+  #   1: INSERT test.numbers id = 1, 2 and 3
+  #   2: INSERT test.logs id = 1 and id = 2 with zero date
+  #   3: UPDATE test.numbers id = 2 with MINIMAL row image
+  #   4: INSERT test.numbers id = 4 after ADD COLUMN
+  def read_rows(nth_transaction, path=binlog_path, **options)
+    open_file_reader(path, **options) do |reader|
+      transaction = reader.each_transaction.to_a[nth_transaction]
+      rows_event = transaction.events.last
+      if rows_event.is_a?(Mysql2Replication::UpdateRowsEvent)
+        rows_event.updated_rows
+      else
+        rows_event.rows
+      end
+    end
+  end
+
+  def read_table_map(**options)
+    open_file_reader(**options) do |reader|
+      reader.each.find do |event|
+        event.is_a?(Mysql2Replication::TableMapEvent)
+      end
+    end
+  end
+
+  test("TableMapEvent") do
+    table_map = read_table_map
+    assert_equal([
+                   "test",
+                   "items",
+                   [0],
+                   [
+                     {
+                       type: :long,
+                       type_id: 3,
+                       name: "id",
+                       unsigned: true,
+                       primary_key: true,
+                     },
+                     {
+                       type: :newdecimal,
+                       type_id: 246,
+                       precision: 10,
+                       scale: 2,
+                       name: "price",
+                     },
+                     {
+                       type: :newdecimal,
+                       type_id: 246,
+                       precision: 30,
+                       scale: 10,
+                       name: "amount",
+                     },
+                     {
+                       type: :time2,
+                       type_id: 19,
+                       decimals: 3,
+                       name: "duration",
+                     },
+                     {
+                       type: :datetime2,
+                       type_id: 18,
+                       decimals: 6,
+                       name: "created_at",
+                     },
+                     {
+                       type: :json,
+                       type_id: 245,
+                       length_size: 4,
+                       name: "document",
+                     },
+                     {
+                       type: :varchar,
+                       type_id: 15,
+                       max_length: 256,
+                       name: "name",
+                       collation_id: 45,
+                       encoding: Encoding::UTF_8,
+                     },
+                     {
+                       type: :varchar,
+                       type_id: 15,
+                       max_length: 32,
+                       name: "legacy_name",
+                       collation_id: 8,
+                       encoding: Encoding::ISO_8859_1,
+                     },
+                     {
+                       type: :longlong,
+                       type_id: 8,
+                       name: "counter",
+                       unsigned: true,
+                     },
+                     {
+                       type: :tiny,
+                       type_id: 1,
+                       name: "delta",
+                     },
+                   ],
+                 ],
+                 [
+                   table_map.database,
+                   table_map.table,
+                   table_map.primary_key,
+                   table_map.columns,
+                 ])
+  end
+
+  test("default") do
+    first_row, second_row = read_rows(0)
+    assert_equal([
+                   {
+                     0 => 1,
+                     1 => BigDecimal("123.45"),
+                     2 => BigDecimal("12345678901234567890.0123456789"),
+                     3 => "01:02:03.456",
+                     4 => Time.utc(2022, 1, 18, 12, 34, 56.789012r),
+                     5 => [
+                       0x00, 0x02, 0x00, 0x23, 0x00, 0x12, 0x00, 0x01,
+                       0x00, 0x13, 0x00, 0x01, 0x00, 0x05, 0x01, 0x00,
+                       0x02, 0x14, 0x00, 0x61, 0x62, 0x03, 0x00, 0x0f,
+                       0x00, 0x04, 0x01, 0x00, 0x04, 0x00, 0x00, 0x0c,
+                       0x0d, 0x00, 0x01, 0x78,
+                     ].pack("C*"),
+                     6 => "こんにちは",
+                     7 => "café".encode("ISO-8859-1"),
+                     8 => 18446744073709551615,
+                     9 => -1,
+                   },
+                   {
+                     0 => 2,
+                     1 => BigDecimal("-123.45"),
+                     2 => BigDecimal("-1.0000000001"),
+                     3 => "-00:00:01.500",
+                     4 => nil,
+                     5 => [
+                       0x02, 0x02, 0x00, 0x12, 0x00, 0x0b, 0x0a, 0x00,
+                       0x05, 0xfe, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00,
+                       0x00, 0xf8, 0x3f,
+                     ].pack("C*"),
+                     6 => "abc",
+                     7 => nil,
+                     8 => 0,
+                     9 => 127,
+                   },
+                 ],
+                 [first_row, second_row])
+  end
+
+  test("encoding") do
+    first_row, = read_rows(0)
+    assert_equal([Encoding::UTF_8, Encoding::ISO_8859_1],
+                 [first_row[6].encoding, first_row[7].encoding])
+  end
+
+  test("UpdateRowsEvent") do
+    updated_row, = read_rows(1)
+    assert_equal([2, 1], [updated_row[0], updated_row[8]])
+  end
+
+  test("row_format: :name") do
+    first_row, = read_rows(0, row_format: :name)
+    assert_equal({"id" => 1, "counter" => 18446744073709551615},
+                 first_row.slice("id", "counter"))
+  end
+
+  test("row_format: :array") do
+    _, second_row = read_rows(0, row_format: :array)
+    assert_equal([2, "abc", 127], second_row.values_at(0, 6, 9))
+  end
+
+  sub_test_case("NULL bitmap") do
+    def read_update_rows_event(**options)
+      open_file_reader(next_binlog_path, **options) do |reader|
+        transaction = reader.each_transaction.to_a[3]
+        rows_event = transaction.events.last
+        [rows_event.rows, rows_event.updated_rows]
+      end
+    end
+
+    test("NULL in written rows") do
+      _, second_row = read_rows(1, next_binlog_path)
+      assert_equal({
+                     0 => 2,
+                     1 => nil,
+                     2 => 8388607,
+                     3 => 9223372036854775807,
+                     4 => nil,
+                     5 => 0.5,
+                     6 => nil,
+                     7 => nil,
+                   },
+                   second_row)
+    end
+
+    test("partial columns") do
+      # The NULL bitmap has bits only for the columns in the column
+      # bitmap.
+      assert_equal([
+                     [{0 => 2}],
+                     [{0 => 2, 3 => 42, 5 => nil}],
+                   ],
+                   read_update_rows_event)
+    end
+
+    test("partial columns: row_format: :name") do
+      assert_equal([
+                     [{"id" => 2}],
+                     [{"id" => 2, "big" => 42, "score" => nil}],
+                   ],
+                   read_update_rows_event(row_format: :name))
+    end
+
+    test("partial columns: row_format: :array") do
+      assert_equal([
+                     [[2, nil, nil, nil, nil, nil, nil, nil]],
+                     [[2, nil, nil, 42, nil, nil, nil, nil]],
+                   ],
+                   read_update_rows_event(row_format: :array))
+    end
+  end
+
+  sub_test_case("native columns") do
+    def read_table_map_and_rows(nth_transaction)
+      open_file_reader(next_binlog_path) do |reader|
+        transaction = reader.each_transaction.to_a[nth_transaction]
+        table_map, rows_event = transaction.events
+        [table_map.columns, rows_event.rows]
+      end
+    end
+
+    test("numbers") do
+      columns, rows = read_table_map_and_rows(1)
+      assert_equal([
+                     [
+                       {
+                         type: :long,
+                         type_id: 3,
+                         name: "id",
+                         primary_key: true,
+                       },
+                       {
+                         type: :short,
+                         type_id: 2,
+                         name: "small",
+                         unsigned: true,
+                       },
+                       {type: :int24, type_id: 9, name: "medium"},
+                       {type: :longlong, type_id: 8, name: "big"},
+                       {type: :float, type_id: 4, size: 4, name: "ratio"},
+                       {type: :double, type_id: 5, size: 8, name: "score"},
+                       {type: :year, type_id: 13, name: "born"},
+                       {
+                         type: :varchar,
+                         type_id: 15,
+                         max_length: 64,
+                         name: "label",
+                         collation_id: 45,
+                         encoding: Encoding::UTF_8,
+                       },
+                     ],
+                     [
+                       [
+                         1,
+                         65535,
+                         -8388608,
+                         -9223372036854775808,
+                         1.5,
+                         -2.25,
+                         2022,
+                         "one",
+                       ],
+                       [3, 0, 0, 0, -0.5, 1e100, 1901, "three"],
+                     ],
+                   ],
+                   [
+                     columns,
+                     rows.values_at(0, 2).collect(&:values),
+                   ])
+    end
+
+    test("logs") do
+      columns, rows = read_table_map_and_rows(2)
+      assert_equal([
+                     [
+                       {
+                         type: :long,
+                         type_id: 3,
+                         name: "id",
+                         primary_key: true,
+                       },
+                       {
+                         type: :blob,
+                         type_id: 252,
+                         length_size: 2,
+                         name: "body",
+                         collation_id: 45,
+                         encoding: Encoding::UTF_8,
+                       },
+                       {type: :date, type_id: 10, name: "created_on"},
+                       {type: :bit, type_id: 16, bits: 10, name: "flags"},
+                       {
+                         type: :string,
+                         type_id: 254,
+                         max_length: 16,
+                         name: "code",
+                         collation_id: 45,
+                         encoding: Encoding::UTF_8,
+                       },
+                       {
+                         type: :timestamp2,
+                         type_id: 17,
+                         decimals: 0,
+                         name: "updated_at",
+                       },
+                     ],
+                     {
+                       0 => 1,
+                       1 => "hello",
+                       2 => Date.new(2022, 1, 18),
+                       3 => 257,
+                       4 => "ab",
+                       5 => Time.utc(2022, 1, 18, 12, 34, 56),
+                     },
+                   ],
+                   [columns, rows[0]])
+    end
+  end
+
+  sub_test_case("table cache") do
+    # TABLE_MAP_EVENTs for test.numbers in next_binlog_path:
+    #   0: CREATE TABLE
+    #   1: The same as 0
+    #   2: After ADD COLUMN
+    def read_numbers_table_maps(reader)
+      reader.each.select do |event|
+        event.is_a?(Mysql2Replication::TableMapEvent) and
+          event.table == "numbers"
+      end
+    end
+
+    test("same TABLE_MAP_EVENT") do
+      open_file_reader(next_binlog_path) do |reader|
+        table_maps = read_numbers_table_maps(reader)
+        assert_same(table_maps[0].columns, table_maps[1].columns)
+      end
+    end
+
+    test("changed TABLE_MAP_EVENT") do
+      open_file_reader(next_binlog_path) do |reader|
+        table_maps = read_numbers_table_maps(reader)
+        assert_equal([8, 9],
+                     [table_maps[1].columns.size, table_maps[2].columns.size])
+        assert_not_same(table_maps[1].columns, table_maps[2].columns)
+      end
+    end
+
+    test("table_cache_size: 0") do
+      open_file_reader(next_binlog_path, table_cache_size: 0) do |reader|
+        table_maps = read_numbers_table_maps(reader)
+        assert_equal(table_maps[0].columns, table_maps[1].columns)
+        assert_not_same(table_maps[0].columns, table_maps[1].columns)
+      end
+    end
+
+    test("#table_cache_size=") do
+      open_file_reader(next_binlog_path) do |reader|
+        table_maps = []
+        reader.each do |event|
+          next unless event.is_a?(Mysql2Replication::TableMapEvent)
+          next unless event.table == "numbers"
+          table_maps << event
+          # Clear the cache before the same TABLE_MAP_EVENT.
+          reader.table_cache_size = reader.table_cache_size
+        end
+        assert_equal(table_maps[0].columns, table_maps[1].columns)
+        assert_not_same(table_maps[0].columns, table_maps[1].columns)
+      end
+    end
+  end
+
+  sub_test_case("#columnar") do
+    def read_rows_event(nth_transaction)
+      open_file_reader(next_binlog_path) do |reader|
+        transaction = reader.each_transaction.to_a[nth_transaction]
+        yield(transaction.events.last)
+      end
+    end
+
+    test("packed: true") do
+      columnar = read_rows_event(1) do |rows_event|
+        rows_event.columnar(packed: true)
+      end
+      values = columnar[:values]
+      assert_equal([
+                     3,
+                     [1, 2, 3],
+                     [65535, 0, 0],
+                     [-8388608, 8388607, 0],
+                     [-9223372036854775808, 9223372036854775807, 0],
+                     [1.5, 0.0, -0.5],
+                     [-2.25, 0.5, 1e100],
+                     [2022, 0, 1901],
+                     ["one", nil, "three"],
+                     ["\x00", "\x02", "\x00", "\x00",
+                      "\x02", "\x00", "\x02", "\x02"].collect(&:b),
+                   ],
+                   [
+                     columnar[:n_rows],
+                     *values[0, 4].collect {|packed| packed.unpack("q<*")},
+                     *values[4, 2].collect {|packed| packed.unpack("E*")},
+                     values[6].unpack("q<*"),
+                     values[7],
+                     columnar[:nulls],
+                   ])
+    end
+
+    test("packed: false") do
+      columnar = read_rows_event(2, &:columnar)
+      assert_equal({
+                     n_rows: 2,
+                     values: [
+                       [1, 2],
+                       ["hello", nil],
+                       [Date.new(2022, 1, 18), nil],
+                       [257, nil],
+                       ["ab", nil],
+                       [Time.utc(2022, 1, 18, 12, 34, 56), nil],
+                     ],
+                     # Zero DATE and TIMESTAMP aren't NULL.
+                     nulls: ["\x00", "\x02", "\x00",
+                             "\x02", "\x02", "\x00"].collect(&:b),
+                   },
+                   columnar)
+    end
+
+    test("UpdateRowsEvent") do
+      columnar = read_rows_event(3, &:columnar)
+      # Columns that aren't in the column bitmap are NULL.
+      assert_equal([
+                     [[2], [42], [nil]],
+                     ["\x00", "\x01", "\x01"].collect(&:b),
+                     ["\x00", "\x00", "\x01"].collect(&:b),
+                   ],
+                   [
+                     columnar[:updated_values].values_at(0, 3, 5),
+                     columnar[:nulls].values_at(0, 3, 5),
+                     columnar[:updated_nulls].values_at(0, 3, 5),
+                   ])
+    end
+
+    test("after #rows") do
+      read_rows_event(1) do |rows_event|
+        rows_event.rows
+        message = "rows are already decoded: #{rows_event.inspect}"
+        assert_raise(Mysql2Replication::Error.new(message)) do
+          rows_event.columnar
+        end
+      end
+    end
+  end
+
+  sub_test_case("shareable:") do
+    data(binlog_path: :binlog_path,
+         next_binlog_path: :next_binlog_path)
+    test("true") do |path_name|
+      open_file_reader(__send__(path_name), shareable: true) do |reader|
+        events = reader.each.to_a
+        assert_equal([true],
+                     events.collect {|event| Ractor.shareable?(event)}.uniq)
+      end
+    end
+
+    test("true: rows") do
+      open_file_reader(next_binlog_path, shareable: true) do |reader|
+        transaction = reader.each_transaction.to_a[1]
+        rows_event = transaction.events.last
+        assert_equal([true, true, "one"],
+                     [
+                       Ractor.shareable?(transaction),
+                       rows_event.rows.frozen?,
+                       rows_event.rows[0][7],
+                     ])
+      end
+    end
+
+    test("false") do
+      open_file_reader(next_binlog_path) do |reader|
+        table_map = reader.each.find do |event|
+          event.is_a?(Mysql2Replication::TableMapEvent)
+        end
+        assert_false(Ractor.shareable?(table_map))
+      end
+    end
+  end
+
+  sub_test_case("share_strings:") do
+    def read_rows_events(**options)
+      open_file_reader(next_binlog_path, **options) do |reader|
+        reader.each_transaction.to_a.values_at(1, 2).collect do |transaction|
+          transaction.events.last
+        end
+      end
+    end
+
+    test("true: decoded after #close") do
+      numbers_rows_event, logs_rows_event = read_rows_events(share_strings: true)
+      GC.start
+      assert_equal([
+                     ["one", nil, "three"],
+                     ["hello", "ab"],
+                     [Encoding::UTF_8, Encoding::UTF_8],
+                   ],
+                   [
+                     numbers_rows_event.rows.collect {|row| row[7]},
+                     logs_rows_event.rows[0].values_at(1, 4),
+                     logs_rows_event.rows[0].values_at(1, 4).collect(&:encoding),
+                   ])
+    end
+
+    test("true: decoded before #close") do
+      rows = open_file_reader(next_binlog_path,
+                              share_strings: true) do |reader|
+        transaction = reader.each_transaction.to_a[1]
+        transaction.events.last.rows
+      end
+      GC.start
+      assert_equal(["one", nil, "three"],
+                   rows.collect {|row| row[7]})
+    end
+
+    test("true: modify") do
+      numbers_rows_event, = read_rows_events(share_strings: true)
+      first_row, _, third_row = numbers_rows_event.rows
+      first_row[7] << "!"
+      assert_equal(["one!", "three"],
+                   [first_row[7], third_row[7]])
+    end
+
+    test("true: #columnar") do
+      _, logs_rows_event = read_rows_events(share_strings: true)
+      GC.start
+      assert_equal([["hello", nil], ["ab", nil]],
+                   logs_rows_event.columnar[:values].values_at(1, 4))
+    end
+  end
+
+  sub_test_case("decimal_format:") do
+    test(":integer") do
+      first_row, second_row = read_rows(0, decimal_format: :integer)
+      assert_equal([
+                     12345,
+                     123456789012345678900123456789,
+                     -12345,
+                     -10000000001,
+                   ],
+                   [
+                     first_row[1],
+                     first_row[2],
+                     second_row[1],
+                     second_row[2],
+                   ])
+    end
+
+    test(":rational") do
+      first_row, second_row = read_rows(0, decimal_format: :rational)
+      assert_equal([
+                     123.45r,
+                     12345678901234567890.0123456789r,
+                     -123.45r,
+                     -1.0000000001r,
+                   ],
+                   [
+                     first_row[1],
+                     first_row[2],
+                     second_row[1],
+                     second_row[2],
+                   ])
+    end
+  end
+
+  sub_test_case("time_format:") do
+    test(":integer") do
+      first_row, = read_rows(0, time_format: :integer)
+      zero_date_row, = read_rows(2, time_format: :integer)
+      assert_equal([
+                     Time.utc(2022, 1, 18, 12, 34, 56).to_i,
+                     nil,
+                   ],
+                   [
+                     first_row[4],
+                     zero_date_row[4],
+                   ])
+    end
+
+    test(":array") do
+      first_row, = read_rows(0, time_format: :array)
+      zero_date_row, = read_rows(2, time_format: :array)
+      assert_equal([
+                     [Time.utc(2022, 1, 18, 12, 34, 56).to_i, 789012],
+                     nil,
+                   ],
+                   [
+                     first_row[4],
+                     zero_date_row[4],
+                   ])
+    end
+
+    test(":time: zero date") do
+      zero_date_row, = read_rows(2)
+      assert_nil(zero_date_row[4])
+    end
+
+    data(":time", :time)
+    data(":integer", :integer)
+    data(":array", :array)
+    test("zero DATE and TIMESTAMP") do |time_format|
+      _, zero_date_row = read_rows(2, next_binlog_path, time_format: time_format)
+      assert_equal([nil, nil], zero_date_row.values_at(2, 5))
+    end
+  end
+
+  sub_test_case("json_format:") do
+    test(":object") do
+      first_row, second_row = read_rows(0, json_format: :object)
+      assert_equal([
+                     {"a" => 1, "b" => [true, nil, "x"]},
+                     [1.5, -2],
+                   ],
+                   [first_row[5], second_row[5]])
+    end
+
+    test(":text") do
+      first_row, second_row = read_rows(0, json_format: :text)
+      assert_equal([
+                     "{\"a\": 1, \"b\": [true, null, \"x\"]}",
+                     "[1.5, -2]",
+                   ],
+                   [first_row[5], second_row[5]])
+    end
+  end
+
+  sub_test_case("broken rows") do
+    def read_broken_rows_event(nth_event, broken_bytes)
+      data = File.binread(binlog_path)
+      broken_bytes.each do |position, byte|
+        data.setbyte(position, byte)
+      end
+      Tempfile.create(["broken", ".binlog"]) do |file|
+        file.binmode
+        file.write(data)
+        file.close
+        open_file_reader(file.path) do |reader|
+          yield(reader.each.to_a[nth_event])
+        end
+      end
+    end
+
+    # The NULL bitmap of the row in the last transaction. All columns
+    # are non NULL but the row only has id and created_at.
+    def truncated_row_bytes
+      {1581 => 0, 1582 => 0}
+    end
+
+    test("truncated: #rows") do
+      read_broken_rows_event(15, truncated_row_bytes) do |rows_event|
+        message = /: "truncated row data: required: 14: rest: 3"\z/
+        error = assert_raise(Mysql2Replication::Error) do
+          rows_event.rows
+        end
+        assert_match(message, error.message)
+      end
+    end
+
+    test("truncated: #columnar") do
+      read_broken_rows_event(15, truncated_row_bytes) do |rows_event|
+        message = /: "truncated row data: required: 14: rest: 3"\z/
+        error = assert_raise(Mysql2Replication::Error) do
+          rows_event.columnar
+        end
+        assert_match(message, error.message)
+      end
+    end
+
+    test("broken decimal") do
+      # The first byte of the price in the first row.
+      read_broken_rows_event(5, {537 => 0xff}) do |rows_event|
+        message = /: "broken decimal group: 2130706555: digits: 8"\z/
+        error = assert_raise(Mysql2Replication::Error) do
+          rows_event.rows
+        end
+        assert_match(message, error.message)
+      end
+    end
+  end
+end
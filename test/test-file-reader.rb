@@ -0,0 +1,433 @@
+class FileReaderTest < Test::Unit::TestCase
+  include Helper
+
+  test("#each") do
+    open_file_reader do |reader|
+      assert_equal([
+                     [Mysql2Replication::FormatDescriptionEvent, 126],
+                     [Mysql2Replication::PreviousGtidsEvent, 197],
+                     [Mysql2Replication::GtidEvent, 274],
+                     [Mysql2Replication::QueryEvent, 341],
+                     [Mysql2Replication::TableMapEvent, 499],
+                     [Mysql2Replication::WriteRowsEvent, 711],
+                     [Mysql2Replication::XidEvent, 742],
+                     [Mysql2Replication::GtidEvent, 819],
+                     [Mysql2Replication::QueryEvent, 886],
+                     [Mysql2Replication::TableMapEvent, 1044],
+                     [Mysql2Replication::UpdateRowsEvent, 1216],
+                     [Mysql2Replication::XidEvent, 1247],
+                     [Mysql2Replication::GtidEvent, 1324],
+                     [Mysql2Replication::QueryEvent, 1391],
+                     [Mysql2Replication::TableMapEvent, 1549],
+                     [Mysql2Replication::WriteRowsEvent, 1599],
+                     [Mysql2Replication::XidEvent, 1630],
+                     [Mysql2Replication::RotateEvent, 1674],
+                   ],
+                   reader.each.collect {|event| [event.class, event.next_position]})
+    end
+  end
+
+  test("#fetch") do
+    open_file_reader do |reader|
+      format_description_event = reader.fetch
+      previous_gtids_event = reader.fetch
+      assert_equal([
+                     "8.0.27",
+                     1,
+                     Time.utc(2022, 1, 18, 12, 34, 56).to_i,
+                     ["3E11FA47-71CA-11E1-9E33-C80AA9429562:1-2"],
+                     197,
+                   ],
+                   [
+                     format_description_event.server_version,
+                     format_description_event.server_id,
+                     format_description_event.timestamp,
+                     previous_gtids_event.gtids,
+                     reader.position,
+                   ])
+    end
+  end
+
+  test("#fetch: end of file") do
+    open_file_reader do |reader|
+      reader.position = File.size(binlog_path)
+      assert_nil(reader.fetch)
+    end
+  end
+
+  test("#position=") do
+    open_file_reader do |reader|
+      reader.position = 742
+      gtid_event = reader.fetch
+      assert_equal(["3E11FA47-71CA-11E1-9E33-C80AA9429562:4", 819],
+                   [gtid_event.gtid, reader.position])
+    end
+  end
+
+  test("#each_transaction") do
+    open_file_reader do |reader|
+      transactions = reader.each_transaction.collect do |transaction|
+        [
+          transaction.gtid,
+          transaction.xid,
+          transaction.next_position,
+          transaction.events.collect(&:class),
+        ]
+      end
+      assert_equal([
+                     [
+                       "3E11FA47-71CA-11E1-9E33-C80AA9429562:3",
+                       10,
+                       742,
+                       [
+                         Mysql2Replication::TableMapEvent,
+                         Mysql2Replication::WriteRowsEvent,
+                       ],
+                     ],
+                     [
+                       "3E11FA47-71CA-11E1-9E33-C80AA9429562:4",
+                       11,
+                       1247,
+                       [
+                         Mysql2Replication::TableMapEvent,
+                         Mysql2Replication::UpdateRowsEvent,
+                       ],
+                     ],
+                     [
+                       "3E11FA47-71CA-11E1-9E33-C80AA9429562:5",
+                       12,
+                       1630,
+                       [
+                         Mysql2Replication::TableMapEvent,
+                         Mysql2Replication::WriteRowsEvent,
+                       ],
+                     ],
+                   ],
+                   transactions)
+    end
+  end
+
+  test("RotateEvent") do
+    open_file_reader do |reader|
+      rotate_event = reader.each.to_a.last
+      assert_equal(["binlog.000002", 4],
+                   [rotate_event.file_name, rotate_event.position])
+    end
+  end
+
+  test(".open_parallel") do
+    readers = Mysql2Replication::FileReader.open_parallel([binlog_path] * 2,
+                                                          verify_checksum: true)
+    begin
+      assert_equal([[binlog_path, 18], [binlog_path, 18]],
+                   readers.collect {|reader| [reader.path, reader.each.count]})
+    ensure
+      readers.each(&:close)
+    end
+  end
+
+  test(".open_parallel: order") do
+    paths = [next_binlog_path, binlog_path, next_binlog_path]
+    readers = Mysql2Replication::FileReader.open_parallel(paths,
+                                                          n_workers: 2)
+    begin
+      assert_equal([
+                     [next_binlog_path, 1931],
+                     [binlog_path, 1674],
+                     [next_binlog_path, 1931],
+                   ],
+                   readers.collect {|reader| [reader.path, reader.each.to_a.last.next_position]})
+    ensure
+      readers.each(&:close)
+    end
+  end
+
+  test(".open_parallel: TABLE_MAP_EVENT per file") do
+    paths = [binlog_path, next_binlog_path]
+    readers = Mysql2Replication::FileReader.open_parallel(paths)
+    begin
+      reader, next_reader = readers
+      # Table ID 100 is mapped to test.items in binlog_path.
+      reader.each.to_a
+      rows_event = next_reader.each.find do |event|
+        event.is_a?(Mysql2Replication::RowsEvent)
+      end
+      assert_equal([100, nil, []],
+                   [rows_event.table_id, rows_event.table_map, rows_event.rows])
+    ensure
+      readers.each(&:close)
+    end
+  end
+
+  test(".open_parallel: error") do
+    Tempfile.create(["not-binlog", ".binlog"]) do |file|
+      file.write("not binlog")
+      file.close
+      missing_path = fixture_path("nonexistent.binlog")
+      # The first failed path in the given order is reported.
+      paths = [binlog_path, missing_path, file.path]
+      assert_raise(Errno::ENOENT.new(missing_path)) do
+        Mysql2Replication::FileReader.open_parallel(paths)
+      end
+    end
+  end
+
+  test("#close") do
+    reader = Mysql2Replication::FileReader.new(binlog_path)
+    reader.close
+    assert_true(reader.closed?)
+  end
+
+  test("re-initialize") do
+    open_file_reader do |reader|
+      message = "file reader is already initialized: #{binlog_path.inspect}"
+      assert_raise(Mysql2Replication::Error.new(message)) do
+        reader.__send__(:initialize, binlog_path)
+      end
+    end
+  end
+
+  test("not binlog") do
+    Tempfile.create(["not-binlog", ".binlog"]) do |file|
+      file.write("not binlog")
+      file.close
+      message = "not a binlog file: #{file.path.inspect}"
+      assert_raise(Mysql2Replication::Error.new(message)) do
+        Mysql2Replication::FileReader.new(file.path)
+      end
+    end
+  end
+
+  test("broken PreviousGtidsEvent") do
+    data = File.binread(binlog_path)
+    # The most significant byte of the number of SIDs.
+    data.setbyte(152, 0x7f)
+    Tempfile.create(["broken", ".binlog"]) do |file|
+      file.binmode
+      file.write(data)
+      file.close
+      open_file_reader(file.path) do |reader|
+        reader.fetch
+        message = "failed to parse event: type: 35"
+        assert_raise(Mysql2Replication::Error.new(message)) do
+          reader.fetch
+        end
+        assert_equal([197, Mysql2Replication::GtidEvent],
+                     [reader.position, reader.fetch.class])
+      end
+    end
+  end
+
+  sub_test_case("#stats") do
+    def read_all(reader)
+      reader.each_transaction.each do |transaction|
+        transaction.events.last.rows
+      end
+    end
+
+    test("#to_h") do
+      open_file_reader(next_binlog_path) do |reader|
+        read_all(reader)
+        reader.position = 4
+        last_timestamp = reader.each.to_a.last.timestamp
+        stats = reader.stats.to_h
+        assert_equal([
+                       [
+                         :n_events,
+                         :n_bytes,
+                         :n_decoded_rows,
+                         :lag,
+                         :elapsed_time,
+                         :events_per_second,
+                         :bytes_per_second,
+                         :time_with_gvl,
+                         :time_without_gvl,
+                       ],
+                       {
+                         # All events are read twice.
+                         n_events: 27 * 2,
+                         n_bytes: (File.size(next_binlog_path) - 4) * 2,
+                         # 0, 3, 2, 1 and 1 rows in each transaction.
+                         n_decoded_rows: 7,
+                         time_without_gvl: 0.0,
+                       },
+                       true,
+                     ],
+                     [
+                       stats.keys,
+                       stats.slice(:n_events,
+                                   :n_bytes,
+                                   :n_decoded_rows,
+                                   :time_without_gvl),
+                       stats[:lag] >= Time.now.to_i - last_timestamp - 1,
+                     ])
+      end
+    end
+
+    test("#reset") do
+      open_file_reader(next_binlog_path) do |reader|
+        read_all(reader)
+        stats = reader.stats
+        assert_equal([
+                       stats,
+                       {
+                         n_events: 0,
+                         n_bytes: 0,
+                         n_decoded_rows: 0,
+                         lag: nil,
+                         events_per_second: 0.0,
+                         bytes_per_second: 0.0,
+                         time_with_gvl: 0.0,
+                         time_without_gvl: 0.0,
+                       },
+                     ],
+                     [
+                       stats.reset,
+                       stats.to_h.except(:elapsed_time),
+                     ])
+      end
+    end
+
+    test("per reader") do
+      readers = Mysql2Replication::FileReader.open_parallel([
+                                                              binlog_path,
+                                                              next_binlog_path,
+                                                            ])
+      begin
+        readers[1].each.to_a
+        assert_equal([0, 27],
+                     readers.collect {|reader| reader.stats.n_events})
+      ensure
+        readers.each(&:close)
+      end
+    end
+  end
+
+  sub_test_case("filter") do
+    def read_table_events(**options)
+      open_file_reader(next_binlog_path, **options) do |reader|
+        reader.each.collect do |event|
+          case event
+          when Mysql2Replication::TableMapEvent
+            [event.class, event.table, event.filtered?]
+          when Mysql2Replication::RowsEvent
+            [event.class, event.table_id, event.rows.size]
+          end
+        end.compact
+      end
+    end
+
+    def rows_events_with_all_tables
+      [
+        # The rows event without TABLE_MAP_EVENT is always returned.
+        [Mysql2Replication::WriteRowsEvent, 100, 0],
+        [Mysql2Replication::TableMapEvent, "numbers", false],
+        [Mysql2Replication::WriteRowsEvent, 200, 3],
+        [Mysql2Replication::TableMapEvent, "logs", false],
+        [Mysql2Replication::WriteRowsEvent, 201, 2],
+        [Mysql2Replication::TableMapEvent, "numbers", false],
+        [Mysql2Replication::UpdateRowsEvent, 200, 1],
+        [Mysql2Replication::TableMapEvent, "numbers", false],
+        [Mysql2Replication::WriteRowsEvent, 200, 1],
+      ]
+    end
+
+    def rows_events_without_logs
+      events = rows_events_with_all_tables
+      events[3] = [Mysql2Replication::TableMapEvent, "logs", true]
+      events[4] = [Mysql2Replication::WriteRowsEvent, 201, 0]
+      events
+    end
+
+    test("none") do
+      assert_equal(rows_events_with_all_tables,
+                   read_table_events)
+    end
+
+    test("include_tables:") do
+      assert_equal(rows_events_without_logs,
+                   read_table_events(include_tables: ["test.numbers"]))
+    end
+
+    test("exclude_tables:") do
+      assert_equal(rows_events_without_logs,
+                   read_table_events(exclude_tables: ["test.logs"]))
+    end
+
+    test("include_tables: and exclude_tables:") do
+      # exclude_tables: wins.
+      events = read_table_events(include_tables: ["test.numbers"],
+                                 exclude_tables: ["test.numbers"])
+      assert_equal([
+                     [Mysql2Replication::WriteRowsEvent, 100, 0],
+                     [Mysql2Replication::TableMapEvent, "numbers", true],
+                     [Mysql2Replication::WriteRowsEvent, 200, 0],
+                     [Mysql2Replication::TableMapEvent, "logs", true],
+                     [Mysql2Replication::WriteRowsEvent, 201, 0],
+                   ],
+                   events[0, 5])
+    end
+
+    test("filtered rows event") do
+      open_file_reader(next_binlog_path,
+                       exclude_tables: ["test.logs"]) do |reader|
+        rows_event = reader.each.find do |event|
+          event.is_a?(Mysql2Replication::RowsEvent) and event.table_id == 201
+        end
+        assert_equal(["logs", true, []],
+                     [
+                       rows_event.table_map.table,
+                       rows_event.table_map.filtered?,
+                       rows_event.rows,
+                     ])
+      end
+    end
+
+    test("skip_filtered_events: true") do
+      events = rows_events_with_all_tables
+      events.delete_at(4)
+      events.delete_at(3)
+      assert_equal(events,
+                   read_table_events(include_tables: ["test.numbers"],
+                                     skip_filtered_events: true))
+    end
+
+    test("skip_filtered_events: true: exclude_tables:") do
+      assert_equal(rows_events_with_all_tables[0, 1] +
+                   rows_events_with_all_tables[3, 2],
+                   read_table_events(exclude_tables: ["test.numbers"],
+                                     skip_filtered_events: true))
+    end
+  end
+
+  sub_test_case("verify_checksum:") do
+    def corrupted_binlog
+      data = File.binread(binlog_path)
+      # The last byte of the XID in the first transaction.
+      data.setbyte(737, data.getbyte(737) ^ 0xff)
+      Tempfile.create(["corrupted", ".binlog"]) do |file|
+        file.binmode
+        file.write(data)
+        file.close
+        yield(file.path)
+      end
+    end
+
+    test("true") do
+      corrupted_binlog do |path|
+        message = "checksum mismatch: position: 711: #{path.inspect}"
+        assert_raise(Mysql2Replication::Error.new(message)) do
+          Mysql2Replication::FileReader.new(path, verify_checksum: true)
+        end
+      end
+    end
+
+    test("false") do
+      corrupted_binlog do |path|
+        open_file_reader(path) do |reader|
+          assert_equal(18, reader.each.count)
+        end
+      end
+    end
+  end
+end